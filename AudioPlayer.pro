@@ -4,21 +4,69 @@
 #
 #-------------------------------------------------
 
-QT       += core gui multimedia
+QT       += core gui multimedia concurrent
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
 TARGET = AudioPlayer
 TEMPLATE = app
 
+# qmake CONFIG+=allocation_counter counts the heap allocations of each thread (see AllocationCounter)
+allocation_counter: DEFINES += ALLOCATION_COUNTER
+
 
 SOURCES += main.cpp\
         mainwindow.cpp\
     wavbuffer.cpp \
-    signalplot.cpp
+    signalplot.cpp \
+    peakpyramid.cpp \
+    samplekernels.cpp \
+    editlist.cpp \
+    peakbuilder.cpp \
+    waveformtilecache.cpp \
+    waveformrasterizer.cpp \
+    audioengine.cpp \
+    playbackproducer.cpp \
+    batchprocessor.cpp \
+    benchmark.cpp \
+    renderbenchmark.cpp \
+    playbacktest.cpp \
+    parallelanalysis.cpp \
+    fft.cpp \
+    spectrogram.cpp \
+    audioprocessor.cpp \
+    planarcache.cpp \
+    fileloader.cpp \
+    allocationcounter.cpp \
+    loudnessmeter.cpp \
+    levelmeter.cpp
 
 HEADERS  += mainwindow.h \
     wavbuffer.h \
-    signalplot.h
+    signalplot.h \
+    peakpyramid.h \
+    samplekernels.h \
+    editlist.h \
+    peakbuilder.h \
+    waveformtilecache.h \
+    waveformrasterizer.h \
+    audioengine.h \
+    playbackproducer.h \
+    ringbuffer.h \
+    batchprocessor.h \
+    benchmark.h \
+    renderbenchmark.h \
+    playbacktest.h \
+    parallelanalysis.h \
+    fft.h \
+    spectrogram.h \
+    audioblock.h \
+    audioprocessor.h \
+    planarcache.h \
+    fileloader.h \
+    allocationcounter.h \
+    loudnessmeter.h \
+    snapshotbuffer.h \
+    levelmeter.h
 
 RESOURCES += application.qrc
@@ -0,0 +1,172 @@
+#include <cerrno>
+#include <cstdlib>
+#include <new>
+
+#include "allocationcounter.h"
+
+
+#ifdef ALLOCATION_COUNTER
+
+// Plain integers, so that reading them never allocates, even in a new thread
+static thread_local quint64 allocationsCount = 0;
+static thread_local quint64 freesCount       = 0;
+
+#ifdef __GLIBC__
+
+extern "C"
+{
+
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void *pointer, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void  __libc_free(void *pointer);
+
+
+void* malloc(size_t size)
+{
+    allocationsCount++;
+    return __libc_malloc(size);
+}
+
+
+void* calloc(size_t count, size_t size)
+{
+    allocationsCount++;
+    return __libc_calloc(count, size);
+}
+
+
+/* A reallocation may move the block: it counts as an allocation and a free. */
+void* realloc(void *pointer, size_t size)
+{
+    
+    if (pointer || size)
+        allocationsCount++;
+    if (pointer)
+        freesCount++;
+    
+    return __libc_realloc(pointer, size);
+    
+}
+
+
+void* memalign(size_t alignment, size_t size)
+{
+    allocationsCount++;
+    return __libc_memalign(alignment, size);
+}
+
+
+void* aligned_alloc(size_t alignment, size_t size)
+{
+    allocationsCount++;
+    return __libc_memalign(alignment, size);
+}
+
+
+int posix_memalign(void **pointer, size_t alignment, size_t size)
+{
+    
+    allocationsCount++;
+    *pointer = __libc_memalign(alignment, size);
+    
+    return *pointer ? 0 : ENOMEM;
+    
+}
+
+
+void free(void *pointer)
+{
+    
+    if (pointer)
+        freesCount++;
+    
+    __libc_free(pointer);
+    
+}
+    
+}
+
+#else  // The C++ allocations only, operator new[] and the nothrow versions forward to these ones
+
+void* operator new(std::size_t size)
+{
+    
+    allocationsCount++;
+    
+    void *pointer = std::malloc(size ? size : 1);
+    
+    if (!pointer)
+        throw std::bad_alloc();
+    
+    return pointer;
+    
+}
+
+
+void operator delete(void *pointer) noexcept
+{
+    
+    if (pointer)
+        freesCount++;
+    
+    std::free(pointer);
+    
+}
+
+
+void operator delete(void *pointer, std::size_t) noexcept
+{
+    operator delete(pointer);
+}
+
+#endif
+
+#endif  // ALLOCATION_COUNTER
+
+
+namespace AllocationCounter
+{
+
+/* Difference between the counts at two moments: the allocations made in between. */
+Counts Counts::operator-(const Counts &other) const
+{
+    
+    Counts difference;
+    
+    difference.allocations = allocations - other.allocations;
+    difference.frees       = frees - other.frees;
+    
+    return difference;
+    
+}
+
+
+/* Check if the allocations are counted in this build. */
+bool isEnabled()
+{
+#ifdef ALLOCATION_COUNTER
+    return true;
+#else
+    return false;
+#endif
+}
+
+
+/* Get the allocations and frees made by the calling thread so far. */
+Counts counts()
+{
+    
+    Counts counts;
+
+#ifdef ALLOCATION_COUNTER
+    counts.allocations = allocationsCount;
+    counts.frees       = freesCount;
+#endif
+    
+    return counts;
+    
+}
+    
+}
@@ -0,0 +1,29 @@
+#ifndef ALLOCATIONCOUNTER_H
+#define ALLOCATIONCOUNTER_H
+
+#include <QtGlobal>
+
+
+/* Count of the heap allocations made by each thread, to check that hot paths do not allocate
+ *
+ * It is only built in with CONFIG+=allocation_counter, which defines ALLOCATION_COUNTER: the allocation
+ * functions are then replaced by functions which count the calls of the calling thread and forward them.
+ * With glibc, malloc and its family are replaced, so that the buffers of Qt containers and images are counted
+ * too; elsewhere, only operator new and delete are. Without the option, the counts stay at 0.
+ */
+namespace AllocationCounter
+{
+    struct Counts
+    {
+        quint64 allocations = 0;
+        quint64 frees       = 0;
+        
+        Counts& operator+=(const Counts &other)  {allocations += other.allocations; frees += other.frees; return *this;};
+        Counts  operator-(const Counts &other) const;
+    };
+    
+    bool   isEnabled();
+    Counts counts();  // Allocations and frees made by the calling thread since it started
+}
+
+#endif // ALLOCATIONCOUNTER_H
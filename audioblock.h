@@ -0,0 +1,22 @@
+#ifndef AUDIOBLOCK_H
+#define AUDIOBLOCK_H
+
+#include <QScopedArrayPointer>
+
+#include "peakpyramid.h"
+
+
+/* Frames produced by an edit, which pieces of an EditList read instead of the frames of the file
+ *
+ * The frames have the format of the file. A block is never changed once a piece reads from it:
+ * pieces share it, and it lives as long as a state of the edit history uses it.
+ * Its peak pyramid is built with the frames, so that the waveform is drawn from it as from the file.
+ */
+struct AudioBlock
+{
+    QScopedArrayPointer<uchar> frames;
+    qint64                     framesCount = 0;
+    PeakPyramid                peaks;
+};
+
+#endif // AUDIOBLOCK_H
@@ -0,0 +1,699 @@
+#include <algorithm>
+
+#include <QAudioDeviceInfo>
+
+#include "audioengine.h"
+
+
+/* Format in which the frames of a file are played: 16-bit integers for 8 and 16-bit samples, 32-bit floats
+ * for the others, which keep the 24 bits of their mantissa. */
+static SampleKernels::SampleFormat preferredFormat(SampleKernels::SampleFormat fileFormat)
+{
+    return (fileFormat == SampleKernels::UInt8 || fileFormat == SampleKernels::Int16) ? SampleKernels::Int16 : SampleKernels::Float32;
+}
+
+
+/* Format of the frames of an audio format, if it is one in which frames are played (InvalidFormat otherwise). */
+static SampleKernels::SampleFormat playedFormat(const QAudioFormat &format)
+{
+    
+    if (format.byteOrder() != QAudioFormat::LittleEndian)
+        return SampleKernels::InvalidFormat;
+    
+    if (format.sampleType() == QAudioFormat::SignedInt && format.sampleSize() == 16)
+        return SampleKernels::Int16;
+    
+    if (format.sampleType() == QAudioFormat::Float && format.sampleSize() == 32)
+        return SampleKernels::Float32;
+    
+    return SampleKernels::InvalidFormat;
+    
+}
+
+
+PlaybackStream::PlaybackStream(RingBuffer<char> *ringBuffer, PlaybackProducer *producer)
+{
+    m_ringBuffer = ringBuffer;
+    m_producer   = producer;
+}
+
+
+/* The stream is at its end once the producer copied the last frame and it was read. */
+bool PlaybackStream::atEnd() const
+{
+    return m_producer->reachedEnd() && m_ringBuffer->readAvailable() == 0;
+}
+
+
+/* Copy as many whole frames as available and fitting in maxSize bytes. */
+qint64 PlaybackStream::readData(char *data, qint64 maxSize)
+{
+    
+    qint64 available = std::min(maxSize, m_ringBuffer->readAvailable());
+    qint64 read      = m_ringBuffer->read(data, available - available % m_bytesPerFrame);
+    
+    // The output asked for frames the producer could not provide in time
+    if (read == 0 && maxSize >= m_bytesPerFrame && !m_producer->reachedEnd())
+        m_underruns.fetchAndAddRelaxed(1);
+    
+    m_framesRead.fetchAndAddRelease(read / m_bytesPerFrame);
+    
+    if (m_sampleFormat != SampleKernels::InvalidFormat)
+        meterFrames(data, read / m_bytesPerFrame);
+    
+    return read;
+    
+}
+
+
+/* Set the format of the frames in the ring buffer, and prepare the meter and the buffers of its levels for it.
+ *
+ * It must be called before the output reads from the stream: the meter then never allocates memory. */
+void PlaybackStream::setFormat(int sampleRate, int channelsCount, SampleKernels::SampleFormat format)
+{
+    
+    m_sampleFormat  = format;
+    m_bytesPerFrame = SampleKernels::sampleSize(format) * channelsCount;
+    m_meter.setFormat(sampleRate, channelsCount, SampleKernels::significantBits(format));
+    m_meterSamples.resize(meterBlockSize * channelsCount);
+    
+    for (int i = 0; i < 3; i++)
+    {
+        m_levels.buffer(i).peaks.fill(0, channelsCount);
+        m_levels.buffer(i).rms.fill(0, channelsCount);
+    }
+    
+}
+
+
+/* Measure frames read by the output, and publish the levels when a step of the meter is completed. */
+void PlaybackStream::meterFrames(const char *data, qint64 framesCount)
+{
+    
+    if (m_meterResetRequested.fetchAndStoreAcquire(0))
+        m_meter.reset();
+    
+    qint64 stepsCount    = m_meter.stepsCount();
+    int    channelsCount = m_meter.channelsCount();
+    
+    for (qint64 frame = 0; frame < framesCount; frame += meterBlockSize)
+    {
+        qint64 count = std::min<qint64>(meterBlockSize, framesCount - frame);
+        
+        SampleKernels::deinterleave((const uchar*) data + frame * m_bytesPerFrame, count, channelsCount, m_sampleFormat,
+                                    m_meterSamples.data(), meterBlockSize);
+        m_meter.process(m_meterSamples.constData(), meterBlockSize, count);
+    }
+    
+    if (m_meter.stepsCount() != stepsCount)
+    {
+        m_meter.getLevels(m_levels.writeBuffer());
+        m_levels.publish();
+    }
+    
+}
+
+
+ClockedOutput::ClockedOutput(QIODevice *stream, QObject *parent) : QThread(parent)
+{
+    m_stream = stream;
+}
+
+
+/* The thread must be finished before the stream and the file are destroyed. */
+ClockedOutput::~ClockedOutput()
+{
+    stop();
+}
+
+
+/* Start consuming the stream, from a clock at 0 and with nothing read yet.
+ *
+ * The file is written by the thread until it is stopped: it must not be used meanwhile. */
+void ClockedOutput::start(int sampleRate, int bytesPerFrame, int periodSize, QFile *file)
+{
+    
+    stop();
+    
+    m_sampleRate    = sampleRate;
+    m_bytesPerFrame = bytesPerFrame;
+    m_periodSize    = periodSize;
+    m_file          = file;
+    m_clockFrames   = 0;
+    m_period.resize((qint64) periodSize * bytesPerFrame);
+    m_pumpedFrames.storeRelease(0);
+    m_reachedEnd.storeRelease(0);
+    
+    resume();
+    
+}
+
+
+/* Start the clock again from the frames played when the thread was stopped, and the thread with it. */
+void ClockedOutput::resume()
+{
+    
+    if (m_running)
+        return;
+    
+    m_running = true;
+    m_clock.start();
+    m_stopRequested.storeRelease(0);
+    
+    QThread::start(QThread::TimeCriticalPriority);
+    
+}
+
+
+/* Ask the thread to stop and wait for it. The clock stops at the frames played so far. */
+void ClockedOutput::stop()
+{
+    
+    m_stopRequested.storeRelease(1);
+    wait();
+    
+    m_clockFrames = playedFrames();
+    m_running     = false;
+    
+}
+
+
+/* Get the frames played according to the clock, which never go beyond the frames read from the stream. */
+qint64 ClockedOutput::playedFrames()
+{
+    
+    qint64 played = m_clockFrames;
+    
+    if (m_running)
+        played += m_clock.nsecsElapsed() * m_sampleRate / 1000000000;
+    
+    return std::min(played, m_pumpedFrames.loadAcquire());
+    
+}
+
+
+/* Main loop of the thread: read the frames due, one period ahead of the clock, then sleep for half a period. */
+void ClockedOutput::run()
+{
+    
+    unsigned long sleepTime = std::max<qint64>(100, (qint64) m_periodSize * 500000 / m_sampleRate);  // us
+    qint64        pumped    = m_pumpedFrames.loadAcquire();
+    
+    while (!m_stopRequested.loadAcquire())
+    {
+        qint64 target = m_clockFrames + m_clock.nsecsElapsed() * m_sampleRate / 1000000000 + m_periodSize;
+        
+        while (pumped < target)
+        {
+            qint64 read = m_stream->read(m_period.data(), m_period.size()) / m_bytesPerFrame;
+            
+            if (read <= 0)
+                break;
+            
+            if (m_file)
+                m_file->write(m_period.constData(), read * m_bytesPerFrame);
+            
+            pumped += read;
+            m_pumpedFrames.storeRelease(pumped);
+        }
+        
+        // Checked after the frames were counted, so that the last ones are never missed
+        if (m_stream->atEnd())
+            m_reachedEnd.storeRelease(1);
+        
+        QThread::usleep(sleepTime);
+    }
+    
+}
+
+
+/* Prepare the audio format of the WavBuffer, played in the format preferred for it. Nothing is played until an output is set. */
+AudioEngine::AudioEngine(WavBuffer *audioSource, QObject *parent) : QObject(parent),
+    m_producer(audioSource, &m_ringBuffer),
+    m_stream(&m_ringBuffer, &m_producer),
+    m_clockedOutput(&m_stream)
+{
+    
+    m_audioSource = audioSource;
+    
+    m_format.setSampleRate(m_audioSource->sampleRate());
+    m_format.setChannelCount(m_audioSource->channelsCount());
+    m_format.setCodec("audio/pcm");
+    m_format.setByteOrder(QAudioFormat::LittleEndian);
+    
+    setOutputFormat(preferredFormat(m_audioSource->sampleFormat()));
+    
+    // The stream must not be buffered: the output takes exactly the frames it needs from the ring buffer
+    m_stream.open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+    
+    // The audio device output pulls from the stream in its own thread
+    m_stream.moveToThread(&m_outputThread);
+    m_outputContext.moveToThread(&m_outputThread);
+    m_outputThread.start(QThread::TimeCriticalPriority);
+    
+    m_audioClock.start();
+    m_positionTimer.setTimerType(Qt::PreciseTimer);
+    connect(&m_positionTimer, &QTimer::timeout, this, &AudioEngine::followClockedOutput);
+    
+}
+
+
+/* The output and the producer must be stopped before the stream and the ring buffer are destroyed. */
+AudioEngine::~AudioEngine()
+{
+    
+    stopOutput();
+    onOutputThread([this]() {delete m_audioOutput;});
+    
+    m_outputThread.quit();
+    m_outputThread.wait();
+    
+}
+
+
+/* Run a function in the output thread, and wait for it to return. */
+void AudioEngine::onOutputThread(std::function<void()> function)
+{
+    QMetaObject::invokeMethod(&m_outputContext, function, Qt::BlockingQueuedConnection);
+}
+
+
+/* Choose where the frames are sent. Playback is stopped.
+ *
+ * It returns false if the output cannot be used, in which case the null output is used. */
+bool AudioEngine::setOutput(Output output, const QString &filePath)
+{
+    
+    stop();
+    
+    onOutputThread([this]() {delete m_audioOutput;});
+    m_audioOutput = nullptr;
+    m_file.close();
+    
+    m_outputType = output;
+    
+    SampleKernels::SampleFormat preferred = preferredFormat(m_audioSource->sampleFormat());
+    setOutputFormat(preferred);
+    
+    if (output == DeviceOutput)
+    {
+        QAudioDeviceInfo device = QAudioDeviceInfo::defaultOutputDevice();
+        
+        // Without the preferred format, the sample type nearest to it for the device is tried, then the other format
+        if (!device.isNull() && !device.isFormatSupported(m_format))
+        {
+            SampleKernels::SampleFormat nearest = playedFormat(device.nearestFormat(m_format));
+            SampleKernels::SampleFormat other   = (preferred == SampleKernels::Int16) ? SampleKernels::Float32 : SampleKernels::Int16;
+            
+            setOutputFormat(nearest != SampleKernels::InvalidFormat ? nearest : other);
+            
+            if (!device.isFormatSupported(m_format) && m_outputFormat != other)
+                setOutputFormat(other);
+        }
+        
+        if (device.isNull() || !device.isFormatSupported(m_format))
+        {
+            m_error      = "The audio format is not supported by the output device";
+            m_outputType = NullOutput;
+            setOutputFormat(preferred);
+            return false;
+        }
+        
+        onOutputThread([this, device]() {m_audioOutput = new QAudioOutput(device, m_format);});
+        
+        // The played time is read in the output thread, where the output must be accessed, then sent to this thread
+        connect(m_audioOutput, &QAudioOutput::notify, &m_outputContext, [this]() {
+            int    run            = m_outputRun.loadAcquire();
+            qint64 processedUSecs = m_audioOutput->processedUSecs();
+            qint64 time           = m_audioClock.nsecsElapsed();
+            QMetaObject::invokeMethod(this, [=]() {setDeviceClock(run, processedUSecs, time);}, Qt::QueuedConnection);
+        });
+        connect(m_audioOutput, &QAudioOutput::stateChanged, this, &AudioEngine::handleOutputState);
+    }
+    else if (output == FileOutput)
+    {
+        m_file.setFileName(filePath);
+        
+        if (!m_file.open(QFile::WriteOnly))
+        {
+            m_error      = "Cannot open the output file";
+            m_outputType = NullOutput;
+            return false;
+        }
+    }
+    
+    return true;
+    
+}
+
+
+/* Set the number of frames pulled at once. It is used the next time the output is started.
+ *
+ * The output buffers periodsCount periods, which gives the latency of the playback. */
+void AudioEngine::setPeriodSize(int framesCount)
+{
+    m_periodSize = std::max(framesCount, 16);
+}
+
+
+/* Play the frames in a given format, Int16 or Float32: the producer converts them to it, the stream and the output read them in it.
+ *
+ * The output and the producer must be stopped. */
+void AudioEngine::setOutputFormat(SampleKernels::SampleFormat format)
+{
+    
+    m_outputFormat    = format;
+    m_outputFrameSize = SampleKernels::sampleSize(format) * m_audioSource->channelsCount();
+    
+    m_format.setSampleSize(8 * SampleKernels::sampleSize(format));
+    m_format.setSampleType(format == SampleKernels::Float32 ? QAudioFormat::Float : QAudioFormat::SignedInt);
+    
+    m_producer.setOutputFormat(format);
+    m_stream.setFormat(m_audioSource->sampleRate(), m_audioSource->channelsCount(), format);
+    
+}
+
+
+/* Get the logical frame being played. */
+qint64 AudioEngine::position()
+{
+    
+    if (!m_outputStarted)
+        return m_stopFrame;
+    
+    return m_startFrame + playedFrames();
+    
+}
+
+
+/* Get the time between a frame being pulled from the ring buffer and being played, in ms. */
+double AudioEngine::latency()
+{
+    
+    if (!m_outputStarted)
+        return 0;
+    
+    return (m_stream.framesRead() - playedFrames()) * 1000.0 / m_audioSource->sampleRate();
+    
+}
+
+
+/* Get the number of frames played since the output was started.
+ *
+ * For the audio device output, the time played given at the last notification is interpolated
+ * with the time elapsed since then, so that the position moves smoothly between notifications.
+ * It never goes beyond the frames pulled by the output, nor goes back. */
+qint64 AudioEngine::playedFrames()
+{
+    
+    qint64 sampleRate = m_audioSource->sampleRate();
+    
+    if (m_audioOutput)
+    {
+        qint64 usecs = m_clockUSecs;
+        
+        if (m_state == PlayingState)
+            usecs += (m_audioClock.nsecsElapsed() - m_clockTime) / 1000;
+        
+        qint64 played = std::min(usecs * sampleRate / 1000000, m_stream.framesRead());
+        m_lastPlayed  = std::max(m_lastPlayed, played);
+        
+        return m_lastPlayed;
+    }
+    
+    // The null and file outputs play at the rate given by their clock, as long as frames were pulled
+    return m_clockedOutput.playedFrames();
+    
+}
+
+
+/* Start or resume the playback. It returns false if the output could not be started. */
+bool AudioEngine::play()
+{
+    
+    if (m_state == PlayingState)
+        return true;
+    
+    if (m_audioSource->framesCount() == 0)
+    {
+        m_error = "There is no audio to play";
+        return false;
+    }
+    
+    // Play from the start again once the end was reached
+    if (!m_outputStarted && m_stopFrame >= m_audioSource->framesCount())
+        m_stopFrame = 0;
+    
+    if (!m_outputStarted)
+    {
+        startOutput();
+    }
+    else if (m_audioOutput)
+    {
+        onOutputThread([this]() {m_audioOutput->resume();});
+        m_clockTime = m_audioClock.nsecsElapsed();
+    }
+    else
+    {
+        m_clockedOutput.resume();
+        m_positionTimer.start();
+    }
+    
+    QAudio::Error error = QAudio::NoError;
+    
+    if (m_audioOutput)
+        onOutputThread([this, &error]() {error = m_audioOutput->error();});
+    
+    if (error != QAudio::NoError)
+    {
+        m_error = "Cannot start the audio output";
+        stopOutput();
+        return false;
+    }
+    
+    setState(PlayingState);
+    
+    return true;
+    
+}
+
+
+/* Pause the playback, keeping the frames already pulled by the output. */
+void AudioEngine::pause()
+{
+    
+    if (m_state != PlayingState)
+        return;
+    
+    if (m_audioOutput)
+    {
+        qint64 processedUSecs;
+        
+        onOutputThread([this, &processedUSecs]() {
+            m_audioOutput->suspend();
+            processedUSecs = m_audioOutput->processedUSecs();
+        });
+        
+        setDeviceClock(m_outputRun.loadAcquire(), processedUSecs, m_audioClock.nsecsElapsed());
+    }
+    else
+    {
+        m_clockedOutput.stop();
+        m_positionTimer.stop();
+    }
+    
+    setState(PausedState);
+    
+}
+
+
+/* Stop the playback and go back to the first frame. */
+void AudioEngine::stop()
+{
+    
+    stopOutput();
+    m_stopFrame = 0;
+    m_stream.resetMeter();
+    
+    setState(StoppedState);
+    emit positionChanged(0);
+    
+}
+
+
+/* Move the playback to a given logical frame.
+ *
+ * The frames already buffered are dropped, so that the next frame heard is exactly the given one. */
+void AudioEngine::seek(qint64 frame)
+{
+    
+    stopOutput();
+    m_stopFrame = qBound<qint64>(0, frame, m_audioSource->framesCount());
+    
+    if (m_state == PlayingState)
+        startOutput();
+    
+    emit positionChanged(m_stopFrame);
+    
+}
+
+
+/* Set the volume from a slider value between 0 and 100. */
+void AudioEngine::setVolume(int volume)
+{
+    
+    m_volume = QAudio::convertVolume(volume / 100.0, QAudio::LogarithmicVolumeScale, QAudio::LinearVolumeScale);
+    
+    if (m_audioOutput)
+        onOutputThread([this]() {m_audioOutput->setVolume(m_volume);});
+    
+}
+
+
+/* Give the new edits of the WavBuffer to the producer, after a cut, undo or redo.
+ *
+ * If the output is started, the buffered frames are dropped and playback goes on from the same position. */
+void AudioEngine::refreshEdits()
+{
+    
+    m_producer.setEdits(m_audioSource->edits());
+    
+    if (m_outputStarted)
+        seek(position());
+    else
+        m_stopFrame = std::min(m_stopFrame, m_audioSource->framesCount());
+    
+}
+
+
+/* Start the producer and the output from m_stopFrame. */
+void AudioEngine::startOutput()
+{
+    
+    qint64 periodBytes = (qint64) m_periodSize * m_outputFrameSize;
+    int    periodTime  = std::max<qint64>(1, (qint64) m_periodSize * 1000 / m_audioSource->sampleRate());  // ms
+    qint64 ringBytes   = (qint64) m_audioSource->sampleRate() * ringBufferTime / 1000 * m_outputFrameSize;
+    
+    m_startFrame    = m_stopFrame;
+    m_outputStarted = true;
+    
+    // The ring buffer holds at least the periods of the output and one more
+    m_ringBuffer.reset(std::max(ringBytes, periodBytes * (periodsCount + 1)));
+    m_stream.resetFramesRead();
+    m_outputRun.fetchAndAddOrdered(1);
+    m_clockUSecs = 0;
+    m_lastPlayed = 0;
+    m_producer.start(m_startFrame, m_periodSize);
+    
+    // Let the producer fill the buffer of the output first, so that it does not start with an underrun
+    QElapsedTimer primeTime;
+    primeTime.start();
+    
+    while (m_ringBuffer.readAvailable() < periodBytes * periodsCount && !m_producer.reachedEnd() && primeTime.elapsed() < 100)
+        QThread::usleep(200);
+    
+    if (m_audioOutput)
+    {
+        onOutputThread([this, periodBytes, periodTime]() {
+            m_audioOutput->setBufferSize(periodBytes * periodsCount);
+            m_audioOutput->setNotifyInterval(periodTime);
+            m_audioOutput->setVolume(m_volume);
+            m_audioOutput->start(&m_stream);
+        });
+        
+        m_clockTime = m_audioClock.nsecsElapsed();
+    }
+    else
+    {
+        m_clockedOutput.start(m_audioSource->sampleRate(), m_outputFrameSize, m_periodSize, m_file.isOpen() ? &m_file : nullptr);
+        m_positionTimer.start(periodTime);
+    }
+    
+}
+
+
+/* Stop the output and the producer, dropping the frames not played yet. */
+void AudioEngine::stopOutput()
+{
+    
+    // Cleared first: the stop of the audio output must not be taken for the end of the audio
+    m_outputStarted = false;
+    
+    if (m_audioOutput)
+        onOutputThread([this]() {m_audioOutput->stop();});
+    
+    m_positionTimer.stop();
+    m_clockedOutput.stop();
+    m_producer.stop();
+    
+}
+
+
+/* Give the position of the null and file outputs, once per period, and stop once their last frame was played. */
+void AudioEngine::followClockedOutput()
+{
+    
+    notifyPosition();
+    
+    if (m_clockedOutput.reachedEnd() && m_clockedOutput.playedFrames() >= m_clockedOutput.pumpedFrames())
+        stop();
+    
+}
+
+
+/* The audio output becomes idle when the stream has no more frames: the end of the audio may be reached. */
+void AudioEngine::handleOutputState(QAudio::State state)
+{
+    
+    if (!m_outputStarted)
+        return;
+    
+    QAudio::Error error = QAudio::NoError;
+    onOutputThread([this, &error]() {error = m_audioOutput->error();});
+    
+    if (state == QAudio::IdleState && m_stream.atEnd())
+    {
+        stop();
+    }
+    else if (state == QAudio::StoppedState && error != QAudio::NoError)
+    {
+        m_error = "The audio output stopped because of an error";
+        stop();
+    }
+    
+}
+
+
+/* Update the clock of the audio device output with the time it played, measured at a given time.
+ *
+ * Notifications of a previous run of the output, received after a seek, are ignored. */
+void AudioEngine::setDeviceClock(int run, qint64 processedUSecs, qint64 time)
+{
+    
+    if (run != m_outputRun.loadAcquire() || !m_outputStarted)
+        return;
+    
+    m_clockUSecs = processedUSecs;
+    m_clockTime  = time;
+    
+    notifyPosition();
+    
+}
+
+
+void AudioEngine::notifyPosition()
+{
+    emit positionChanged(position());
+}
+
+
+void AudioEngine::setState(State state)
+{
+    
+    if (state == m_state)
+        return;
+    
+    m_state = state;
+    emit stateChanged(state);
+    
+}
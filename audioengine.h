@@ -0,0 +1,245 @@
+#ifndef AUDIOENGINE_H
+#define AUDIOENGINE_H
+
+#include <QAtomicInteger>
+#include <QAudioOutput>
+#include <QElapsedTimer>
+#include <functional>
+#include <QFile>
+#include <QIODevice>
+#include <QObject>
+#include <QThread>
+#include <QTimer>
+
+#include "loudnessmeter.h"
+#include "playbackproducer.h"
+#include "ringbuffer.h"
+#include "snapshotbuffer.h"
+#include "wavbuffer.h"
+
+
+/* Sequential device which gives the frames of the playback ring buffer
+ *
+ * The audio output pulls from it: reading never blocks. When the ring buffer runs out
+ * before the producer reached the end of the audio, an underrun is counted.
+ * Only whole frames are read.
+ *
+ * The frames read are measured by a LoudnessMeter, in the thread which pulls them, before the volume
+ * of the output is applied. At the end of each step of the meter (100 ms of audio), its levels are
+ * published through a SnapshotBuffer, which the GUI thread reads without ever blocking the output. */
+class PlaybackStream : public QIODevice
+{
+    
+public:
+    PlaybackStream(RingBuffer<char> *ringBuffer, PlaybackProducer *producer);
+    
+    static const int meterBlockSize = 1024;  // Frames decoded at once for the meter
+    
+    void   setFormat(int sampleRate, int channelsCount, SampleKernels::SampleFormat format);
+    void   resetMeter()             {m_meterResetRequested.storeRelease(1);};
+    bool   updateLevels()           {return m_levels.update();};
+    const LoudnessMeter::Levels& levels()  {return m_levels.readBuffer();};
+    
+    qint64 framesRead()             {return m_framesRead.loadAcquire();};
+    int    underrunsCount()         {return m_underruns.loadAcquire();};
+    void   resetFramesRead()        {m_framesRead.storeRelease(0);};
+    
+    bool isSequential() const       {return true;};
+    bool atEnd() const;
+    
+protected:
+    qint64 readData(char *data, qint64 maxSize);
+    qint64 writeData(const char*, qint64)   {return -1;};
+    
+private:
+    RingBuffer<char>       *m_ringBuffer;
+    PlaybackProducer       *m_producer;
+    int                     m_bytesPerFrame = 0;
+    QAtomicInteger<qint64>  m_framesRead;  // Frames read since the output was started
+    QAtomicInt              m_underruns;
+    
+    // Meter of the frames read, only used by the thread which reads once the format is set
+    LoudnessMeter                         m_meter;
+    SampleKernels::SampleFormat           m_sampleFormat = SampleKernels::InvalidFormat;
+    QVector<int>                          m_meterSamples;  // Samples of meterBlockSize frames, channel by channel
+    SnapshotBuffer<LoudnessMeter::Levels> m_levels;
+    QAtomicInt                            m_meterResetRequested;
+    
+    void meterFrames(const char *data, qint64 framesCount);
+    
+};
+
+
+/* Worker thread which consumes the playback stream at the audio rate, for the null and file outputs
+ *
+ * A clock gives the frames due since the output was started: the thread reads them from the stream,
+ * one period ahead of the clock, then sleeps for half a period. The frames are written to a file if one
+ * is given, or dropped. Reading never waits for the GUI thread, so the producer must keep up with the
+ * clock as with an audio device: otherwise the stream counts underruns.
+ */
+class ClockedOutput : public QThread
+{
+    
+public:
+    ClockedOutput(QIODevice *stream, QObject *parent = 0);
+    ~ClockedOutput();
+    
+    void start(int sampleRate, int bytesPerFrame, int periodSize, QFile *file);
+    void resume();
+    void stop();
+    
+    qint64 playedFrames();
+    qint64 pumpedFrames()  {return m_pumpedFrames.loadAcquire();};
+    bool   reachedEnd()    {return m_reachedEnd.loadAcquire();};
+    
+protected:
+    void run();
+    
+private:
+    QIODevice *m_stream;
+    QFile     *m_file          = nullptr;  // Null for the null output
+    int        m_sampleRate    = 0;
+    int        m_bytesPerFrame = 0;
+    int        m_periodSize    = 0;
+    QByteArray m_period;
+    
+    // The clock is only changed while the thread is stopped
+    QElapsedTimer m_clock;
+    qint64        m_clockFrames = 0;      // Frames played when the clock was started
+    bool          m_running     = false;  // The clock runs
+    
+    QAtomicInt             m_stopRequested;
+    QAtomicInteger<qint64> m_pumpedFrames;  // Frames read from the stream since the output was started
+    QAtomicInt             m_reachedEnd;    // The stream was at its end after the last frames were read
+    
+};
+
+
+/* Playback engine which plays the edited audio of a WavBuffer
+ *
+ * A PlaybackProducer thread copies the frames into a ring buffer, in periods of a configurable
+ * size, and the output consumes them. The audio device output lives in its own thread, so
+ * neither the device nor the producer ever wait for the GUI thread.
+ * Positions are given in frames, so seeking is sample-accurate.
+ *
+ * The frames are played as 16-bit integers or 32-bit floats, whatever the format of the file:
+ * the producer converts them, and the format is chosen among both for the audio device.
+ * The frames can be sent to the default audio device, or to a null or file output
+ * which consume them in real time in a thread of their own (see ClockedOutput): this allows
+ * running without an audio device. The file output writes raw PCM frames in the played format,
+ * without a header.
+ *
+ * The levels of the frames played are measured as they are pulled by the output (see PlaybackStream):
+ * updateLevels takes the last levels published, at most every 100 ms of audio. The meter starts
+ * again each time the playback is stopped.
+ */
+class AudioEngine : public QObject
+{
+    
+    Q_OBJECT
+    
+public:
+    enum State
+    {
+        StoppedState,
+        PlayingState,
+        PausedState
+    };
+    Q_ENUM(State)
+    
+    enum Output
+    {
+        DeviceOutput,  // Default audio output device
+        NullOutput,    // Frames are consumed and dropped
+        FileOutput     // Frames are consumed and written to a file
+    };
+    
+    static const int defaultPeriodSize = 512;  // frames
+    static const int periodsCount      = 3;    // Periods buffered by the output
+    static const int ringBufferTime    = 250;  // ms of audio buffered by the producer
+    
+    AudioEngine(WavBuffer *audioSource, QObject *parent = 0);
+    ~AudioEngine();
+    
+    bool setOutput(Output output, const QString &filePath = QString());
+    void setPeriodSize(int framesCount);
+    
+    // Getters
+    State       state()      {return m_state;};
+    Output      output()     {return m_outputType;};
+    int         periodSize() {return m_periodSize;};
+    SampleKernels::SampleFormat outputFormat()  {return m_outputFormat;};  // Format of the frames played
+    const char* error()      {return m_error;};
+    
+    qint64 position();
+    double latency();
+    int    underrunsCount()  {return m_stream.underrunsCount();};
+    int    overrunsCount()   {return m_ringBuffer.overrunsCount();};
+    
+    // Levels of the audio played, to read from the GUI thread only
+    bool updateLevels()                    {return m_stream.updateLevels();};
+    const LoudnessMeter::Levels& levels()  {return m_stream.levels();};
+    
+public slots:
+    bool play();
+    void pause();
+    void stop();
+    void seek(qint64 frame);
+    void setVolume(int volume);
+    void refreshEdits();
+    
+signals:
+    void positionChanged(qint64 frame);
+    void stateChanged(AudioEngine::State state);
+    
+private slots:
+    void followClockedOutput();
+    void handleOutputState(QAudio::State state);
+    void notifyPosition();
+    
+private:
+    WavBuffer        *m_audioSource;
+    RingBuffer<char>  m_ringBuffer;
+    PlaybackProducer  m_producer;
+    PlaybackStream    m_stream;
+    State             m_state      = StoppedState;
+    Output            m_outputType = NullOutput;
+    int               m_periodSize = defaultPeriodSize;
+    SampleKernels::SampleFormat m_outputFormat = SampleKernels::Int16;
+    int               m_outputFrameSize = 0;  // Bytes per frame in m_outputFormat
+    qreal             m_volume     = 1.0;
+    const char       *m_error      = "";
+    
+    qint64 m_startFrame    = 0;      // Logical frame at which the output was started
+    qint64 m_stopFrame     = 0;      // Logical frame played next while the output is stopped
+    bool   m_outputStarted = false;  // The output was started, and may be paused
+    
+    // Audio device output, which lives in m_outputThread
+    QAudioFormat           m_format;
+    QAudioOutput          *m_audioOutput = nullptr;
+    QThread                m_outputThread;
+    QObject                m_outputContext;   // Lives in m_outputThread, to run functions there
+    QAtomicInt             m_outputRun;       // Incremented each time the output is started
+    
+    // Clock of the audio device output: the time played at the last notification, interpolated since then
+    QElapsedTimer m_audioClock;
+    qint64        m_clockUSecs  = 0;  // Time played by the output at m_clockTime
+    qint64        m_clockTime   = 0;  // ns, on m_audioClock
+    qint64        m_lastPlayed  = 0;  // Last value of playedFrames, which never goes back
+    
+    // Null and file outputs: frames are pulled by a thread at the audio rate, followed by a timer for the position
+    ClockedOutput m_clockedOutput;
+    QTimer        m_positionTimer;
+    QFile         m_file;
+    
+    qint64 playedFrames();
+    void   setDeviceClock(int run, qint64 processedUSecs, qint64 time);
+    void   startOutput();
+    void   stopOutput();
+    void   setState(State state);
+    void   setOutputFormat(SampleKernels::SampleFormat format);
+    void   onOutputThread(std::function<void()> function);
+    
+};
+
+#endif // AUDIOENGINE_H
@@ -0,0 +1,265 @@
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <new>
+
+#include "audioprocessor.h"
+#include "parallelanalysis.h"
+
+
+// Frames analysed between two checks of the stop request, when the whole range must be scanned
+static const qint64 analysisStep = 16 * ParallelAnalysis::blockSize;
+
+
+/* The peak of the range is read here, in the thread of the WavBuffer, which owns the peak pyramids. */
+AudioProcessor::AudioProcessor(WavBuffer *audioSource, Operation operation, qint64 startFrame, qint64 endFrame, double gain, QObject *parent) :
+    QThread(parent), m_audioSource(audioSource), m_edits(*audioSource->edits()), m_operation(operation), m_gain(gain)
+{
+    
+    m_startFrame = std::max<qint64>(startFrame, 0);
+    m_endFrame   = std::min(endFrame, audioSource->framesCount());
+    
+    if (m_operation != Normalize)
+        return;
+    
+    for (int channel = 0; channel < audioSource->channelsCount(); channel++)
+    {
+        int min, max;
+        
+        if (!audioSource->getMinMaxSampleValueInRange(m_startFrame, m_endFrame - m_startFrame, channel, min, max))
+        {
+            m_peak = -1;  // The samples will be scanned
+            return;
+        }
+        
+        m_peak = std::max<double>(m_peak, std::max(-(qint64) min, (qint64) max));
+    }
+    
+    // Floating point samples are clamped to full scale in the pyramids: louder ones must be scanned
+    if (isFloat() && m_peak >= 2147483647.0)
+        m_peak = -1;
+    
+}
+
+
+/* The thread reads the WavBuffer: it must be finished before the WavBuffer is deleted. */
+AudioProcessor::~AudioProcessor()
+{
+    stop();
+}
+
+
+/* Ask the thread to stop and wait for it. Nothing is applied afterwards, unless it had finished already. */
+void AudioProcessor::stop()
+{
+    m_stopRequested.storeRelease(1);
+    wait();
+}
+
+
+/* Replace the range by the processed frames, once the thread is finished.
+ *
+ * It returns false if the processing did not complete: it was stopped, or failed (see error()). */
+bool AudioProcessor::apply()
+{
+    
+    wait();
+    
+    if (!m_finished.loadAcquire())
+        return false;
+    
+    m_audioSource->replaceFrames(m_startFrame, m_endFrame, m_block);
+    
+    return true;
+    
+}
+
+
+/* Main function of the thread: find the parameters of the gain ramp, then process the frames. */
+void AudioProcessor::run()
+{
+    
+    qint64          framesCount = m_endFrame - m_startFrame;
+    int             channels    = m_audioSource->channelsCount();
+    QVector<double> offsets(channels, 0.0);
+    bool            scan        = (m_operation == RemoveDcOffset || (m_operation == Normalize && m_peak < 0));
+    
+    if (framesCount <= 0)
+        return;
+    
+    m_framesTotal = scan ? 2 * framesCount : framesCount;
+    
+    if (scan && !analyse(offsets))
+        return;
+    
+    // Gain of the first frame and change of the gain from a frame to the next one
+    double startGain = 1;
+    double gainStep  = 0;
+    double rampStep  = 1.0 / std::max<qint64>(framesCount - 1, 1);
+    
+    switch (m_operation)
+    {
+        case Gain:
+            startGain = m_gain;
+            break;
+        case FadeIn:
+            startGain = 0;
+            gainStep  = rampStep;
+            break;
+        case FadeOut:
+            startGain = 1;
+            gainStep  = -rampStep;
+            break;
+        case Normalize:
+        {
+            double fullScale = std::ldexp(1.0, SampleKernels::significantBits(m_audioSource->sampleFormat()) - 1) - 1;
+            startGain = (m_peak > 0) ? fullScale / m_peak : 1;
+            offsets.fill(0);
+            break;
+        }
+        case RemoveDcOffset:
+            break;
+    }
+    
+    if (process(offsets, startGain, gainStep))
+        m_finished.storeRelease(1);
+    
+}
+
+
+/* Scan the samples of the range for the mean of each channel, and its peak for Normalize.
+ *
+ * The statistics are computed on all the cores, by steps so that the scan can be stopped. It returns false if it was. */
+bool AudioProcessor::analyse(QVector<double> &means)
+{
+    
+    // The statistics give decoded samples, clamped to full scale for floating point samples: their peak is read from the frames
+    if (m_operation == Normalize && isFloat())
+        return scanFloatPeak();
+    
+    QVector<ParallelAnalysis::ChannelStatistics> total(means.size());
+    
+    for (qint64 frame = m_startFrame; frame < m_endFrame; frame += analysisStep)
+    {
+        if (m_stopRequested.loadAcquire())
+            return false;
+        
+        qint64 end = std::min(frame + analysisStep, m_endFrame);
+        
+        QVector<ParallelAnalysis::ChannelStatistics> step = ParallelAnalysis::statistics(m_audioSource, frame, end, &m_edits);
+        
+        for (int channel = 0; channel < means.size(); channel++)
+        {
+            ParallelAnalysis::ChannelStatistics &channelTotal = total[channel];
+            
+            channelTotal.min          = channelTotal.framesCount ? std::min(channelTotal.min, step[channel].min) : step[channel].min;
+            channelTotal.max          = channelTotal.framesCount ? std::max(channelTotal.max, step[channel].max) : step[channel].max;
+            channelTotal.framesCount += step[channel].framesCount;
+            channelTotal.sum         += step[channel].sum;
+        }
+        
+        addProgress(end - frame);
+    }
+    
+    for (int channel = 0; channel < means.size(); channel++)
+    {
+        means[channel] = total[channel].mean();
+        m_peak         = std::max<double>(m_peak, std::max(-(qint64) total[channel].min, (qint64) total[channel].max));
+    }
+    
+    return true;
+    
+}
+
+
+/* Read the highest absolute value of the floating point samples of the range, which may be above full scale.
+ *
+ * It returns false if the thread was stopped. */
+bool AudioProcessor::scanFloatPeak()
+{
+    
+    int        bytesPerFrame = m_audioSource->bytesPerFrame();
+    QByteArray frames;
+    
+    frames.resize(PeakPyramid::chunkSize * bytesPerFrame);
+    m_peak = 0;
+    
+    for (qint64 frame = m_startFrame; frame < m_endFrame; frame += PeakPyramid::chunkSize)
+    {
+        if (m_stopRequested.loadAcquire())
+            return false;
+        
+        qint64 count = std::min(PeakPyramid::chunkSize, m_endFrame - frame);
+        
+        m_audioSource->readFrames(frame, frames.data(), count, &m_edits);
+        m_peak = std::max(m_peak, SampleKernels::peak((const uchar*) frames.constData(), count, m_audioSource->channelsCount(),
+                                                       m_audioSource->sampleFormat()));
+        addProgress(count);
+    }
+    
+    return true;
+    
+}
+
+
+/* Copy the frames of the range into a new block and process them, chunk by chunk.
+ *
+ * It returns false if there is not enough memory for the block or if the thread was stopped. */
+bool AudioProcessor::process(const QVector<double> &offsets, double startGain, double gainStep)
+{
+    
+    qint64                      framesCount   = m_endFrame - m_startFrame;
+    int                         bytesPerFrame = m_audioSource->bytesPerFrame();
+    SampleKernels::SampleFormat format        = m_audioSource->sampleFormat();
+    
+    m_block = QSharedPointer<AudioBlock>(new AudioBlock);
+    m_block->framesCount = framesCount;
+    m_block->frames.reset(new (std::nothrow) uchar[framesCount * bytesPerFrame]);
+    
+    if (!m_block->frames.data())
+    {
+        m_error = "Not enough memory to process the selection";
+        return false;
+    }
+    
+    m_block->peaks.allocate(m_audioSource->channelsCount(), framesCount);
+    
+    for (qint64 chunk = 0; chunk < m_block->peaks.chunksCount(); chunk++)
+    {
+        if (m_stopRequested.loadAcquire())
+            return false;
+        
+        qint64 first  = chunk * PeakPyramid::chunkSize;
+        qint64 count  = std::min(PeakPyramid::chunkSize, framesCount - first);
+        uchar *frames = m_block->frames.data() + first * bytesPerFrame;
+        
+        m_audioSource->readFrames(m_startFrame + first, (char*) frames, count, &m_edits);
+        SampleKernels::applyGain(frames, frames, count, m_audioSource->channelsCount(), format, offsets.constData(),
+                                 startGain + gainStep * first, gainStep);
+        
+        m_block->peaks.buildChunk(m_block->frames.data(), format, chunk);
+        addProgress(count);
+    }
+    
+    m_block->peaks.buildUpperLevels();
+    
+    return true;
+    
+}
+
+
+/* Count frames done by a pass, and report the progress when its percentage changes. */
+void AudioProcessor::addProgress(qint64 framesCount)
+{
+    
+    m_framesDone += framesCount;
+    
+    int percent = (int) (100 * m_framesDone / m_framesTotal);
+    
+    if (percent != m_lastPercent)
+    {
+        m_lastPercent = percent;
+        emit progressChanged(percent);
+    }
+    
+}
@@ -0,0 +1,86 @@
+#ifndef AUDIOPROCESSOR_H
+#define AUDIOPROCESSOR_H
+
+#include <QAtomicInt>
+#include <QSharedPointer>
+#include <QThread>
+#include <QVector>
+
+#include "audioblock.h"
+#include "editlist.h"
+#include "wavbuffer.h"
+
+
+/* Worker thread which processes the samples of a range of frames of a WavBuffer
+ *
+ * Every operation is a gain, which may ramp linearly over the range, applied after removing an offset
+ * from each channel (see SampleKernels::applyGain):
+ * - Gain multiplies the samples by a constant gain
+ * - FadeIn and FadeOut ramp the gain from 0 to 1, or from 1 to 0
+ * - Normalize brings the highest peak of the range to full scale, with the same gain for all the channels.
+ *   The peak is read from the peak pyramids: the samples are only scanned if they are not computed yet
+ * - RemoveDcOffset subtracts the mean of each channel over the range
+ *
+ * The frames are copied into a new AudioBlock and processed there in place, by chunks of the peak pyramid,
+ * whose levels are built as soon as their frames are processed. The thread works on a copy of the edit
+ * list, and can be stopped between two chunks. Once it is finished, apply() replaces the range by the
+ * block, in the thread of the WavBuffer: the audio data of the file is never modified, and undo works as for a cut.
+ */
+class AudioProcessor : public QThread
+{
+    
+    Q_OBJECT
+    
+public:
+    enum Operation
+    {
+        Gain,
+        FadeIn,
+        FadeOut,
+        Normalize,
+        RemoveDcOffset
+    };
+    
+    AudioProcessor(WavBuffer *audioSource, Operation operation, qint64 startFrame, qint64 endFrame, double gain = 1, QObject *parent = 0);
+    ~AudioProcessor();
+    
+    const char* error()  {return m_error;};
+    
+    void stop();
+    bool apply();
+    
+signals:
+    void progressChanged(int percent);
+    
+protected:
+    void run();
+    
+private:
+    WavBuffer *m_audioSource;
+    EditList   m_edits;  // Copy of the edits when the processing was asked for
+    Operation  m_operation;
+    qint64     m_startFrame;
+    qint64     m_endFrame;
+    double     m_gain;
+    double     m_peak = -1;  // Highest absolute decoded sample of the range, for Normalize (-1 if the pyramids could not give it)
+    
+    QSharedPointer<AudioBlock> m_block;
+    const char                *m_error = "";
+    
+    QAtomicInt m_stopRequested;
+    QAtomicInt m_finished;  // Set when all the frames are processed
+    
+    // Progress over all the passes on the frames
+    qint64 m_framesDone  = 0;
+    qint64 m_framesTotal = 0;
+    int    m_lastPercent = -1;
+    
+    bool isFloat()  {return m_audioSource->sampleFormat() == SampleKernels::Float32 || m_audioSource->sampleFormat() == SampleKernels::Float64;};
+    bool analyse(QVector<double> &means);
+    bool scanFloatPeak();
+    bool process(const QVector<double> &offsets, double startGain, double gainStep);
+    void addProgress(qint64 framesCount);
+    
+};
+
+#endif // AUDIOPROCESSOR_H
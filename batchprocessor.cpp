@@ -0,0 +1,301 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QRegularExpression>
+#include <QSaveFile>
+#include <QTextStream>
+#include <QThreadPool>
+
+#include "batchprocessor.h"
+#include "parallelanalysis.h"
+#include "wavbuffer.h"
+
+
+const char *BatchProcessor::usage =
+    "Usage: AudioPlayer --batch [options] --output <directory> <file.wav>...\n"
+    "       AudioPlayer --batch [options] --loudness <file.wav>...\n"
+    "\n"
+    "Options:\n"
+    "  --output <directory>  Directory where the edited files are written\n"
+    "  --loudness            Measure the loudness of the files (EBU R128) instead of exporting them\n"
+    "  --cut <start>:<end>   Remove the frames [start, end) of the original files (may be repeated)\n"
+    "  --cuts <file>         Read cuts from a file, one \"<start> <end>\" pair per line\n"
+    "  --jobs <count>        Number of files processed in parallel (default: one per core)\n";
+
+
+/* Read the arguments given after --batch.
+ *
+ * It returns false if they are invalid, the reason is given by error(). */
+bool BatchProcessor::parseArguments(const QStringList &arguments)
+{
+    
+    // The first argument is the program name
+    for (int i = 1; i < arguments.size(); i++)
+    {
+        const QString &argument = arguments.at(i);
+        bool           hasValue = i + 1 < arguments.size();
+        
+        if (argument == "--batch")
+        {
+            continue;
+        }
+        else if (argument == "--loudness")
+        {
+            m_loudness = true;
+        }
+        else if (argument == "--output" && hasValue)
+        {
+            m_outputDirectory = arguments.at(++i);
+        }
+        else if (argument == "--cut" && hasValue)
+        {
+            QStringList bounds = arguments.at(++i).split(':');
+            
+            if (bounds.size() != 2 || !addCut(bounds.at(0), bounds.at(1)))
+                return false;
+        }
+        else if (argument == "--cuts" && hasValue)
+        {
+            if (!readCutList(arguments.at(++i)))
+                return false;
+        }
+        else if (argument == "--jobs" && hasValue)
+        {
+            bool ok;
+            m_jobsCount = arguments.at(++i).toInt(&ok);
+            
+            if (!ok || m_jobsCount < 1)
+            {
+                m_error = "Invalid jobs count";
+                return false;
+            }
+        }
+        else if (argument.startsWith("--"))
+        {
+            m_error = "Unknown option or missing value";
+            return false;
+        }
+        else
+        {
+            m_inputPaths.append(argument);
+        }
+    }
+    
+    if (m_inputPaths.isEmpty())
+    {
+        m_error = "No input file";
+        return false;
+    }
+    
+    if (!m_loudness && (m_outputDirectory.isEmpty() || !QDir(m_outputDirectory).exists()))
+    {
+        m_error = "The output directory must exist";
+        return false;
+    }
+    
+    return true;
+    
+}
+
+
+/* Read a cut list file. Empty lines and lines starting with # are ignored. */
+bool BatchProcessor::readCutList(const QString &filePath)
+{
+    
+    QFile file(filePath);
+    
+    if (!file.open(QFile::ReadOnly | QFile::Text))
+    {
+        m_error = "Unable to open the cut list";
+        return false;
+    }
+    
+    QTextStream stream(&file);
+    
+    while (!stream.atEnd())
+    {
+        QString line = stream.readLine().trimmed();
+        
+        if (line.isEmpty() || line.startsWith('#'))
+            continue;
+        
+        QStringList bounds = line.split(QRegularExpression("\\s+"));
+        
+        if (bounds.size() != 2 || !addCut(bounds.at(0), bounds.at(1)))
+            return false;
+    }
+    
+    return true;
+    
+}
+
+
+/* Add a cut to the cut list, from its bounds given as text. */
+bool BatchProcessor::addCut(const QString &start, const QString &end)
+{
+    
+    bool startOk, endOk;
+    Cut  cut = {start.toLongLong(&startOk), end.toLongLong(&endOk)};
+    
+    if (!startOk || !endOk || cut.startFrame < 0 || cut.endFrame <= cut.startFrame)
+    {
+        m_error = "Invalid cut, expected <start> <end> with start < end";
+        return false;
+    }
+    
+    m_cuts.append(cut);
+    
+    return true;
+    
+}
+
+
+/* Process all the input files on a thread pool, and wait for them.
+ *
+ * It returns the exit code of the program: 0 if all the files were processed. */
+int BatchProcessor::run()
+{
+    
+    // Cuts are given in frames of the original file: apply them from the end of the file
+    // so that each one is not moved by the others, once overlapping cuts are merged
+    std::sort(m_cuts.begin(), m_cuts.end(), [](const Cut &a, const Cut &b) {return a.startFrame < b.startFrame;});
+    
+    QVector<Cut> merged;
+    
+    for (const Cut &cut : m_cuts)
+    {
+        if (!merged.isEmpty() && cut.startFrame <= merged.last().endFrame)
+            merged.last().endFrame = std::max(merged.last().endFrame, cut.endFrame);
+        else
+            merged.append(cut);
+    }
+    
+    std::reverse(merged.begin(), merged.end());
+    m_cuts = merged;
+    
+    QThreadPool   pool;
+    QElapsedTimer timer;
+    
+    if (m_jobsCount > 0)
+        pool.setMaxThreadCount(m_jobsCount);
+    
+    timer.start();
+    
+    for (const QString &inputPath : m_inputPaths)
+        pool.start(new BatchJob(this, inputPath));
+    
+    pool.waitForDone();
+    
+    printf("%d file(s) processed, %d failed, in %.3f s\n",
+           m_inputPaths.size() - m_failedCount, m_failedCount, timer.nsecsElapsed() / 1e9);
+    
+    return m_failedCount == 0 ? 0 : 1;
+    
+}
+
+
+/* Load a file, apply the cuts and export it. Called from the threads of the pool. */
+void BatchProcessor::processFile(const QString &inputPath)
+{
+    
+    QElapsedTimer timer;
+    timer.start();
+    
+    WavBuffer   audioSource;
+    QString     outputPath = QDir(m_outputDirectory).filePath(QFileInfo(inputPath).fileName());
+    QSaveFile   outputFile(outputPath);
+    const char *error      = nullptr;
+    
+    if (!audioSource.loadFile(QFile::encodeName(inputPath).constData()))
+    {
+        error = audioSource.error();
+    }
+    else
+    {
+        for (const Cut &cut : m_cuts)
+        {
+            if (cut.startFrame < audioSource.framesCount())
+                audioSource.cutBlock(cut.startFrame, std::min(cut.endFrame, audioSource.framesCount()) - 1);
+        }
+        
+        // The output file only appears once it is complete
+        if (!outputFile.open(QFile::WriteOnly))
+            error = "Unable to create the output file";
+        else if (!audioSource.exportTo(&outputFile) || !outputFile.commit())
+            error = "Unable to write the output file";
+    }
+    
+    double elapsed = timer.nsecsElapsed() / 1e9;
+    
+    QMutexLocker locker(&m_outputMutex);
+    
+    if (error)
+    {
+        fprintf(stderr, "%s: %s\n", qPrintable(inputPath), error);
+        m_failedCount++;
+        return;
+    }
+    
+    // Throughput of the file, in MB of input
+    double megabytes = QFileInfo(inputPath).size() / 1e6;
+    
+    printf("%s: %lld frames -> %s, %.1f MB in %.3f s (%.1f MB/s)\n",
+           qPrintable(inputPath), (long long) audioSource.framesCount(), qPrintable(outputPath),
+           megabytes, elapsed, megabytes / std::max(elapsed, 1e-9));
+    fflush(stdout);
+    
+}
+
+
+/* Load a file, apply the cuts and measure its loudness. Called from the threads of the pool. */
+void BatchProcessor::measureFile(const QString &inputPath)
+{
+    
+    QElapsedTimer timer;
+    timer.start();
+    
+    WavBuffer                  audioSource;
+    ParallelAnalysis::Loudness loudness;
+    bool                       loaded = audioSource.loadFile(QFile::encodeName(inputPath).constData());
+    
+    if (loaded)
+    {
+        for (const Cut &cut : m_cuts)
+        {
+            if (cut.startFrame < audioSource.framesCount())
+                audioSource.cutBlock(cut.startFrame, std::min(cut.endFrame, audioSource.framesCount()) - 1);
+        }
+        
+        loudness = ParallelAnalysis::loudness(&audioSource, 0, audioSource.framesCount());
+    }
+    
+    double elapsed = timer.nsecsElapsed() / 1e9;
+    
+    QMutexLocker locker(&m_outputMutex);
+    
+    if (!loaded)
+    {
+        fprintf(stderr, "%s: %s\n", qPrintable(inputPath), audioSource.error());
+        m_failedCount++;
+        return;
+    }
+    
+    double peak = 0;
+    for (double channelPeak : loudness.samplePeaks)
+        peak = std::max(peak, channelPeak);
+    
+    double megabytes = QFileInfo(inputPath).size() / 1e6;
+    
+    printf("%s: integrated %.1f LUFS, max momentary %.1f LUFS, max short-term %.1f LUFS, sample peak %.1f dBFS, "
+           "%.1f MB in %.3f s (%.1f MB/s)\n",
+           qPrintable(inputPath), loudness.integrated, loudness.maxMomentary, loudness.maxShortTerm, 20 * std::log10(peak),
+           megabytes, elapsed, megabytes / std::max(elapsed, 1e-9));
+    fflush(stdout);
+    
+}
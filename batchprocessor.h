@@ -0,0 +1,78 @@
+#ifndef BATCHPROCESSOR_H
+#define BATCHPROCESSOR_H
+
+#include <QMutex>
+#include <QRunnable>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+
+/* Headless processing of many WAV files, started with the --batch argument
+ *
+ * Each input file is loaded in a WavBuffer, the cuts of the cut list are applied,
+ * and the result is exported to the output directory under the same name.
+ * Files are memory-mapped and exported block by block, so they are never held
+ * in memory as a whole: the frames which are kept are copied by the kernel from the
+ * input to the output file. Files are processed in parallel on a thread pool, and the
+ * throughput of each one is reported on the standard output.
+ *
+ * With --loudness, nothing is exported: the loudness of each file, once cut, is measured
+ * as in EBU R128 and reported instead. The frames of each file are also measured on
+ * several threads (see ParallelAnalysis::loudness).
+ */
+class BatchProcessor
+{
+    
+public:
+    // Range of frames [startFrame, endFrame) of the original file to remove
+    struct Cut
+    {
+        qint64 startFrame;
+        qint64 endFrame;
+    };
+    
+    static const char *usage;
+    
+    bool parseArguments(const QStringList &arguments);
+    int  run();
+    
+    const char* error()  {return m_error;};
+    
+private:
+    QStringList  m_inputPaths;
+    QString      m_outputDirectory;
+    QVector<Cut> m_cuts;
+    int          m_jobsCount = 0;   // 0 for one job per core
+    bool         m_loudness  = false;
+    const char  *m_error     = "";
+    
+    QMutex m_outputMutex;  // Lines printed by the jobs must not mix
+    int    m_failedCount = 0;
+    
+    bool readCutList(const QString &filePath);
+    bool addCut(const QString &start, const QString &end);
+    void processFile(const QString &inputPath);
+    void measureFile(const QString &inputPath);
+    
+    friend class BatchJob;
+    
+};
+
+
+/* Job of the thread pool which processes a single file. */
+class BatchJob : public QRunnable
+{
+    
+public:
+    BatchJob(BatchProcessor *processor, const QString &inputPath) : m_processor(processor), m_inputPath(inputPath) {};
+    
+    void run()  {m_processor->m_loudness ? m_processor->measureFile(m_inputPath) : m_processor->processFile(m_inputPath);};
+    
+private:
+    BatchProcessor *m_processor;
+    QString         m_inputPath;
+    
+};
+
+#endif // BATCHPROCESSOR_H
@@ -0,0 +1,526 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include <QDataStream>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+#include <QTemporaryDir>
+#include <QThread>
+
+#include "benchmark.h"
+#include "parallelanalysis.h"
+#include "samplekernels.h"
+#include "wavbuffer.h"
+
+
+// Each benchmark is repeated until it ran for this time, and the best run is kept
+static const qint64 minimumTime = 200;  // ms
+
+// Frames given to each getMinMaxSampleValueInRange call, as for a pixel column of a zoomed out plot
+static const int minMaxRange = 4096;
+
+// Cuts done by the cut benchmark
+static const int cutsCount = 1000;
+
+// Longest files benchmarked, in samples: the longest files with many channels are skipped
+static const qint64 maxSamplesCount = 6LL << 24;
+
+// Channels of the file on which the parallel analysis is timed
+static const int scalingChannelsCount = 16;
+
+
+const char *Benchmark::usage =
+    "Usage: AudioPlayer --benchmark [--quick] [--output <file.json>]\n"
+    "\n"
+    "Options:\n"
+    "  --quick                Only benchmark short files\n"
+    "  --output <file.json>   Write the results to a file instead of the standard output\n";
+
+
+/* Read the arguments given after --benchmark. */
+bool Benchmark::parseArguments(const QStringList &arguments)
+{
+    
+    for (int i = 1; i < arguments.size(); i++)
+    {
+        const QString &argument = arguments.at(i);
+        
+        if (argument == "--benchmark")
+        {
+            continue;
+        }
+        else if (argument == "--quick")
+        {
+            m_quick = true;
+        }
+        else if (argument == "--output" && i + 1 < arguments.size())
+        {
+            m_outputPath = arguments.at(++i);
+        }
+        else
+        {
+            m_error = "Unknown option or missing value";
+            return false;
+        }
+    }
+    
+    return true;
+    
+}
+
+
+/* Write a WAV file of a given format, filled with a sine wave and some noise.
+ *
+ * The file is written by blocks, so that long files do not need much memory. */
+bool Benchmark::writeSyntheticWav(const QString &filePath, SampleKernels::SampleFormat format, int channelsCount, qint64 framesCount)
+{
+    
+    QFile file(filePath);
+    
+    if (!file.open(QFile::WriteOnly))
+        return false;
+    
+    bool   isFloat        = (format == SampleKernels::Float32 || format == SampleKernels::Float64);
+    int    bytesPerSample = SampleKernels::sampleSize(format);
+    int    bytesPerFrame  = bytesPerSample * channelsCount;
+    qint64 dataSize       = framesCount * bytesPerFrame;
+    
+    // Largest value of integer samples
+    double scale = (format == SampleKernels::UInt8) ? 127 : std::ldexp(1.0, SampleKernels::significantBits(format) - 1) - 1;
+    
+    QByteArray header;
+    QDataStream stream(&header, QIODevice::WriteOnly);
+    stream.setByteOrder(QDataStream::LittleEndian);
+    
+    stream.writeRawData("RIFF", 4);
+    stream << (quint32) (36 + dataSize + (dataSize & 1));
+    stream.writeRawData("WAVEfmt ", 8);
+    stream << (quint32) 16 << (quint16) (isFloat ? 3 : 1) << (quint16) channelsCount << (quint32) 44100
+           << (quint32) (44100 * bytesPerFrame) << (quint16) bytesPerFrame << (quint16) (8 * bytesPerSample);
+    stream.writeRawData("data", 4);
+    stream << (quint32) dataSize;
+    
+    if (file.write(header) != header.size())
+        return false;
+    
+    QByteArray block;
+    quint32    noise = 1;
+    
+    for (qint64 frame = 0; frame < framesCount; )
+    {
+        qint64 blockFrames = std::min<qint64>(framesCount - frame, 65536);
+        
+        block.resize(blockFrames * bytesPerFrame);
+        uchar *sample = (uchar*) block.data();
+        
+        for (qint64 i = 0; i < blockFrames; i++, frame++)
+        {
+            for (int channel = 0; channel < channelsCount; channel++, sample += bytesPerSample)
+            {
+                noise = noise * 1664525 + 1013904223;
+                double value = 0.8 * std::sin(frame * 0.01 * (channel + 1)) + 0.1 * ((int) (noise >> 16) - 32768) / 32768.0;
+                
+                // Raw bits of the sample, written in little endian
+                quint64 bits;
+                
+                if (format == SampleKernels::Float32)
+                {
+                    float value32 = (float) value;
+                    quint32 bits32;
+                    memcpy(&bits32, &value32, sizeof(bits32));
+                    bits = bits32;
+                }
+                else if (format == SampleKernels::Float64)
+                {
+                    memcpy(&bits, &value, sizeof(bits));
+                }
+                else
+                {
+                    bits = (quint64) (qint64) (value * scale) + ((format == SampleKernels::UInt8) ? 128 : 0);
+                }
+                
+                for (int b = 0; b < bytesPerSample; b++)
+                    sample[b] = (bits >> (8 * b)) & 0xFF;
+            }
+        }
+        
+        if (file.write(block) != block.size())
+            return false;
+    }
+    
+    if ((dataSize & 1) && file.write("\0", 1) != 1)
+        return false;
+    
+    return true;
+    
+}
+
+
+/* Run all the benchmarks and write the results. It returns the exit code of the program. */
+int Benchmark::run()
+{
+    
+    QTemporaryDir directory;
+    
+    if (!directory.isValid())
+    {
+        fprintf(stderr, "Unable to create a temporary directory\n");
+        return 1;
+    }
+    
+    QVector<qint64> lengths = {1 << 16, 1 << 20};
+    
+    if (!m_quick)
+        lengths.append(1 << 24);
+    
+    for (SampleKernels::SampleFormat format : {SampleKernels::UInt8, SampleKernels::Int16, SampleKernels::Int24,
+                                               SampleKernels::Int32, SampleKernels::Float32, SampleKernels::Float64})
+    {
+        for (int channelsCount : {1, 2, 6, 32})
+        {
+            for (qint64 framesCount : lengths)
+            {
+                if (channelsCount * framesCount > maxSamplesCount)
+                    continue;
+                
+                QString filePath = directory.filePath(QString("bench_%1_%2ch_%3.wav").arg(SampleKernels::formatName(format)).arg(channelsCount).arg(framesCount));
+                
+                if (!writeSyntheticWav(filePath, format, channelsCount, framesCount))
+                {
+                    fprintf(stderr, "Unable to write %s\n", qPrintable(filePath));
+                    return 1;
+                }
+                
+                benchmarkFile(filePath, format, channelsCount, framesCount);
+                QFile::remove(filePath);
+            }
+        }
+    }
+    
+    // Scaling of the parallel analysis with the number of threads
+    qint64  scalingFrames = m_quick ? (1 << 20) : (1 << 22);
+    QString scalingPath   = directory.filePath("bench_scaling.wav");
+    
+    if (!writeSyntheticWav(scalingPath, SampleKernels::Int16, scalingChannelsCount, scalingFrames))
+    {
+        fprintf(stderr, "Unable to write %s\n", qPrintable(scalingPath));
+        return 1;
+    }
+    
+    benchmarkScaling(scalingPath, scalingChannelsCount, scalingFrames);
+    QFile::remove(scalingPath);
+    
+    QJsonObject report;
+    report["instruction_set"] = SampleKernels::instructionSet();
+    report["results"]         = m_results;
+    report["scaling"]         = m_scaling;
+    
+    QByteArray json = QJsonDocument(report).toJson();
+    
+    if (m_outputPath.isEmpty())
+    {
+        fwrite(json.constData(), 1, json.size(), stdout);
+        return 0;
+    }
+    
+    QFile output(m_outputPath);
+    
+    if (!output.open(QFile::WriteOnly) || output.write(json) != json.size())
+    {
+        fprintf(stderr, "Unable to write %s\n", qPrintable(m_outputPath));
+        return 1;
+    }
+    
+    return 0;
+    
+}
+
+
+/* Time the hot paths of WavBuffer on a file. */
+void Benchmark::benchmarkFile(const QString &filePath, SampleKernels::SampleFormat format, int channelsCount, qint64 framesCount)
+{
+    
+    QByteArray path      = QFile::encodeName(filePath);
+    qint64     audioSize = framesCount * channelsCount * SampleKernels::sampleSize(format);
+    
+    // Loading: header parsing, and reading the file when it is not mapped
+    double seconds = measure([&]() {
+        WavBuffer audioSource;
+        audioSource.loadFile(path.constData(), WavBuffer::LoadMapped);
+    });
+    addResult("load_mapped", format, channelsCount, framesCount, framesCount, audioSize, seconds);
+    
+    seconds = measure([&]() {
+        WavBuffer audioSource;
+        audioSource.loadFile(path.constData(), WavBuffer::LoadInMemory);
+    });
+    addResult("load_in_memory", format, channelsCount, framesCount, framesCount, audioSize, seconds);
+    
+    WavBuffer audioSource;
+    
+    if (!audioSource.loadFile(path.constData()))
+    {
+        fprintf(stderr, "Unable to load %s: %s\n", path.constData(), audioSource.error());
+        return;
+    }
+    
+    // Decoding every sample one by one
+    volatile int sink = 0;
+    
+    seconds = measure([&]() {
+        int sum = 0;
+        for (qint64 frame = 0; frame < framesCount; frame++)
+            for (int channel = 0; channel < channelsCount; channel++)
+                sum += audioSource.getSample(frame, channel);
+        sink = sum;
+    });
+    addResult("get_sample", format, channelsCount, framesCount, framesCount, audioSize, seconds);
+    
+    // Decoding the samples of each channel by runs, as the plot does at the lowest scales
+    QVector<int> samples(minMaxRange);
+    
+    seconds = measure([&]() {
+        int sum = 0;
+        for (int channel = 0; channel < channelsCount; channel++)
+            for (qint64 frame = 0; frame < framesCount; frame += minMaxRange)
+                sum += samples[audioSource.readSamples(frame, minMaxRange, channel, samples.data()) - 1];
+        sink = sum;
+    });
+    addResult("read_samples", format, channelsCount, framesCount, framesCount, audioSize, seconds);
+    
+    // Same through the planar cache, emptied before each run so that the deinterleaving is timed too
+    audioSource.setPlanarCacheEnabled(true);
+    
+    seconds = measure([&]() {
+        int sum = 0;
+        audioSource.planarCache()->clear();
+        for (int channel = 0; channel < channelsCount; channel++)
+            for (qint64 frame = 0; frame < framesCount; frame += minMaxRange)
+                sum += samples[audioSource.readSamples(frame, minMaxRange, channel, samples.data()) - 1];
+        sink = sum;
+    });
+    addResult("read_samples_planar", format, channelsCount, framesCount, framesCount, audioSize, seconds);
+    
+    audioSource.setPlanarCacheEnabled(false);
+    
+    // Min/max reduction of a channel from the samples, before the peaks are computed
+    seconds = measure([&]() {
+        int min, max;
+        for (int channel = 0; channel < channelsCount; channel++)
+            for (qint64 frame = 0; frame < framesCount; frame += minMaxRange)
+                audioSource.getMinMaxSampleValueInRange(frame, minMaxRange, channel, min, max);
+        sink = min + max;
+    });
+    addResult("min_max_samples", format, channelsCount, framesCount, framesCount, audioSize, seconds);
+    
+    // Computation of the peak pyramid, all channels at once
+    seconds = measure([&]() {
+        audioSource.peaks()->build(&audioSource);
+    });
+    addResult("peaks_build", format, channelsCount, framesCount, framesCount, audioSize, seconds);
+    
+    // Min/max reduction from the pyramid
+    seconds = measure([&]() {
+        int min, max;
+        for (int channel = 0; channel < channelsCount; channel++)
+            for (qint64 frame = 0; frame < framesCount; frame += minMaxRange)
+                audioSource.getMinMaxSampleValueInRange(frame, minMaxRange, channel, min, max);
+        sink = min + max;
+    });
+    addResult("min_max_peaks", format, channelsCount, framesCount, framesCount, audioSize, seconds);
+    
+    // Cuts spread over the file, each one splitting a piece of the edit list
+    seconds = measure([&]() {
+        audioSource.edits()->reset(framesCount);
+        for (int i = 0; i < cutsCount; i++)
+        {
+            qint64 start = (framesCount - cutsCount) / cutsCount * (cutsCount - 1 - i);
+            audioSource.cutBlock(start, start);
+        }
+    });
+    addResult("cut", format, channelsCount, framesCount, cutsCount, 0, seconds);
+    
+    // Export with the cuts, the frames of the file being copied by the kernel or written from the mapping
+    QString exportPath = filePath + ".export";
+    
+    for (bool fileCopy : {true, false})
+    {
+        audioSource.setFileCopyEnabled(fileCopy);
+        
+        seconds = measure([&]() {
+            QSaveFile file(exportPath);
+            if (file.open(QFile::WriteOnly) && audioSource.exportTo(&file))
+                file.commit();
+        });
+        addResult(fileCopy ? "export_copy" : "export_write", format, channelsCount, framesCount, audioSource.framesCount(), audioSource.audioSize(), seconds);
+    }
+    
+    QFile::remove(exportPath);
+    
+}
+
+
+/* Time the parallel analysis passes with 1 thread up to one thread per core.
+ *
+ * The results of each thread count are compared with those of a single thread: they must be exactly the same. */
+void Benchmark::benchmarkScaling(const QString &filePath, int channelsCount, qint64 framesCount)
+{
+    
+    QByteArray path      = QFile::encodeName(filePath);
+    qint64     audioSize = framesCount * channelsCount * 2;
+    WavBuffer  audioSource;
+    
+    if (!audioSource.loadFile(path.constData()))
+    {
+        fprintf(stderr, "Unable to load %s: %s\n", path.constData(), audioSource.error());
+        return;
+    }
+    
+    QVector<int> threadsCounts;
+    
+    for (int threadsCount = 1; threadsCount < QThread::idealThreadCount(); threadsCount *= 2)
+        threadsCounts.append(threadsCount);
+    threadsCounts.append(QThread::idealThreadCount());
+    
+    QVector<ParallelAnalysis::ChannelStatistics> referenceStatistics;
+    ParallelAnalysis::Loudness                   referenceLoudness;
+    quint64 referenceChecksum = 0;
+    double  referencePeaks    = 0;
+    double  referenceAnalysis = 0;
+    double  referenceMeasure  = 0;
+    
+    for (int threadsCount : threadsCounts)
+    {
+        ParallelAnalysis::setThreadsCount(threadsCount);
+        
+        QVector<ParallelAnalysis::ChannelStatistics> statistics;
+        ParallelAnalysis::Loudness                   loudness;
+        
+        double peaksSeconds = measure([&]() {
+            ParallelAnalysis::buildPeaks(&audioSource);
+        });
+        double analysisSeconds = measure([&]() {
+            statistics = ParallelAnalysis::statistics(&audioSource, 0, framesCount);
+        });
+        double loudnessSeconds = measure([&]() {
+            loudness = ParallelAnalysis::loudness(&audioSource, 0, framesCount);
+        });
+        
+        quint64 checksum = peaksChecksum(audioSource.peaks(), channelsCount, framesCount);
+        
+        if (threadsCount == 1)
+        {
+            referenceStatistics = statistics;
+            referenceChecksum   = checksum;
+            referencePeaks      = peaksSeconds;
+            referenceAnalysis   = analysisSeconds;
+            referenceLoudness   = loudness;
+            referenceMeasure    = loudnessSeconds;
+        }
+        
+        auto addScaling = [&](const char *name, double seconds, double referenceSeconds, bool identical) {
+            QJsonObject result;
+            result["name"]      = name;
+            result["threads"]   = threadsCount;
+            result["channels"]  = channelsCount;
+            result["frames"]    = (double) framesCount;
+            result["seconds"]   = seconds;
+            result["speedup"]   = referenceSeconds / seconds;
+            result["gb_per_s"]  = audioSize / seconds / 1e9;
+            result["identical"] = identical;
+            
+            m_scaling.append(result);
+            
+            fprintf(stderr, "%-20s %2d threads: %10.3f ms  x%5.2f%s\n", name, threadsCount, seconds * 1e3,
+                    referenceSeconds / seconds, identical ? "" : "  RESULTS DIFFER");
+        };
+        
+        addScaling("peaks_build_parallel", peaksSeconds,    referencePeaks,    checksum == referenceChecksum);
+        addScaling("statistics_parallel",  analysisSeconds, referenceAnalysis, statistics == referenceStatistics);
+        addScaling("loudness_parallel",    loudnessSeconds, referenceMeasure,  loudness == referenceLoudness);
+    }
+    
+    // Back to one thread per core
+    ParallelAnalysis::setThreadsCount(0);
+    
+}
+
+
+/* Hash all the peaks of a pyramid, so that pyramids can be compared. */
+quint64 Benchmark::peaksChecksum(PeakPyramid *peaks, int channelsCount, qint64 framesCount)
+{
+    
+    quint64 checksum = 14695981039346656037ULL;  // FNV-1a
+    
+    for (int level = 0; level < peaks->levelsCount(); level++)
+    {
+        for (qint64 frame = 0; frame < framesCount; frame += peaks->blockSize(level))
+        {
+            for (int channel = 0; channel < channelsCount; channel++)
+            {
+                PeakPyramid::Peak peak = peaks->peak(level, frame, channel);
+                checksum = (checksum ^ (quint32) peak.min) * 1099511628211ULL;
+                checksum = (checksum ^ (quint32) peak.max) * 1099511628211ULL;
+            }
+        }
+    }
+    
+    return checksum;
+    
+}
+
+
+/* Add a result to the report. The time is given per operation, which is a frame, or a cut for the cut benchmark. */
+void Benchmark::addResult(const QString &name, SampleKernels::SampleFormat format, int channelsCount, qint64 framesCount,
+                          qint64 operationsCount, qint64 bytesCount, double seconds)
+{
+    
+    QJsonObject result;
+    result["name"]            = name;
+    result["format"]          = SampleKernels::formatName(format);
+    result["bit_depth"]       = 8 * SampleKernels::sampleSize(format);
+    result["channels"]        = channelsCount;
+    result["frames"]          = (double) framesCount;
+    result["seconds"]         = seconds;
+    result["ns_per_op"]       = seconds * 1e9 / operationsCount;
+    result["operations"]      = (double) operationsCount;
+    result["unit"]            = (name == "cut") ? "cut" : "frame";
+    
+    if (bytesCount > 0)
+        result["gb_per_s"] = bytesCount / seconds / 1e9;
+    
+    m_results.append(result);
+    
+    fprintf(stderr, "%-16s %-7s %dch %9lld frames: %10.3f ns/op\n", qPrintable(name), SampleKernels::formatName(format), channelsCount,
+            (long long) framesCount, seconds * 1e9 / operationsCount);
+    
+}
+
+
+/* Run a function until minimumTime elapsed (at least 3 times), and return the shortest run in seconds. */
+double Benchmark::measure(std::function<void()> function)
+{
+    
+    QElapsedTimer total;
+    double        best = INFINITY;
+    
+    total.start();
+    
+    for (int run = 0; run < 3 || total.elapsed() < minimumTime; run++)
+    {
+        QElapsedTimer timer;
+        timer.start();
+        
+        function();
+        
+        best = std::min(best, timer.nsecsElapsed() / 1e9);
+    }
+    
+    return best;
+    
+}
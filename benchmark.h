@@ -0,0 +1,55 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <functional>
+
+#include <QJsonArray>
+#include <QString>
+#include <QStringList>
+
+#include "peakpyramid.h"
+#include "samplekernels.h"
+
+
+/* Micro-benchmarks of the hot paths of WavBuffer, started with the --benchmark argument
+ *
+ * Synthetic WAV files of every sample format, of various lengths and channels counts, are
+ * generated in a temporary directory. Loading, sample decoding (straight from the frames
+ * and through the planar cache), min/max reduction (with and without the peak pyramid),
+ * cuts and the export of the cut file are timed on each of them.
+ * The results are written as JSON, so that they can be compared across builds:
+ * each result gives the time per frame (or per operation) and the throughput in GB/s.
+ * The parallel analysis passes (peaks, statistics and loudness) are also timed on a 16-channel file with 1 thread up to
+ * one thread per core, and their results are checked to be the same for every thread count.
+ */
+class Benchmark
+{
+    
+public:
+    static const char *usage;
+    
+    bool parseArguments(const QStringList &arguments);
+    int  run();
+    
+    const char* error()  {return m_error;};
+    
+    static bool writeSyntheticWav(const QString &filePath, SampleKernels::SampleFormat format, int channelsCount, qint64 framesCount);
+    
+private:
+    QString     m_outputPath;       // Empty for the standard output
+    bool        m_quick = false;    // Only the short files
+    const char *m_error = "";
+    QJsonArray  m_results;
+    QJsonArray  m_scaling;
+    
+    void benchmarkFile(const QString &filePath, SampleKernels::SampleFormat format, int channelsCount, qint64 framesCount);
+    void benchmarkScaling(const QString &filePath, int channelsCount, qint64 framesCount);
+    void addResult(const QString &name, SampleKernels::SampleFormat format, int channelsCount, qint64 framesCount,
+                   qint64 operationsCount, qint64 bytesCount, double seconds);
+    
+    static double  measure(std::function<void()> function);
+    static quint64 peaksChecksum(PeakPyramid *peaks, int channelsCount, qint64 framesCount);
+    
+};
+
+#endif // BENCHMARK_H
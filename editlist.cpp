@@ -0,0 +1,316 @@
+#include <algorithm>
+
+#include "editlist.h"
+
+
+/* Start over with a single piece covering all the source frames, and forget the edit history. */
+void EditList::reset(qint64 sourceFramesCount)
+{
+    
+    m_state = State();
+    m_undoStack.clear();
+    m_redoStack.clear();
+    
+    if (sourceFramesCount > 0)
+        m_state.root = makeLeaf({0, sourceFramesCount});
+    
+    m_changedFrom = 0;
+    m_changedTo   = framesCount();
+    m_shift       = 0;
+    
+}
+
+
+/* Record the range of logical frames changed by an edit, undo or redo.
+ *
+ * The frames from changedTo on are those which followed the changed range before: they just moved by the change of the frames count. */
+void EditList::setChangedRange(qint64 changedFrom, qint64 changedTo, qint64 previousFramesCount)
+{
+    m_changedFrom = changedFrom;
+    m_changedTo   = changedTo;
+    m_shift       = framesCount() - previousFramesCount;
+}
+
+
+/* Get the index of the piece which contains a given logical frame, going down the tree.
+ *
+ * It returns -1 if the frame is out of range. */
+int EditList::pieceAt(qint64 frame)
+{
+    
+    if (frame < 0 || frame >= framesCount())
+        return -1;
+    
+    const Node *node  = m_state.root.data();
+    int         index = 0;
+    
+    while (node)
+    {
+        qint64 leftFrames = framesOf(node->left);
+        
+        if (frame < leftFrames)
+        {
+            node = node->left.data();
+            continue;
+        }
+        
+        frame -= leftFrames;
+        index += piecesOf(node->left);
+        
+        if (frame < node->piece.framesCount)
+            break;
+        
+        frame -= node->piece.framesCount;
+        index += 1;
+        node   = node->right.data();
+    }
+    
+    return index;
+    
+}
+
+
+/* Find the node of the piece at a given index, and the logical frame at which the piece starts. */
+const EditList::Node* EditList::nodeAt(int index, qint64 &start)
+{
+    
+    const Node *node = m_state.root.data();
+    
+    start = 0;
+    
+    while (node)
+    {
+        int leftPieces = piecesOf(node->left);
+        
+        if (index < leftPieces)
+        {
+            node = node->left.data();
+            continue;
+        }
+        
+        if (index == leftPieces)
+        {
+            start += framesOf(node->left);
+            return node;
+        }
+        
+        index -= leftPieces + 1;
+        start += framesOf(node->left) + node->piece.framesCount;
+        node   = node->right.data();
+    }
+    
+    return nullptr;
+    
+}
+
+
+EditList::Piece EditList::piece(int index)
+{
+    qint64 start;
+    return nodeAt(index, start)->piece;
+}
+
+
+qint64 EditList::pieceStart(int index)
+{
+    qint64 start;
+    nodeAt(index, start);
+    return start;
+}
+
+
+/* Convert a logical frame into the source frame it reads from, in the file or in the block of its piece. */
+qint64 EditList::sourceFrame(qint64 frame)
+{
+    
+    int index = pieceAt(frame);
+    
+    if (index < 0)
+        return -1;
+    
+    qint64      start;
+    const Node *node = nodeAt(index, start);
+    
+    return node->piece.sourceFrame + (frame - start);
+    
+}
+
+
+/* Remove the logical frames in [startFrame, endFrame). */
+void EditList::cut(qint64 startFrame, qint64 endFrame)
+{
+    edit(startFrame, endFrame, QVector<Piece>());
+}
+
+
+/* Replace the logical frames in [startFrame, endFrame) by the frames of a piece, usually read from a block. */
+void EditList::replace(qint64 startFrame, qint64 endFrame, const Piece &piece)
+{
+    edit(startFrame, endFrame, QVector<Piece>({piece}));
+}
+
+
+/* Replace the logical frames in [startFrame, endFrame) by the frames of some pieces (none for a cut).
+ *
+ * The tree is split at both bounds, which shortens the pieces they fall in, and the trees before
+ * and after the range are merged around the inserted pieces. Only O(log pieces) nodes are built,
+ * the others are shared with the previous state, which is pushed on the undo stack. */
+void EditList::edit(qint64 startFrame, qint64 endFrame, const QVector<Piece> &inserted)
+{
+    
+    startFrame = std::max<qint64>(startFrame, 0);
+    endFrame   = std::min(endFrame, framesCount());
+    
+    if (startFrame >= endFrame)
+        return;
+    
+    NodePointer before, range, removed, after;
+    split(m_state.root, startFrame, before, range);
+    split(range, endFrame - startFrame, removed, after);
+    
+    State edited;
+    edited.editStart = startFrame;
+    
+    for (const Piece &piece : inserted)
+    {
+        before             = merge(before, makeLeaf(piece));
+        edited.editFrames += piece.framesCount;
+    }
+    
+    edited.root = merge(before, after);
+    
+    m_undoStack.push_back(m_state);
+    m_redoStack.clear();
+    m_state = edited;
+    setChangedRange(startFrame, startFrame + edited.editFrames, framesOf(m_undoStack.last().root));
+    
+}
+
+
+/* Priorities of the new nodes, from a xorshift generator: the tree is balanced whatever the order of the edits. */
+quint32 EditList::nextPriority()
+{
+    
+    m_seed ^= m_seed << 13;
+    m_seed ^= m_seed >> 17;
+    m_seed ^= m_seed << 5;
+    
+    return m_seed;
+    
+}
+
+
+EditList::NodePointer EditList::makeLeaf(const Piece &piece)
+{
+    return makeNode(piece, nextPriority(), NodePointer(), NodePointer());
+}
+
+
+EditList::NodePointer EditList::makeNode(const Piece &piece, quint32 priority, const NodePointer &left, const NodePointer &right)
+{
+    
+    Node *node = new Node;
+    
+    node->piece       = piece;
+    node->priority    = priority;
+    node->left        = left;
+    node->right       = right;
+    node->piecesCount = piecesOf(left) + 1 + piecesOf(right);
+    node->framesCount = framesOf(left) + piece.framesCount + framesOf(right);
+    
+    return NodePointer(node);
+    
+}
+
+
+/* Join two trees, all the pieces of the left one coming before those of the right one. */
+EditList::NodePointer EditList::merge(const NodePointer &left, const NodePointer &right)
+{
+    
+    if (!left)
+        return right;
+    if (!right)
+        return left;
+    
+    if (left->priority > right->priority)
+        return makeNode(left->piece, left->priority, left->left, merge(left->right, right));
+    
+    return makeNode(right->piece, right->priority, merge(left, right->left), right->right);
+    
+}
+
+
+/* Split a tree into the frames before a logical frame and the others. The piece which contains the frame
+ * is split in two: the head keeps its priority, which is still higher than those of its subtree, and the
+ * tail gets a new one, so that pieces cut many times do not make the tree a chain of equal priorities. */
+void EditList::split(const NodePointer &node, qint64 frame, NodePointer &left, NodePointer &right)
+{
+    
+    if (!node)
+    {
+        left  = NodePointer();
+        right = NodePointer();
+        return;
+    }
+    
+    qint64 leftFrames = framesOf(node->left);
+    qint64 pieceEnd   = leftFrames + node->piece.framesCount;
+    
+    if (frame <= leftFrames)
+    {
+        NodePointer middle;
+        split(node->left, frame, left, middle);
+        right = makeNode(node->piece, node->priority, middle, node->right);
+    }
+    else if (frame >= pieceEnd)
+    {
+        NodePointer middle;
+        split(node->right, frame - pieceEnd, middle, right);
+        left = makeNode(node->piece, node->priority, node->left, middle);
+    }
+    else
+    {
+        Piece head = node->piece;
+        Piece tail = node->piece;
+        
+        head.framesCount  = frame - leftFrames;
+        tail.sourceFrame += head.framesCount;
+        tail.framesCount -= head.framesCount;
+        
+        left  = makeNode(head, node->priority, node->left, NodePointer());
+        right = merge(makeLeaf(tail), node->right);
+    }
+    
+}
+
+
+/* Go back to the state before the last edit. */
+void EditList::undo()
+{
+    
+    if (!canUndo())
+        return;
+    
+    m_redoStack.push_back(m_state);
+    m_state = m_undoStack.takeLast();
+    
+    // The frames the edit replaced are back at its start
+    const State &undone       = m_redoStack.last();
+    qint64       undoneFrames = framesOf(undone.root);
+    setChangedRange(undone.editStart, undone.editStart + undone.editFrames - (undoneFrames - framesCount()), undoneFrames);
+    
+}
+
+
+/* Apply again the last undone edit. */
+void EditList::redo()
+{
+    
+    if (!canRedo())
+        return;
+    
+    m_undoStack.push_back(m_state);
+    m_state = m_redoStack.takeLast();
+    setChangedRange(m_state.editStart, m_state.editStart + m_state.editFrames, framesOf(m_undoStack.last().root));
+    
+}
@@ -0,0 +1,106 @@
+#ifndef EDITLIST_H
+#define EDITLIST_H
+
+#include <QSharedPointer>
+#include <QVector>
+
+struct AudioBlock;  // See audioblock.h
+
+
+/* Piece table describing the edited audio as a list of ranges of source frames
+ *
+ * Edits never touch the audio data: a cut only splits the piece which contains
+ * its start and drops the frames it covers. Edits which change samples put the
+ * new frames in an AudioBlock, and replace the frames they cover by a piece which
+ * reads from the block instead of the file.
+ *
+ * The pieces are kept in a persistent treap: a binary tree ordered by logical frame, balanced
+ * by random priorities, whose nodes are never modified once built and are shared between the
+ * states which contain them. Each node knows the pieces and frames of its subtree, so finding
+ * a piece by frame or by index, and an edit, cost O(log pieces): an edit only builds the nodes
+ * on the paths to its bounds. Each edit saves the previous tree on the undo stack, which holds a
+ * single pointer, so undo/redo just swap trees, and copies of the list (given to worker threads)
+ * only share the root.
+ * Logical frames are the frames of the edited audio, source frames those of the file (or of the block of a piece).
+ * After each change, the frames from changedTo() on are those which were at changedTo() - shift()
+ * before it, so that whatever was computed for them can be moved instead of computed again.
+ */
+class EditList
+{
+    
+public:
+    struct Piece
+    {
+        qint64 sourceFrame;  // First source frame of the piece
+        qint64 framesCount;
+        QSharedPointer<AudioBlock> block;  // Frames the piece reads from, null for the frames of the file
+    };
+    
+    void reset(qint64 sourceFramesCount);
+    
+    // Getters
+    qint64 framesCount()            {return framesOf(m_state.root);};
+    int    piecesCount()            {return piecesOf(m_state.root);};
+    Piece  piece(int index);
+    qint64 pieceStart(int index);
+    bool   canUndo()                {return !m_undoStack.isEmpty();};
+    bool   canRedo()                {return !m_redoStack.isEmpty();};
+    qint64 changedFrom()            {return m_changedFrom;};
+    qint64 changedTo()              {return m_changedTo;};
+    qint64 shift()                  {return m_shift;};
+    
+    int    pieceAt(qint64 frame);
+    qint64 sourceFrame(qint64 frame);
+    
+    void cut(qint64 startFrame, qint64 endFrame);
+    void replace(qint64 startFrame, qint64 endFrame, const Piece &piece);
+    void undo();
+    void redo();
+    
+private:
+    struct Node;
+    typedef QSharedPointer<const Node> NodePointer;
+    
+    // Node of the treap, never modified once built
+    struct Node
+    {
+        Piece       piece;
+        quint32     priority;     // Higher than the priorities of the subtree
+        NodePointer left;         // Pieces before this one
+        NodePointer right;        // Pieces after this one
+        int         piecesCount;  // Pieces of the subtree
+        qint64      framesCount;  // Frames of the subtree
+    };
+    
+    struct State
+    {
+        NodePointer root;
+        qint64      editStart  = 0;  // First logical frame changed by the edit which led to this state
+        qint64      editFrames = 0;  // Frames put at editStart by this edit (0 for a cut)
+    };
+    
+
+    State          m_state;
+    qint64         m_changedFrom = 0;  // First logical frame changed by the last edit, undo or redo
+    qint64         m_changedTo   = 0;  // First logical frame after the changed ones: it showed frame m_changedTo - m_shift before
+    qint64         m_shift       = 0;  // Frames added (or removed if negative) by the last edit, undo or redo
+    QVector<State> m_undoStack;
+    QVector<State> m_redoStack;
+    quint32        m_seed        = 2463534242u;  // Of the priorities of the new nodes
+    
+    quint32     nextPriority();
+    const Node* nodeAt(int index, qint64 &start);
+    NodePointer makeLeaf(const Piece &piece);
+    
+    static qint64      framesOf(const NodePointer &node)  {return node ? node->framesCount : 0;};
+    static int         piecesOf(const NodePointer &node)  {return node ? node->piecesCount : 0;};
+    static NodePointer makeNode(const Piece &piece, quint32 priority, const NodePointer &left, const NodePointer &right);
+    static NodePointer merge(const NodePointer &left, const NodePointer &right);
+    void               split(const NodePointer &node, qint64 frame, NodePointer &left, NodePointer &right);
+    
+    void edit(qint64 startFrame, qint64 endFrame, const QVector<Piece> &inserted);
+    void setChangedRange(qint64 changedFrom, qint64 changedTo, qint64 previousFramesCount);
+    
+};
+
+#endif // EDITLIST_H
@@ -0,0 +1,125 @@
+#include <algorithm>
+#include <cmath>
+
+#include "fft.h"
+
+
+/* Precompute the bit reversal permutation and the twiddle factors. The size must be a power of two, at least 4. */
+FFT::FFT(int size)
+{
+    
+    m_size = size;
+    m_half = size / 2;
+    
+    int bits = 0;
+    while ((1 << bits) < m_half)
+        bits++;
+    
+    m_bitReversal.resize(m_half);
+    for (int i = 0; i < m_half; i++)
+    {
+        int reversed = 0;
+        for (int b = 0; b < bits; b++)
+            reversed |= ((i >> b) & 1) << (bits - 1 - b);
+        m_bitReversal[i] = reversed;
+    }
+    
+    // The stage of half size h uses the factors at [h, 2h): the table has m_half entries, the first one is unused
+    m_twiddleReal.resize(std::max(m_half, 2));
+    m_twiddleImag.resize(std::max(m_half, 2));
+    for (int h = 1; h < m_half; h *= 2)
+    {
+        for (int k = 0; k < h; k++)
+        {
+            m_twiddleReal[h + k] = std::cos(M_PI * k / h);
+            m_twiddleImag[h + k] = -std::sin(M_PI * k / h);
+        }
+    }
+    
+    m_untangleReal.resize(m_half);
+    m_untangleImag.resize(m_half);
+    for (int k = 0; k < m_half; k++)
+    {
+        m_untangleReal[k] = std::cos(2 * M_PI * k / m_size);
+        m_untangleImag[k] = -std::sin(2 * M_PI * k / m_size);
+    }
+    
+    m_real.resize(m_half);
+    m_imag.resize(m_half);
+    
+}
+
+
+/* Transform m_real and m_imag in place, their values being in bit-reversed order. */
+void FFT::transform()
+{
+    
+    float *real = m_real.data();
+    float *imag = m_imag.data();
+    
+    for (int h = 1; h < m_half; h *= 2)
+    {
+        const float *twiddleReal = m_twiddleReal.constData() + h;
+        const float *twiddleImag = m_twiddleImag.constData() + h;
+        
+        for (int group = 0; group < m_half; group += 2 * h)
+        {
+            float *aReal = real + group;
+            float *aImag = imag + group;
+            float *bReal = real + group + h;
+            float *bImag = imag + group + h;
+            
+            // Butterflies of a group: no dependency between iterations
+            for (int k = 0; k < h; k++)
+            {
+                float tReal = twiddleReal[k] * bReal[k] - twiddleImag[k] * bImag[k];
+                float tImag = twiddleReal[k] * bImag[k] + twiddleImag[k] * bReal[k];
+                
+                bReal[k] = aReal[k] - tReal;
+                bImag[k] = aImag[k] - tImag;
+                aReal[k] = aReal[k] + tReal;
+                aImag[k] = aImag[k] + tImag;
+            }
+        }
+    }
+    
+}
+
+
+/* Even samples are the real parts, odd samples the imaginary parts of the complex FFT. If Z is its result,
+ * the spectrum of the real samples is X[k] = (Z[k] + conj(Z[n - k])) / 2 + W^k (Z[k] - conj(Z[n - k])) / 2i,
+ * with n = size / 2 and W = exp(-2 * i * pi / size). */
+void FFT::powerSpectrum(const float *samples, float *power)
+{
+    
+    for (int i = 0; i < m_half; i++)
+    {
+        m_real[m_bitReversal[i]] = samples[2 * i];
+        m_imag[m_bitReversal[i]] = samples[2 * i + 1];
+    }
+    
+    transform();
+    
+    // Z[0] gives the bins 0 and n at once
+    power[0]      = (m_real[0] + m_imag[0]) * (m_real[0] + m_imag[0]);
+    power[m_half] = (m_real[0] - m_imag[0]) * (m_real[0] - m_imag[0]);
+    
+    for (int k = 1; k < m_half; k++)
+    {
+        float zReal = m_real[k];
+        float zImag = m_imag[k];
+        float cReal = m_real[m_half - k];   // conj(Z[n - k])
+        float cImag = -m_imag[m_half - k];
+        
+        float evenReal = (zReal + cReal) / 2;
+        float evenImag = (zImag + cImag) / 2;
+        float oddReal  = (zImag - cImag) / 2;
+        float oddImag  = (cReal - zReal) / 2;
+        
+        float xReal = evenReal + m_untangleReal[k] * oddReal - m_untangleImag[k] * oddImag;
+        float xImag = evenImag + m_untangleReal[k] * oddImag + m_untangleImag[k] * oddReal;
+        
+        power[k] = xReal * xReal + xImag * xImag;
+    }
+    
+}
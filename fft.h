@@ -0,0 +1,43 @@
+#ifndef FFT_H
+#define FFT_H
+
+#include <QVector>
+
+
+/* Fast Fourier transform of real signals, for a given power of two size
+ *
+ * The N real samples are packed into N/2 complex values, transformed by an iterative
+ * radix-2 FFT, and the spectrum of the real signal is untangled from the result.
+ * Real and imaginary parts are kept in separate arrays, and the twiddle factors of each
+ * stage are stored one after the other: the inner loops run over contiguous floats
+ * without any shuffling, so that the compiler can vectorize them.
+ * An FFT object holds its work buffers: it must only be used by one thread at a time.
+ */
+class FFT
+{
+    
+public:
+    FFT(int size);
+    
+    int  size()  {return m_size;};
+    
+    // Squared magnitudes of the size / 2 + 1 first bins of the spectrum of size real samples
+    void powerSpectrum(const float *samples, float *power);
+    
+private:
+    int m_size;
+    int m_half;  // Size of the complex FFT
+    
+    QVector<int>   m_bitReversal;    // Index of each packed sample in the complex FFT
+    QVector<float> m_twiddleReal;    // exp(-i * pi * k / h) for k < h, at offset h for each stage of half size h
+    QVector<float> m_twiddleImag;
+    QVector<float> m_untangleReal;   // exp(-2 * i * pi * k / size) for k < size / 2
+    QVector<float> m_untangleImag;
+    QVector<float> m_real;
+    QVector<float> m_imag;
+    
+    void transform();
+    
+};
+
+#endif // FFT_H
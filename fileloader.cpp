@@ -0,0 +1,78 @@
+#include <QElapsedTimer>
+#include <QFile>
+
+#include "fileloader.h"
+
+
+// Minimum delay between two framesLoaded signals, so that the plot is not repainted more than needed
+static const int updateInterval = 16;  // ms
+
+
+/* The WavBuffer must not be used by another thread until headerLoaded is emitted. */
+FileLoader::FileLoader(WavBuffer *audioSource, const QString &filePath, QObject *parent) : QThread(parent)
+{
+    m_audioSource = audioSource;
+    m_filePath    = QFile::encodeName(filePath);
+}
+
+
+/* The worker thread must be finished before the WavBuffer is deleted. */
+FileLoader::~FileLoader()
+{
+    stop();
+}
+
+
+/* Ask the worker thread to stop and wait for it. */
+void FileLoader::stop()
+{
+    m_stopRequested.storeRelease(1);
+    wait();
+}
+
+
+/* Main loop of the worker thread.
+ *
+ * Frames are loaded by chunks of the peak pyramid: a chunk can be analysed as soon as it is loaded.
+ * If the file cannot be opened or read, the thread finishes with an error and the WavBuffer is not loaded. */
+void FileLoader::run()
+{
+    
+    if (!m_audioSource->openFile(m_filePath.constData()))
+    {
+        m_error = m_audioSource->error();
+        return;
+    }
+    
+    emit headerLoaded();
+    
+    qint64 framesCount = m_audioSource->sourceFramesCount();
+    
+    QElapsedTimer lastUpdate;
+    lastUpdate.start();
+    
+    while (!m_audioSource->isLoaded() && !m_stopRequested.loadAcquire())
+    {
+        
+        if (m_audioSource->loadFrames(PeakPyramid::chunkSize) < 0)
+        {
+            m_error = m_audioSource->error();
+            return;
+        }
+        
+        if (lastUpdate.elapsed() >= updateInterval)
+        {
+            emit framesLoaded();
+            emit progressChanged(100 * m_audioSource->loadedFramesCount() / framesCount);
+            lastUpdate.restart();
+        }
+        
+    }
+    
+    if (m_stopRequested.loadAcquire())
+        return;
+    
+    emit framesLoaded();
+    emit progressChanged(100);
+    
+}
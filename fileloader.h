@@ -0,0 +1,50 @@
+#ifndef FILELOADER_H
+#define FILELOADER_H
+
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QThread>
+
+#include "wavbuffer.h"
+
+
+/* Worker thread which opens an audio file into a WavBuffer
+ *
+ * It reads the header first and emits headerLoaded, so that the file info and the plot can be shown
+ * at once, then loads the audio data by chunks of the peak pyramid, emitting framesLoaded as they arrive:
+ * the peaks of the chunks loaded are computed meanwhile (see PeakBuilder), so that reading the file
+ * overlaps with the analysis, and the waveform is drawn progressively.
+ * The GUI thread must not use the WavBuffer before headerLoaded, nor read frames which are not loaded.
+ * Loading can be stopped between two chunks: the file is then only partially loaded.
+ */
+class FileLoader : public QThread
+{
+    
+    Q_OBJECT
+    
+public:
+    FileLoader(WavBuffer *audioSource, const QString &filePath, QObject *parent = 0);
+    ~FileLoader();
+    
+    const char* error()  {return m_error;};
+    
+    void stop();
+    
+signals:
+    void headerLoaded();
+    void framesLoaded();               // Some frames are loaded since the last signal
+    void progressChanged(int percent);
+    
+protected:
+    void run();
+    
+private:
+    WavBuffer  *m_audioSource;
+    QByteArray  m_filePath;
+    const char *m_error = "";
+    
+    QAtomicInt m_stopRequested;
+    
+};
+
+#endif // FILELOADER_H
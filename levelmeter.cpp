@@ -0,0 +1,119 @@
+#include <algorithm>
+#include <cmath>
+
+#include <QPainter>
+
+#include "levelmeter.h"
+
+
+// Space around the bars, and between the bars and the loudness values
+static const int padding = 4;
+
+
+LevelMeter::LevelMeter(QWidget *parent) : QWidget(parent)
+{
+    setMinimumWidth(60);
+    setSizePolicy(QSizePolicy::Fixed, QSizePolicy::Expanding);
+}
+
+
+/* Set the number of bars, which are cleared. */
+void LevelMeter::setChannelsCount(int channelsCount)
+{
+    
+    m_peaks.fill(0, channelsCount);
+    m_rms.fill(0, channelsCount);
+    
+    clear();
+    updateGeometry();
+    
+}
+
+
+/* Show new levels, which must have the number of channels of the meter. */
+void LevelMeter::setLevels(const LoudnessMeter::Levels &levels)
+{
+    
+    std::copy(levels.peaks.constBegin(), levels.peaks.constBegin() + m_peaks.size(), m_peaks.begin());
+    std::copy(levels.rms.constBegin(), levels.rms.constBegin() + m_rms.size(), m_rms.begin());
+    
+    m_momentary  = levels.momentary;
+    m_shortTerm  = levels.shortTerm;
+    m_integrated = levels.integrated;
+    
+    update();
+    
+}
+
+
+/* Show no level, when nothing is played. */
+void LevelMeter::clear()
+{
+    
+    std::fill(m_peaks.begin(), m_peaks.end(), 0.0f);
+    std::fill(m_rms.begin(), m_rms.end(), 0.0f);
+    
+    m_momentary  = -HUGE_VAL;
+    m_shortTerm  = -HUGE_VAL;
+    m_integrated = -HUGE_VAL;
+    
+    update();
+    
+}
+
+
+/* Bars are a few pixels wide, the widget gets wider with the number of channels up to a limit. */
+QSize LevelMeter::sizeHint() const
+{
+    return QSize(std::max(minimumWidth(), std::min(m_peaks.size() * 6, 160) + 2 * padding), 200);
+}
+
+
+/* Draw the bars of the channels, then the loudness values below them. */
+void LevelMeter::paintEvent(__attribute__((unused)) QPaintEvent *event)
+{
+    
+    QPainter painter(this);
+    
+    int   textHeight = fontMetrics().height();
+    QRect bars       = QRect(padding, padding, width() - 2 * padding, height() - 3 * textHeight - 3 * padding);
+    
+    painter.fillRect(bars, Qt::black);
+    
+    // Position of a level, given relative to full scale, on the scale of the bars
+    auto levelY = [&](float level) {
+        double decibels = level > 0 ? 20 * std::log10(level) : minimumLevel;
+        double ratio    = (std::min(decibels, 0.0) - minimumLevel) / -minimumLevel;
+        return bars.bottom() - (int) (std::max(ratio, 0.0) * bars.height());
+    };
+    
+    int channelsCount = m_peaks.size();
+    
+    for (int channel = 0; channel < channelsCount; channel++)
+    {
+        int left  = bars.x() + channel * bars.width() / channelsCount;
+        int right = bars.x() + (channel + 1) * bars.width() / channelsCount;
+        int width = std::max(1, right - left - (channelsCount <= bars.width() / 3 ? 1 : 0));
+        int rmsY  = levelY(m_rms.at(channel));
+        int peakY = levelY(m_peaks.at(channel));
+        
+        painter.fillRect(QRect(left, rmsY, width, bars.bottom() - rmsY + 1), QColor(60, 180, 75));
+        painter.fillRect(QRect(left, peakY, width, 2), m_peaks.at(channel) >= 1.0f ? Qt::red : Qt::yellow);
+    }
+    
+    // Loudness values
+    QRect text = QRect(padding, bars.bottom() + padding, width() - 2 * padding, textHeight);
+    
+    painter.drawText(text, Qt::AlignLeft, "M " + formatLoudness(m_momentary));
+    text.translate(0, textHeight + padding);
+    painter.drawText(text, Qt::AlignLeft, "S " + formatLoudness(m_shortTerm));
+    text.translate(0, textHeight + padding);
+    painter.drawText(text, Qt::AlignLeft, "I " + formatLoudness(m_integrated));
+    
+}
+
+
+QString LevelMeter::formatLoudness(double loudness)
+{
+    return std::isfinite(loudness) ? QString::number(loudness, 'f', 1) : QString("-inf");
+}
@@ -0,0 +1,47 @@
+#ifndef LEVELMETER_H
+#define LEVELMETER_H
+
+#include <QVector>
+#include <QWidget>
+
+#include "loudnessmeter.h"
+
+
+/* Widget which shows the levels of the audio being played
+ *
+ * A bar per channel shows its RMS level, with a line at its peak level, on a scale from
+ * -60 dBFS to 0 dBFS (peaks which reach full scale are drawn in red). The momentary,
+ * short-term and integrated loudness are written below, in LUFS.
+ * The levels are copied by setLevels, so that the widget never shares the buffers of the thread which measures them.
+ */
+class LevelMeter : public QWidget
+{
+    
+    Q_OBJECT
+    
+public:
+    static const int minimumLevel = -60;  // dBFS, bottom of the bars
+    
+    LevelMeter(QWidget *parent = 0);
+    
+    void setChannelsCount(int channelsCount);
+    void setLevels(const LoudnessMeter::Levels &levels);
+    void clear();
+    
+    QSize sizeHint() const;
+    
+protected:
+    void paintEvent(QPaintEvent *event);
+    
+private:
+    QVector<float> m_peaks;
+    QVector<float> m_rms;
+    double m_momentary  = -HUGE_VAL;
+    double m_shortTerm  = -HUGE_VAL;
+    double m_integrated = -HUGE_VAL;
+    
+    static QString formatLoudness(double loudness);
+    
+};
+
+#endif // LEVELMETER_H
@@ -0,0 +1,294 @@
+#include <algorithm>
+
+#include "loudnessmeter.h"
+
+
+const double LoudnessMeter::absoluteGate = -70;
+const double LoudnessMeter::relativeGate = -10;
+
+
+/* Compute the coefficients of both stages for a sample rate.
+ *
+ * They are derived from the analog prototypes of BS.1770 with the bilinear transform, which gives
+ * the coefficients of the standard at 48 kHz. */
+void LoudnessMeter::Filter::setSampleRate(int sampleRate)
+{
+    
+    // High shelf, modelling the acoustic effect of the head
+    double frequency = 1681.974450955533;
+    double gain      = 3.999843853973347;  // dB
+    double q         = 0.7071752369554196;
+    double k         = std::tan(M_PI * frequency / sampleRate);
+    double vh        = std::pow(10.0, gain / 20.0);
+    double vb        = std::pow(vh, 0.4996667741545416);
+    double a0        = 1.0 + k / q + k * k;
+    
+    m_b[0][0] = (vh + vb * k / q + k * k) / a0;
+    m_b[0][1] = 2.0 * (k * k - vh) / a0;
+    m_b[0][2] = (vh - vb * k / q + k * k) / a0;
+    m_a[0][0] = 2.0 * (k * k - 1.0) / a0;
+    m_a[0][1] = (1.0 - k / q + k * k) / a0;
+    
+    // High pass (RLB weighting)
+    frequency = 38.13547087602444;
+    q         = 0.5003270373238773;
+    k         = std::tan(M_PI * frequency / sampleRate);
+    a0        = 1.0 + k / q + k * k;
+    
+    m_b[1][0] = 1.0;
+    m_b[1][1] = -2.0;
+    m_b[1][2] = 1.0;
+    m_a[1][0] = 2.0 * (k * k - 1.0) / a0;
+    m_a[1][1] = (1.0 - k / q + k * k) / a0;
+    
+    reset();
+    
+}
+
+
+void LoudnessMeter::Filter::reset()
+{
+    std::fill(&m_state[0][0], &m_state[0][0] + 4, 0.0);
+}
+
+
+/* Prepare the meter for a format, and reset it. This is where its memory is allocated. */
+void LoudnessMeter::setFormat(int sampleRate, int channelsCount, int significantBits)
+{
+    
+    m_stepFrames  = std::max(1, sampleRate / stepsPerSecond);
+    m_sampleScale = std::ldexp(1.0, 1 - significantBits);
+    
+    m_filters.resize(channelsCount);
+    m_weights.resize(channelsCount);
+    m_sumsOfSquares.resize(channelsCount);
+    m_weightedSums.resize(channelsCount);
+    m_stepPeaks.resize(channelsCount);
+    m_peaks.resize(channelsCount);
+    m_rms.resize(channelsCount);
+    m_blocksCounts.resize(histogramBins);
+    m_blocksEnergies.resize(histogramBins);
+    
+    for (int channel = 0; channel < channelsCount; channel++)
+    {
+        m_filters[channel].setSampleRate(sampleRate);
+        m_weights[channel] = channelWeight(channel, channelsCount);
+    }
+    
+    reset();
+    
+}
+
+
+/* Forget all the samples measured so far. */
+void LoudnessMeter::reset()
+{
+    
+    for (Filter &filter : m_filters)
+        filter.reset();
+    
+    std::fill(m_sumsOfSquares.begin(), m_sumsOfSquares.end(), 0.0);
+    std::fill(m_weightedSums.begin(), m_weightedSums.end(), 0.0);
+    std::fill(m_stepPeaks.begin(), m_stepPeaks.end(), 0.0);
+    std::fill(m_peaks.begin(), m_peaks.end(), 0.0f);
+    std::fill(m_rms.begin(), m_rms.end(), 0.0f);
+    std::fill(m_blocksCounts.begin(), m_blocksCounts.end(), 0);
+    std::fill(m_blocksEnergies.begin(), m_blocksEnergies.end(), 0.0);
+    
+    m_stepPosition = 0;
+    m_stepsCount   = 0;
+    m_maxMomentary = -HUGE_VAL;
+    m_maxShortTerm = -HUGE_VAL;
+    
+}
+
+
+/* The frames are processed channel by channel up to the end of each step. */
+void LoudnessMeter::process(const int *samples, qint64 channelStride, qint64 framesCount)
+{
+    
+    for (qint64 frame = 0; frame < framesCount; )
+    {
+        qint64 count = std::min(framesCount - frame, m_stepFrames - m_stepPosition);
+        
+        for (int channel = 0; channel < m_filters.size(); channel++)
+        {
+            const int *channelSamples = samples + channel * channelStride + frame;
+            Filter    &filter         = m_filters[channel];
+            double     sumOfSquares   = 0;
+            double     weightedSum    = 0;
+            double     peak           = m_stepPeaks.at(channel);
+            
+            for (qint64 i = 0; i < count; i++)
+            {
+                double sample   = channelSamples[i];
+                double weighted = filter.process(sample);
+                
+                sumOfSquares += sample * sample;
+                weightedSum  += weighted * weighted;
+                peak          = std::max(peak, std::abs(sample));
+            }
+            
+            m_sumsOfSquares[channel] += sumOfSquares;
+            m_weightedSums[channel]  += weightedSum;
+            m_stepPeaks[channel]      = peak;
+        }
+        
+        frame          += count;
+        m_stepPosition += count;
+        
+        if (m_stepPosition == m_stepFrames)
+            finishStep();
+    }
+    
+}
+
+
+/* Compute the levels of the step which was just completed, and start the next one. */
+void LoudnessMeter::finishStep()
+{
+    
+    double energy = 0;
+    
+    for (int channel = 0; channel < m_filters.size(); channel++)
+    {
+        m_peaks[channel] = m_stepPeaks.at(channel) * m_sampleScale;
+        m_rms[channel]   = std::sqrt(m_sumsOfSquares.at(channel) / m_stepFrames) * m_sampleScale;
+        energy          += m_weights.at(channel) * m_weightedSums.at(channel) / m_stepFrames;
+        
+        m_sumsOfSquares[channel] = 0;
+        m_weightedSums[channel]  = 0;
+        m_stepPeaks[channel]     = 0;
+    }
+    
+    m_stepPosition = 0;
+    
+    addStep(energy * m_sampleScale * m_sampleScale);
+    
+}
+
+
+/* The block of the last 400 ms is counted in the histogram once there are enough steps. */
+void LoudnessMeter::addStep(double energy)
+{
+    
+    m_energies[m_stepsCount % shortTermSteps] = energy;
+    m_stepsCount++;
+    
+    if (m_stepsCount >= momentarySteps)
+    {
+        double blockEnergy = meanEnergy(momentarySteps);
+        double blockLevel  = loudness(blockEnergy);
+        
+        m_maxMomentary = std::max(m_maxMomentary, blockLevel);
+        
+        if (blockLevel > absoluteGate)
+        {
+            int bin = std::min(histogramBins - 1, (int) ((blockLevel - absoluteGate) * 100));
+            
+            m_blocksCounts[bin]++;
+            m_blocksEnergies[bin] += blockEnergy;
+        }
+    }
+    
+    if (m_stepsCount >= shortTermSteps)
+        m_maxShortTerm = std::max(m_maxShortTerm, loudness(meanEnergy(shortTermSteps)));
+    
+}
+
+
+double LoudnessMeter::meanEnergy(int stepsCount)
+{
+    
+    double sum = 0;
+    
+    for (int i = 1; i <= stepsCount; i++)
+        sum += m_energies[(m_stepsCount - i) % shortTermSteps];
+    
+    return sum / stepsCount;
+    
+}
+
+
+double LoudnessMeter::momentary()
+{
+    return m_stepsCount >= momentarySteps ? loudness(meanEnergy(momentarySteps)) : -HUGE_VAL;
+}
+
+
+double LoudnessMeter::shortTerm()
+{
+    return m_stepsCount >= shortTermSteps ? loudness(meanEnergy(shortTermSteps)) : -HUGE_VAL;
+}
+
+
+/* The relative gate is found from the mean energy of the blocks above the absolute gate, then the blocks
+ * of the bins above it are averaged. The gate is thus applied to within a bin, 0.01 LU. */
+double LoudnessMeter::integrated()
+{
+    
+    quint64 blocksCount = 0;
+    double  energy      = 0;
+    
+    for (int bin = 0; bin < histogramBins; bin++)
+    {
+        blocksCount += m_blocksCounts.at(bin);
+        energy      += m_blocksEnergies.at(bin);
+    }
+    
+    if (blocksCount == 0)
+        return -HUGE_VAL;
+    
+    double gate     = loudness(energy / blocksCount) + relativeGate;
+    int    firstBin = std::max(0, (int) std::ceil((gate - absoluteGate) * 100));
+    
+    blocksCount = 0;
+    energy      = 0;
+    
+    for (int bin = firstBin; bin < histogramBins; bin++)
+    {
+        blocksCount += m_blocksCounts.at(bin);
+        energy      += m_blocksEnergies.at(bin);
+    }
+    
+    return blocksCount ? loudness(energy / blocksCount) : -HUGE_VAL;
+    
+}
+
+
+void LoudnessMeter::getLevels(Levels &levels)
+{
+    
+    std::copy(m_peaks.constBegin(), m_peaks.constEnd(), levels.peaks.data());
+    std::copy(m_rms.constBegin(), m_rms.constEnd(), levels.rms.data());
+    
+    levels.momentary  = momentary();
+    levels.shortTerm  = shortTerm();
+    levels.integrated = integrated();
+    
+}
+
+
+/* Weights of the channels in the loudness, as given by BS.1770 for 5.0 and 5.1 layouts
+ * (the surround channels count more and the LFE channel is left out), 1 for other layouts. */
+double LoudnessMeter::channelWeight(int channelIndex, int channelsCount)
+{
+    
+    if (channelsCount == 5 && channelIndex >= 3)
+        return 1.41;
+    
+    if (channelsCount == 6 && channelIndex == 3)
+        return 0;
+    
+    if (channelsCount == 6 && channelIndex >= 4)
+        return 1.41;
+    
+    return 1;
+    
+}
+
+
+double LoudnessMeter::loudness(double energy)
+{
+    return energy > 0 ? -0.691 + 10 * std::log10(energy) : -HUGE_VAL;
+}
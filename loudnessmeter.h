@@ -0,0 +1,130 @@
+#ifndef LOUDNESSMETER_H
+#define LOUDNESSMETER_H
+
+#include <cmath>
+
+#include <QVector>
+
+
+/* Level and loudness meter of multichannel audio, fed with blocks of decoded samples
+ *
+ * The samples are measured in steps of 100 ms. For each channel, the peak and RMS level of the
+ * last step are given relative to full scale. The loudness is measured as in ITU-R BS.1770 and
+ * EBU R128: the samples are K-weighted (a high shelf then a high pass), and the mean squares of
+ * the channels are summed with their weights at each step. The momentary loudness is given over
+ * the last 400 ms, the short-term loudness over the last 3 s, and the integrated loudness over the
+ * 400 ms blocks (one per step) above the absolute gate of -70 LUFS and the relative gate of -10 LU.
+ *
+ * Blocks are gated through a histogram of their loudness in 0.01 LU bins, so that the integrated
+ * loudness needs a fixed amount of memory whatever the length of the audio. Once the format is set,
+ * processing samples never allocates memory: the meter can be used in the audio delivery thread.
+ */
+class LoudnessMeter
+{
+    
+public:
+    static const int stepsPerSecond = 10;  // Steps of 100 ms
+    static const int momentarySteps = 4;   // 400 ms
+    static const int shortTermSteps = 30;  // 3 s
+    
+    /* K-weighting filter of a single channel: two biquads in series, in transposed direct form II */
+    class Filter
+    {
+    
+    public:
+        void setSampleRate(int sampleRate);
+        void reset();
+        
+        double process(double sample)
+        {
+            for (int i = 0; i < 2; i++)
+            {
+                double output = m_b[i][0] * sample + m_state[i][0];
+                m_state[i][0] = m_b[i][1] * sample - m_a[i][0] * output + m_state[i][1];
+                m_state[i][1] = m_b[i][2] * sample - m_a[i][1] * output;
+                sample        = output;
+            }
+            return sample;
+        };
+    
+    private:
+        double m_b[2][3];
+        double m_a[2][2];
+        double m_state[2][2] = {{0, 0}, {0, 0}};
+        
+    };
+    
+    // Levels given to other threads, all relative to full scale or in LUFS
+    struct Levels
+    {
+        QVector<float> peaks;
+        QVector<float> rms;
+        double momentary  = -HUGE_VAL;
+        double shortTerm  = -HUGE_VAL;
+        double integrated = -HUGE_VAL;
+    };
+    
+    void setFormat(int sampleRate, int channelsCount, int significantBits);
+    void reset();
+    
+    // Process the decoded samples of all the channels of a run of frames, those of channel c starting at samples + c * channelStride
+    void process(const int *samples, qint64 channelStride, qint64 framesCount);
+    
+    // Add a step of 100 ms given by the weighted sum of the K-weighted mean squares of the channels
+    void addStep(double energy);
+    
+    // Copy the levels of the last step, without allocating: levels must already hold a value per channel
+    void getLevels(Levels &levels);
+    
+    // Getters
+    int    channelsCount()             {return m_filters.size();};
+    int    stepFrames()                {return m_stepFrames;};
+    double sampleScale()               {return m_sampleScale;};
+    qint64 stepsCount()                {return m_stepsCount;};
+    float  peak(int channelIndex)      {return m_peaks.at(channelIndex);};  // Over the last step
+    float  rms(int channelIndex)       {return m_rms.at(channelIndex);};
+    double maxMomentary()              {return m_maxMomentary;};
+    double maxShortTerm()              {return m_maxShortTerm;};
+    double momentary();
+    double shortTerm();
+    double integrated();
+    
+    static double channelWeight(int channelIndex, int channelsCount);
+    static double loudness(double energy);  // In LUFS
+    
+private:
+    static const int    histogramBins   = 10000;  // Blocks from -70 to +30 LUFS
+    static const double absoluteGate;             // LUFS
+    static const double relativeGate;             // LU
+    
+    int     m_stepFrames  = 0;
+    double  m_sampleScale = 1;
+    
+    // Current step
+    QVector<Filter> m_filters;
+    QVector<double> m_weights;
+    QVector<double> m_sumsOfSquares;    // Samples, for the RMS
+    QVector<double> m_weightedSums;     // K-weighted samples, for the loudness
+    QVector<double> m_stepPeaks;
+    qint64          m_stepPosition = 0; // Frames already in the current step
+    
+    // Levels of the last step
+    QVector<float>  m_peaks;
+    QVector<float>  m_rms;
+    
+    // Energies of the last steps, in a circular buffer
+    double  m_energies[shortTermSteps];
+    qint64  m_stepsCount   = 0;
+    double  m_maxMomentary = -HUGE_VAL;
+    double  m_maxShortTerm = -HUGE_VAL;
+    
+    // Blocks above the absolute gate
+    QVector<quint64> m_blocksCounts;
+    QVector<double>  m_blocksEnergies;
+    
+    void   finishStep();
+    double meanEnergy(int stepsCount);
+    
+};
+
+#endif // LOUDNESSMETER_H
@@ -1,8 +1,79 @@
 #include "mainwindow.h"
+#include "batchprocessor.h"
+#include "benchmark.h"
+#include "playbacktest.h"
+#include "renderbenchmark.h"
 #include <QApplication>
+#include <QCoreApplication>
+#include <cstdio>
+#include <cstring>
 
 int main(int argc, char *argv[])
 {
+    // Headless modes: process files, run benchmarks or check the playback from the command line, without any window
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--batch") == 0)
+        {
+            QCoreApplication a(argc, argv);
+            BatchProcessor batch;
+            
+            if (!batch.parseArguments(a.arguments()))
+            {
+                fprintf(stderr, "%s\n\n%s", batch.error(), BatchProcessor::usage);
+                return 2;
+            }
+            
+            return batch.run();
+        }
+        
+        if (strcmp(argv[i], "--benchmark") == 0)
+        {
+            QCoreApplication a(argc, argv);
+            Benchmark benchmark;
+            
+            if (!benchmark.parseArguments(a.arguments()))
+            {
+                fprintf(stderr, "%s\n\n%s", benchmark.error(), Benchmark::usage);
+                return 2;
+            }
+            
+            return benchmark.run();
+        }
+        
+        if (strcmp(argv[i], "--playback-test") == 0)
+        {
+            QCoreApplication a(argc, argv);
+            PlaybackTest test;
+            
+            if (!test.parseArguments(a.arguments()))
+            {
+                fprintf(stderr, "%s\n\n%s", test.error(), PlaybackTest::usage);
+                return 2;
+            }
+            
+            return test.run();
+        }
+        
+        if (strcmp(argv[i], "--render-benchmark") == 0)
+        {
+            // The plot is only rendered into images, no display is needed
+            if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+                qputenv("QT_QPA_PLATFORM", "offscreen");
+            
+            QApplication a(argc, argv);
+            RenderBenchmark benchmark;
+            
+            if (!benchmark.parseArguments(a.arguments()))
+            {
+                fprintf(stderr, "%s\n\n%s", benchmark.error(), RenderBenchmark::usage);
+                return 2;
+            }
+            
+            return benchmark.run();
+        }
+    }
+    
     QApplication a(argc, argv);
     MainWindow w;
     w.show();
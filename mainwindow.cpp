@@ -1,5 +1,10 @@
 #include "mainwindow.h"
 
+
+// Interval between two repaints of the waveform during playback
+static const int frameInterval = 16;  // ms, about 60 frames per second
+
+
 MainWindow::MainWindow(QWidget *parent): QMainWindow(parent)
 {
     
@@ -15,6 +20,7 @@ MainWindow::MainWindow(QWidget *parent): QMainWindow(parent)
     createToolBar();         // Create toolbar
     createInfoSection();     // Create the upper part of the UI
     createPlayerSection();   // Create the lower part of the UI
+    createStatusBar();       // Create the progress of the file being loaded
     setItemsEnabled(false);  // Disable buttons until we load a file
 
     // Window parameters
@@ -44,6 +50,67 @@ void MainWindow::createActions()
     actionStop      = new QAction(QIcon(":/images/stop.png"), tr("Stop"), this);
     actionCut       = new QAction(QIcon(":/images/cut.png"),  tr("Cut"),  this);
     
+    actionUndo = new QAction(tr("Undo"), this);
+    actionUndo->setShortcut(QKeySequence::Undo);
+    connect(actionUndo, &QAction::triggered, this, &MainWindow::undoEdit);
+    
+    actionRedo = new QAction(tr("Redo"), this);
+    actionRedo->setShortcut(QKeySequence::Redo);
+    connect(actionRedo, &QAction::triggered, this, &MainWindow::redoEdit);
+    
+    // Processing of the selection, the operation is kept in the data of the actions
+    actionGain           = new QAction(tr("Gain..."),          this);
+    actionFadeIn         = new QAction(tr("Fade In"),          this);
+    actionFadeOut        = new QAction(tr("Fade Out"),         this);
+    actionNormalize      = new QAction(tr("Normalize"),        this);
+    actionRemoveDcOffset = new QAction(tr("Remove DC Offset"), this);
+    actionGain->setData(AudioProcessor::Gain);
+    actionFadeIn->setData(AudioProcessor::FadeIn);
+    actionFadeOut->setData(AudioProcessor::FadeOut);
+    actionNormalize->setData(AudioProcessor::Normalize);
+    actionRemoveDcOffset->setData(AudioProcessor::RemoveDcOffset);
+    
+    for (QAction *action : {actionGain, actionFadeIn, actionFadeOut, actionNormalize, actionRemoveDcOffset})
+        connect(action, &QAction::triggered, this, &MainWindow::processSelection);
+    
+    actionSpectrogram = new QAction(tr("Spectrogram"), this);
+    actionSpectrogram->setCheckable(true);
+    
+    // Settings of the spectrogram, the values are kept in the data of the actions
+    Spectrogram::Settings settings;
+    const char           *windowNames[] = {QT_TR_NOOP("Rectangular"), QT_TR_NOOP("Hann"), QT_TR_NOOP("Hamming"), QT_TR_NOOP("Blackman")};
+    
+    windowSizeGroup = new QActionGroup(this);
+    for (int size : {512, 1024, 2048, 4096, 8192})
+    {
+        QAction *action = windowSizeGroup->addAction(tr("%1 frames").arg(size));
+        action->setData(size);
+        action->setCheckable(true);
+        action->setChecked(size == settings.windowSize);
+    }
+    
+    hopGroup = new QActionGroup(this);
+    for (int hop : {128, 256, 512, 1024, 2048})
+    {
+        QAction *action = hopGroup->addAction(tr("%1 frames").arg(hop));
+        action->setData(hop);
+        action->setCheckable(true);
+        action->setChecked(hop == settings.hop);
+    }
+    
+    windowFunctionGroup = new QActionGroup(this);
+    for (Spectrogram::WindowFunction window : {Spectrogram::Rectangular, Spectrogram::Hann, Spectrogram::Hamming, Spectrogram::Blackman})
+    {
+        QAction *action = windowFunctionGroup->addAction(tr(windowNames[window]));
+        action->setData(window);
+        action->setCheckable(true);
+        action->setChecked(window == settings.window);
+    }
+    
+    connect(windowSizeGroup,     &QActionGroup::triggered, this, &MainWindow::updateSpectrogramSettings);
+    connect(hopGroup,            &QActionGroup::triggered, this, &MainWindow::updateSpectrogramSettings);
+    connect(windowFunctionGroup, &QActionGroup::triggered, this, &MainWindow::updateSpectrogramSettings);
+    
     actionPlayPause->setObjectName("actionPlayPause");
     actionStop->setObjectName("actionStop");
     
@@ -59,10 +126,26 @@ void MainWindow::createMenus()
     fileMenu->addAction(actionExport);
     fileMenu->addAction(actionClose);
     
+    editMenu = menuBar()->addMenu(tr("Edit"));
+    editMenu->addAction(actionUndo);
+    editMenu->addAction(actionRedo);
+    
     audioMenu = menuBar()->addMenu(tr("Audio"));
     audioMenu->addAction(actionPlayPause);
     audioMenu->addAction(actionStop);
     audioMenu->addAction(actionCut);
+    audioMenu->addSeparator();
+    audioMenu->addAction(actionGain);
+    audioMenu->addAction(actionFadeIn);
+    audioMenu->addAction(actionFadeOut);
+    audioMenu->addAction(actionNormalize);
+    audioMenu->addAction(actionRemoveDcOffset);
+    
+    viewMenu = menuBar()->addMenu(tr("View"));
+    viewMenu->addAction(actionSpectrogram);
+    viewMenu->addMenu(tr("Spectrogram Window Size"))->addActions(windowSizeGroup->actions());
+    viewMenu->addMenu(tr("Spectrogram Hop"))->addActions(hopGroup->actions());
+    viewMenu->addMenu(tr("Spectrogram Window Function"))->addActions(windowFunctionGroup->actions());
     
 }
 
@@ -147,11 +230,19 @@ void MainWindow::createPlayerSection()
     
     // Signal plot
     waveFormPlot = new SignalPlot;
+    connect(actionSpectrogram, &QAction::toggled, waveFormPlot, &SignalPlot::setSpectrogramVisible);
     
     // Volume
     volume = new QSlider;
     volume->setValue(50);
     
+    // Levels of the audio being played, next to the volume
+    levelMeter = new LevelMeter;
+    
+    QHBoxLayout *volumeLayout = new QHBoxLayout;
+    volumeLayout->addWidget(volume);
+    volumeLayout->addWidget(levelMeter);
+    
     // Time line
     timeLine = new QScrollBar(Qt::Horizontal);
     timeLine->setVisible(false);
@@ -167,7 +258,7 @@ void MainWindow::createPlayerSection()
     playerLayout->addWidget(scale,        1, 2);
     playerLayout->addWidget(scaleValue,   1, 3, Qt::AlignCenter);
     playerLayout->addWidget(waveFormPlot, 2, 1, 1, 2);
-    playerLayout->addWidget(volume,       2, 3, Qt::AlignHCenter);
+    playerLayout->addLayout(volumeLayout, 2, 3);
     playerLayout->addWidget(timeLine,     3, 1, 1, 2);
     playerLayout->addWidget(timeCode,     3, 3, Qt::AlignCenter);
     
@@ -180,6 +271,26 @@ void MainWindow::createPlayerSection()
     mainLayout->addWidget(playerGroup, Qt::AlignBottom);
     
 }
+
+
+/* This method creates the progress bar of the file being loaded, with its button to cancel, hidden until a file is opened */
+void MainWindow::createStatusBar()
+{
+    
+    loadProgress = new QProgressBar;
+    loadProgress->setRange(0, 100);
+    loadProgress->setMaximumWidth(200);
+    loadProgress->hide();
+    
+    cancelLoadButton = new QPushButton(tr("Cancel"));
+    cancelLoadButton->hide();
+    
+    statusBar()->addPermanentWidget(loadProgress);
+    statusBar()->addPermanentWidget(cancelLoadButton);
+    
+    connect(cancelLoadButton, &QPushButton::clicked, this, &MainWindow::closeFile);
+    
+}
             
 /* This method is used to enable/disable multiple UI elements at once */
 void MainWindow::setItemsEnabled(bool enable)
@@ -192,22 +303,39 @@ void MainWindow::setItemsEnabled(bool enable)
     timeCode->setEnabled(enable);
     
     actionOpen->setEnabled(!enable);
-    actionExport->setEnabled(enable);
     actionClose->setEnabled(enable);
     
+    setAudioActionsEnabled(enable);
+    
+    // Nothing to undo/redo until an edit is made
+    actionUndo->setEnabled(false);
+    actionRedo->setEnabled(false);
+
+}
+
+
+/* Enable/disable the actions which read the whole audio data: they wait until the file is loaded. */
+void MainWindow::setAudioActionsEnabled(bool enable)
+{
+    
+    actionExport->setEnabled(enable);
     actionPlayPause->setEnabled(enable);
     actionStop->setEnabled(enable);
     actionCut->setEnabled(enable);
-
+    actionGain->setEnabled(enable);
+    actionFadeIn->setEnabled(enable);
+    actionFadeOut->setEnabled(enable);
+    actionNormalize->setEnabled(enable);
+    actionRemoveDcOffset->setEnabled(enable);
+    
 }
 
 
 /* This slot handles everything related to opening an audio file. 
  *
  * It provides a default file picker to choose the location of your audio file.
- * It creates an instance of QMediaPlayer to play the audio
- * It creates an instance of SignalPlot to display the audio waveform
- * It connects all UI elements with the player backend
+ * The file is opened by a FileLoader in the background: the window is set up once its header is read
+ * (see showFile), while the audio data is loaded with a progress bar and a button to cancel.
  */
 void MainWindow::openFile()
 {
@@ -218,51 +346,126 @@ void MainWindow::openFile()
     {
         
         audioSource = new WavBuffer;
-        if (!audioSource->loadFile(filePath.toStdString().c_str()))
-        {
-            QMessageBox::warning(this, tr("Error"), tr(audioSource->error()));
-            return;
-        }
+        fileLoader  = new FileLoader(audioSource, filePath);
         
-        // Update UI with audio file information
-        setItemsEnabled(true);
-        updateInfoSection(audioSource->filePath(),
-                          QString::number(audioSource->channelsCount()),
-                          QString::number(audioSource->bitDepth()),
-                          QString::number(audioSource->sampleRate()));
+        connect(fileLoader, &FileLoader::headerLoaded,    this,         &MainWindow::showFile);
+        connect(fileLoader, SIGNAL(framesLoaded()),       waveFormPlot, SLOT(update()));
+        connect(fileLoader, &FileLoader::progressChanged, loadProgress, &QProgressBar::setValue);
+        connect(fileLoader, &QThread::finished,           this,         &MainWindow::finishOpening);
         
-        // Create the player
-        player = new QMediaPlayer;
-        player->setMedia(QUrl::fromLocalFile(audioSource->filePath()));
+        actionOpen->setEnabled(false);
+        loadProgress->setValue(0);
+        loadProgress->show();
+        cancelLoadButton->show();
         
-        // Load the waveform
-        waveFormPlot->preparePlot(audioSource, player);
-        
-        // Connect the UI with the player backend
-        connect(actionPlayPause, &QAction::triggered,            this,         &MainWindow::playPauseStop);
-        connect(actionStop,      &QAction::triggered,            this,         &MainWindow::playPauseStop);
-        connect(actionCut,       SIGNAL(triggered()),            waveFormPlot, SLOT(refreshCut()));
-        connect(volume,          &QSlider::valueChanged,         player,       &QMediaPlayer::setVolume);
-        connect(scale,           &QSlider::valueChanged,         waveFormPlot, &SignalPlot::setScale);
-        connect(timeLine,        &QScrollBar::valueChanged,      player,       &QMediaPlayer::setPosition);
-        connect(timeLine,        &QScrollBar::valueChanged,      waveFormPlot, &SignalPlot::refreshPosition);
-        connect(player,          &QMediaPlayer::positionChanged, timeLine,     &QScrollBar::setValue);
-        connect(player,          &QMediaPlayer::positionChanged, this,         &MainWindow::setTimeCode);
-        connect(player,          &QMediaPlayer::durationChanged, this,         &MainWindow::setTimeLine);
-        
-        /* The signal QMediaPlayer::positionChanged is not emitted often enough to use it for the waveform
-         * plot and the timecode value so we use QTimers instead */
-        timerWaveForm = new QTimer();
-        connect(timerWaveForm,   &QTimer::timeout,               waveFormPlot, &SignalPlot::refreshPosition);
-        
-        timerTimeCode = new QTimer();
-        connect(timerTimeCode,   &QTimer::timeout,               this,         &MainWindow::setTimeCode);
+        fileLoader->start();
         
     }
 
 }
 
 
+/* Set the window up for the file being opened, once its header is read.
+ *
+ * It creates an instance of AudioEngine to play the audio
+ * It creates an instance of SignalPlot to display the audio waveform
+ * It connects all UI elements with the player backend
+ * The actions which need the whole audio data are only enabled once the file is loaded (see finishOpening).
+ */
+void MainWindow::showFile()
+{
+    
+    // The loader may have been cancelled meanwhile
+    if (sender() != fileLoader)
+        return;
+    
+    // Update UI with audio file information
+    setItemsEnabled(true);
+    setAudioActionsEnabled(false);
+    updateInfoSection(audioSource->filePath(),
+                      QString::number(audioSource->channelsCount()),
+                      QString::number(audioSource->bitDepth()),
+                      QString::number(audioSource->sampleRate()));
+    
+    // Create the player, which plays the edited audio (without an audio device, playback is simulated)
+    player = new AudioEngine(audioSource);
+    if (!player->setOutput(AudioEngine::DeviceOutput))
+        statusBar()->showMessage(tr("No audio output: %1").arg(tr(player->error())));
+    player->setVolume(volume->value());
+    
+    // Load the waveform
+    waveFormPlot->preparePlot(audioSource, player);
+    levelMeter->setChannelsCount(audioSource->channelsCount());
+    
+    // Compute the peaks of the waveform in the background, the plot is refreshed as they arrive
+    peakBuilder = new PeakBuilder(audioSource);
+    connect(peakBuilder,  SIGNAL(peaksUpdated()),              waveFormPlot, SLOT(update()));
+    connect(peakBuilder,  &PeakBuilder::progressChanged,       this,         &MainWindow::showPeaksProgress);
+    connect(waveFormPlot, &SignalPlot::visibleRangeChanged,    peakBuilder,  &PeakBuilder::setVisibleRange);
+    peakBuilder->start(QThread::LowPriority);
+
+    // Thanks to the peak pyramid, any scale can be drawn quickly: allow zooming out to the whole file
+    int maximumScale = (int) qBound<qint64>(500, audioSource->framesCount() / waveFormPlot->width() + 1, INT_MAX);
+    scale->setMaximum(maximumScale);
+    scaleValue->setMaximum(maximumScale);
+
+    // Connect the UI with the player backend
+    connect(actionPlayPause, &QAction::triggered,            this,         &MainWindow::playPauseStop);
+    connect(actionStop,      &QAction::triggered,            this,         &MainWindow::playPauseStop);
+    connect(actionCut,       SIGNAL(triggered()),            waveFormPlot, SLOT(refreshCut()));
+    connect(actionCut,       &QAction::triggered,            this,         &MainWindow::updateEditActions);
+    connect(actionCut,       &QAction::triggered,            player,       &AudioEngine::refreshEdits);
+    connect(actionCut,       &QAction::triggered,            this,         &MainWindow::setTimeLine);
+    connect(volume,          &QSlider::valueChanged,         player,       &AudioEngine::setVolume);
+    connect(scale,           &QSlider::valueChanged,         waveFormPlot, &SignalPlot::setScale);
+    connect(timeLine,        &QScrollBar::valueChanged,      this,         &MainWindow::seekTimeLine);
+    connect(timeLine,        &QScrollBar::valueChanged,      waveFormPlot, &SignalPlot::refreshPosition);
+    connect(player,          &AudioEngine::positionChanged,  this,         &MainWindow::updateTimeLine);
+    connect(player,          &AudioEngine::positionChanged,  this,         &MainWindow::setTimeCode);
+    connect(player,          &AudioEngine::stateChanged,     this,         &MainWindow::showPlayerState);
+    
+    setTimeLine();
+    
+    /* The waveform plot follows the playback at a bounded frame rate, reading the position
+     * interpolated from the audio clock at each frame, and the levels published meanwhile are shown.
+     * The timecode only needs a slow timer */
+    timerWaveForm = new QTimer();
+    timerWaveForm->setTimerType(Qt::PreciseTimer);
+    connect(timerWaveForm,   &QTimer::timeout,               waveFormPlot, &SignalPlot::refreshPosition);
+    connect(timerWaveForm,   &QTimer::timeout,               this,         &MainWindow::updateLevels);
+    
+    timerTimeCode = new QTimer();
+    connect(timerTimeCode,   &QTimer::timeout,               this,         &MainWindow::setTimeCode);
+    
+}
+
+
+/* Finish the opening of a file once its loader is done.
+ *
+ * If the file could not be opened or read, or if loading was cancelled, the file is closed. */
+void MainWindow::finishOpening()
+{
+    
+    if (sender() != fileLoader)
+        return;
+    
+    loadProgress->hide();
+    cancelLoadButton->hide();
+    
+    if (!audioSource->isLoaded() || fileLoader->error()[0])
+    {
+        if (fileLoader->error()[0])
+            QMessageBox::warning(this, tr("Error"), tr(fileLoader->error()));
+        
+        closeFile();
+        return;
+    }
+    
+    setAudioActionsEnabled(true);
+    
+}
+
+
 /* Fill the info section about the audio file with data from the WavBuffer. */
 void MainWindow::updateInfoSection(QString filePath, QString channelsCount, QString bitDepth, QString sampleRate)
 {
@@ -286,37 +489,172 @@ void MainWindow::playPauseStop()
     if (senderName == "actionStop")
     {
         player->stop();
-        
-        // Edit the UI with correct label and icon
-        actionPlayPause->setText(tr("Play"));
-        actionPlayPause->setIcon(QIcon(":/images/play.png"));
     }
     else
     {
         
         // If we are already playing, pause the player
-        if (player->state() == QMediaPlayer::PlayingState)
+        if (player->state() == AudioEngine::PlayingState)
         {
             player->pause();
-            
-            // Edit the UI with correct label and icon
-            action->setText(tr("Play"));
-            action->setIcon(QIcon(":/images/play.png"));
-            
         }
         else  // the player is paused
         {
-
-            player->play();
-            timerWaveForm->start(0);
-            timerTimeCode->start(1000);
             
-            // Edit the UI with correct label and icon
-            action->setText(tr("Pause"));
-            action->setIcon(QIcon(":/images/pause.png"));
+            if (!player->play())
+            {
+                QMessageBox::warning(this, tr("Error"), tr(player->error()));
+                return;
+            }
         }
+        
+    }
+}
+
+
+/* Edit the UI with the correct label and icon for the play/pause action. */
+void MainWindow::showPlayerState(AudioEngine::State state)
+{
     
+    if (state == AudioEngine::PlayingState)
+    {
+        actionPlayPause->setText(tr("Pause"));
+        actionPlayPause->setIcon(QIcon(":/images/pause.png"));
+        
+        timerWaveForm->start(frameInterval);
+        timerTimeCode->start(1000);
     }
+    else
+    {
+        actionPlayPause->setText(tr("Play"));
+        actionPlayPause->setIcon(QIcon(":/images/play.png"));
+        
+        // Nothing moves until the playback starts again, show the final position once
+        timerWaveForm->stop();
+        timerTimeCode->stop();
+        waveFormPlot->refreshPosition();
+        setTimeCode();
+    }
+    
+    // The meter starts again with the next playback
+    if (state == AudioEngine::StoppedState)
+        levelMeter->clear();
+    
+    // The audio output should never run out of frames, let the user know if it did
+    if (state == AudioEngine::StoppedState && player->underrunsCount() > 0)
+        statusBar()->showMessage(tr("Playback underruns: %1").arg(player->underrunsCount()));
+    
+}
+
+
+/* Undo the last edit of the audio file. */
+void MainWindow::undoEdit()
+{
+    audioSource->undo();
+    waveFormPlot->refreshEdits();
+    player->refreshEdits();
+    updateEditActions();
+    setTimeLine();
+}
+
+
+/* Apply again the last undone edit of the audio file. */
+void MainWindow::redoEdit()
+{
+    audioSource->redo();
+    waveFormPlot->refreshEdits();
+    player->refreshEdits();
+    updateEditActions();
+    setTimeLine();
+}
+
+
+/* Process the samples of the selection with the operation of the action which was triggered.
+ *
+ * The processing runs on a worker thread, while a modal dialog shows its progress and allows cancelling it.
+ * It becomes an edit once it is finished, which can be undone as a cut. */
+void MainWindow::processSelection()
+{
+    
+    QAction                  *action    = qobject_cast<QAction*>(sender());
+    AudioProcessor::Operation operation = (AudioProcessor::Operation) action->data().toInt();
+    qint64                    startFrame, endFrame;
+    
+    if (!waveFormPlot->selectedRange(startFrame, endFrame))
+    {
+        statusBar()->showMessage(tr("Select the audio to process first"));
+        return;
+    }
+    
+    double gain = 1;
+    
+    if (operation == AudioProcessor::Gain)
+    {
+        bool   accepted;
+        double decibels = QInputDialog::getDouble(this, tr("Gain"), tr("Gain (dB)"), 0, -96, 96, 1, &accepted);
+        
+        if (!accepted)
+            return;
+        
+        gain = std::pow(10.0, decibels / 20);
+    }
+    
+    AudioProcessor  processor(audioSource, operation, startFrame, endFrame, gain);
+    QProgressDialog progress(action->text(), tr("Cancel"), 0, 100, this);
+    progress.setWindowModality(Qt::WindowModal);
+    progress.setMinimumDuration(0);
+    
+    connect(&processor, &AudioProcessor::progressChanged, &progress, &QProgressDialog::setValue);
+    connect(&processor, &QThread::finished,               &progress, &QDialog::accept);
+    
+    processor.start();
+    progress.exec();
+    processor.stop();  // Cancelled if the dialog was closed before the end
+    
+    if (!processor.apply())
+    {
+        if (*processor.error())
+            QMessageBox::warning(this, tr("Error"), tr(processor.error()));
+        return;
+    }
+    
+    waveFormPlot->refreshEdits();
+    player->refreshEdits();
+    updateEditActions();
+    setTimeLine();
+    
+}
+
+
+/* Give the settings checked in the View menu to the spectrogram. */
+void MainWindow::updateSpectrogramSettings()
+{
+    
+    Spectrogram::Settings settings;
+    settings.windowSize = windowSizeGroup->checkedAction()->data().toInt();
+    settings.hop        = hopGroup->checkedAction()->data().toInt();
+    settings.window     = (Spectrogram::WindowFunction) windowFunctionGroup->checkedAction()->data().toInt();
+    
+    waveFormPlot->spectrogram()->setSettings(settings);
+    
+}
+
+
+/* Enable the undo/redo actions only if there is something to undo/redo. */
+void MainWindow::updateEditActions()
+{
+    actionUndo->setEnabled(audioSource->canUndo());
+    actionRedo->setEnabled(audioSource->canRedo());
+}
+
+
+/* Show the progress of the peaks computation in the status bar. */
+void MainWindow::showPeaksProgress(int percent)
+{
+    if (percent < 100)
+        statusBar()->showMessage(tr("Computing waveform: %1%").arg(percent));
+    else
+        statusBar()->clearMessage();
 }
 
 
@@ -325,17 +663,22 @@ void MainWindow::setTimeCode()
 {
     
     QTime timeValue = QTime(0, 0);
-    timeValue = timeValue.addMSecs(player->position());
+    timeValue = timeValue.addMSecs(player->position() * 1000 / audioSource->sampleRate());
     timeCode->setText(timeValue.toString("mm:ss"));
     
 }
 
 
-/* Set the range of the timeline scrollbar. */
-void MainWindow::setTimeLine(qint64 duration)
+/* Set the range of the timeline scrollbar to the frames count of the edited audio.
+ *
+ * Each step of the timeline is a frame, unless the frames count does not fit an int. */
+void MainWindow::setTimeLine()
 {
     
-    timeLine->setRange(0, duration);
+    timeLineDivisor = audioSource->framesCount() / INT_MAX + 1;
+    
+    timeLine->setRange(0, audioSource->framesCount() / timeLineDivisor);
+    timeLine->setPageStep(audioSource->sampleRate() / timeLineDivisor + 1);
     timeLine->setVisible(true);
     
     waveFormPlot->refreshPosition();
@@ -343,8 +686,34 @@ void MainWindow::setTimeLine(qint64 duration)
 }
 
 
+/* Move the playback to the frame chosen with the timeline. */
+void MainWindow::seekTimeLine(int value)
+{
+    player->seek(value * timeLineDivisor);
+}
+
+
+/* Move the timeline to the frame being played, without seeking again. */
+void MainWindow::updateTimeLine(qint64 frame)
+{
+    QSignalBlocker blocker(timeLine);
+    timeLine->setValue(frame / timeLineDivisor);
+}
+
+
+/* Show the levels of the audio being played, if the player published new ones since the last call. */
+void MainWindow::updateLevels()
+{
+    if (player->updateLevels())
+        levelMeter->setLevels(player->levels());
+}
+
+
 
-/* Export the audio file with cut area (if any). */
+/* Export the audio file with cut area (if any).
+ *
+ * The file is written to a temporary file, which replaces the chosen file once it is complete:
+ * a failed export leaves the previous file untouched, even when it is the file being edited. */
 bool MainWindow::exportFile()
 {
     
@@ -354,19 +723,26 @@ bool MainWindow::exportFile()
     if (fileName.isEmpty())
         return false;
     
-    QFile file(fileName);
+    QSaveFile file(fileName);
     
     // Display an error message if the file is not writable
-    if (!file.open(QFile::WriteOnly | QFile::Text))
+    if (!file.open(QFile::WriteOnly))
     {
         QMessageBox::warning(this, tr("Application"), tr("Cannot write file %1:\n%2.").arg(fileName).arg(file.errorString()));
         return false;
     }
     
-    // Write raw bytes from the audio buffer to the file
-    file.write(audioSource->buffer());
-    file.close();
-
+    // Write a header with the new audio size, then the audio data
+    if (!audioSource->exportTo(&file) || !file.commit())
+    {
+        QMessageBox::warning(this, tr("Application"), tr("Cannot write file %1:\n%2.").arg(fileName).arg(file.errorString()));
+        file.cancelWriting();
+        return false;
+    }
+    
+    // If the file was viewed before, its waveform must be computed again
+    PeakPyramid::removeCache(fileName);
+    
     return true;
 
 }
@@ -380,11 +756,24 @@ void MainWindow::closeFile()
 {
     setItemsEnabled(false);
     updateInfoSection("", "", "", "");
+    loadProgress->hide();
+    cancelLoadButton->hide();
     waveFormPlot->unsetPlot();
+    levelMeter->setChannelsCount(0);
     delete timerWaveForm;
     delete timerTimeCode;
     delete player;
+    delete peakBuilder;  // Stops the peaks computation, which reads the audio source
+    delete fileLoader;   // Stops loading the file
     delete audioSource;
     
+    // The file may be closed before its header was read (see finishOpening), when only some of them exist
+    timerWaveForm = nullptr;
+    timerTimeCode = nullptr;
+    player        = nullptr;
+    peakBuilder   = nullptr;
+    fileLoader    = nullptr;
+    audioSource   = nullptr;
+    
 }
 
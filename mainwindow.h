@@ -3,8 +3,12 @@
 
 #include <QtWidgets>
 #include <QMainWindow>
-#include <QMediaPlayer>
 
+#include "audioengine.h"
+#include "audioprocessor.h"
+#include "fileloader.h"
+#include "levelmeter.h"
+#include "peakbuilder.h"
 #include "wavbuffer.h"
 #include "signalplot.h"
 
@@ -17,11 +21,23 @@ public:
     
 private slots:
     void openFile();
+    void showFile();
+    void finishOpening();
     bool exportFile();
     void closeFile();
     void playPauseStop();
+    void undoEdit();
+    void redoEdit();
+    void processSelection();
+    void updateEditActions();
+    void showPeaksProgress(int percent);
+    void showPlayerState(AudioEngine::State state);
     void setTimeCode();
-    void setTimeLine(qint64 duration);
+    void setTimeLine();
+    void seekTimeLine(int value);
+    void updateTimeLine(qint64 frame);
+    void updateLevels();
+    void updateSpectrogramSettings();
     
 private:
     void createActions();
@@ -29,7 +45,9 @@ private:
     void createToolBar();
     void createInfoSection();
     void createPlayerSection();
+    void createStatusBar();
     void setItemsEnabled(bool);
+    void setAudioActionsEnabled(bool);
     void updateInfoSection(QString filePath, QString channelsCount, QString bitDepth, QString sampleRate);
     
     // Layout for the main window
@@ -42,10 +60,22 @@ private:
     QAction *actionPlayPause;
     QAction *actionStop;
     QAction *actionCut;
+    QAction *actionUndo;
+    QAction *actionRedo;
+    QAction *actionGain;
+    QAction *actionFadeIn;
+    QAction *actionFadeOut;
+    QAction *actionNormalize;
+    QAction *actionRemoveDcOffset;
+    QAction *actionSpectrogram;
+    QActionGroup *windowSizeGroup;
+    QActionGroup *hopGroup;
+    QActionGroup *windowFunctionGroup;
     // Menus
     QMenu   *fileMenu;
     QMenu   *editMenu;
     QMenu   *audioMenu;
+    QMenu   *viewMenu;
     QMenu   *helpMenu;
     // Toolbars
     QToolBar *fileToolBar;
@@ -63,14 +93,22 @@ private:
     QSpinBox   *scaleValue;
     SignalPlot *waveFormPlot;
     QSlider    *volume;
+    LevelMeter *levelMeter;
     QScrollBar *timeLine;
     QLineEdit  *timeCode;
-    QTimer     *timerTimeCode;
+    QTimer     *timerTimeCode = nullptr;
+    qint64      timeLineDivisor = 1;  // Frames per timeline step, the frames count may not fit an int
+    
+    // Progress of the file being loaded
+    QProgressBar *loadProgress;
+    QPushButton  *cancelLoadButton;
     
     // Other classes instances
-    WavBuffer    *audioSource;
-    QMediaPlayer *player;
-    QTimer       *timerWaveForm;
+    WavBuffer    *audioSource = nullptr;
+    FileLoader   *fileLoader  = nullptr;
+    PeakBuilder  *peakBuilder = nullptr;
+    AudioEngine  *player      = nullptr;
+    QTimer       *timerWaveForm = nullptr;
 
 };
 
@@ -0,0 +1,327 @@
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <numeric>
+
+#include <QThread>
+#include <QThreadPool>
+#include <QtConcurrent>
+
+#include "loudnessmeter.h"
+#include "parallelanalysis.h"
+#include "samplekernels.h"
+
+
+namespace ParallelAnalysis
+{
+
+// Logical frames of a single channel analysed by a task, all in the same piece of the edit list
+struct BlockTask
+{
+    WavBuffer *audioSource;
+    EditList  *edits;
+    qint64     startFrame;
+    qint64     framesCount;
+    int        channelIndex;
+};
+
+struct BlockStatistics
+{
+    int               channelIndex;
+    ChannelStatistics statistics;
+};
+
+// Logical frames of a single channel whose loudness is measured by a task, after frames which settle the filter
+struct LoudnessTask
+{
+    WavBuffer *audioSource;
+    qint64     startFrame;
+    qint64     framesCount;
+    qint64     settlingFrames;  // Frames before startFrame, only given to the filter
+    qint64     firstStep;
+    int        channelIndex;
+};
+
+struct LoudnessSegment
+{
+    qint64          firstStep;
+    double          weight;
+    int             channelIndex;
+    double          peak;
+    QVector<double> energies;  // K-weighted mean square of each step
+};
+
+struct LoudnessSums
+{
+    QVector<double> energies;  // Weighted sum of the channels of each step
+    QVector<double> peaks;
+};
+
+
+double ChannelStatistics::mean() const
+{
+    return framesCount ? sum / framesCount : 0;
+}
+
+
+double ChannelStatistics::rms() const
+{
+    return framesCount ? std::sqrt(sumOfSquares / framesCount) : 0;
+}
+
+
+bool ChannelStatistics::operator==(const ChannelStatistics &other) const
+{
+    return min == other.min && max == other.max && framesCount == other.framesCount &&
+           sum == other.sum && sumOfSquares == other.sumOfSquares;
+}
+
+
+bool Loudness::operator==(const Loudness &other) const
+{
+    return integrated == other.integrated && maxMomentary == other.maxMomentary && maxShortTerm == other.maxShortTerm &&
+           samplePeaks == other.samplePeaks;
+}
+
+
+/* Compute the statistics of a block of a channel. The samples are summed in order, so the result never changes.
+ *
+ * The samples are read with WavBuffer::readSamples: they come from the planar cache when it is enabled,
+ * and the tasks of the other channels of the block find them there. */
+static BlockStatistics analyseBlock(const BlockTask &task)
+{
+    
+    QVector<int> samples(task.framesCount);
+    
+    task.audioSource->readSamples(task.startFrame, task.framesCount, task.channelIndex, samples.data(), task.edits);
+    
+    BlockStatistics block;
+    block.channelIndex           = task.channelIndex;
+    block.statistics.min         = INT_MAX;
+    block.statistics.max         = INT_MIN;
+    block.statistics.framesCount = task.framesCount;
+    
+    for (int sample : samples)
+    {
+        block.statistics.min           = std::min(block.statistics.min, sample);
+        block.statistics.max           = std::max(block.statistics.max, sample);
+        block.statistics.sum          += sample;
+        block.statistics.sumOfSquares += (double) sample * sample;
+    }
+    
+    return block;
+    
+}
+
+
+/* Merge the statistics of a block into those of its channel. Blocks are merged in the order of the tasks. */
+static void mergeBlock(QVector<ChannelStatistics> &channels, const BlockStatistics &block)
+{
+    
+    if (channels.size() <= block.channelIndex)
+        channels.resize(block.channelIndex + 1);
+    
+    ChannelStatistics &channel = channels[block.channelIndex];
+    
+    channel.min           = channel.framesCount ? std::min(channel.min, block.statistics.min) : block.statistics.min;
+    channel.max           = channel.framesCount ? std::max(channel.max, block.statistics.max) : block.statistics.max;
+    channel.framesCount  += block.statistics.framesCount;
+    channel.sum          += block.statistics.sum;
+    channel.sumOfSquares += block.statistics.sumOfSquares;
+    
+}
+
+
+/* Measure the loudness of a channel over some steps. The steps are complete, except for the frames after the
+ * last one in the last segment, which only count for the peak. */
+static LoudnessSegment measureSegment(const LoudnessTask &task)
+{
+    
+    WavBuffer    *audioSource = task.audioSource;
+    int           stepFrames  = std::max(1, audioSource->sampleRate() / LoudnessMeter::stepsPerSecond);
+    double        scale       = std::ldexp(1.0, 1 - SampleKernels::significantBits(audioSource->sampleFormat()));
+    QVector<int>  samples(task.settlingFrames + task.framesCount);
+    
+    audioSource->readSamples(task.startFrame - task.settlingFrames, samples.size(), task.channelIndex, samples.data());
+    
+    LoudnessMeter::Filter filter;
+    filter.setSampleRate(audioSource->sampleRate());
+    
+    for (qint64 i = 0; i < task.settlingFrames; i++)
+        filter.process(samples.at(i));
+    
+    LoudnessSegment segment;
+    segment.firstStep    = task.firstStep;
+    segment.weight       = LoudnessMeter::channelWeight(task.channelIndex, audioSource->channelsCount());
+    segment.channelIndex = task.channelIndex;
+    segment.peak         = 0;
+    segment.energies.resize(task.framesCount / stepFrames);
+    
+    const int *frames = samples.constData() + task.settlingFrames;
+    
+    for (int step = 0; step < segment.energies.size(); step++)
+    {
+        double sum = 0;
+        
+        for (qint64 i = (qint64) step * stepFrames; i < (qint64) (step + 1) * stepFrames; i++)
+        {
+            double weighted = filter.process(frames[i]);
+            sum += weighted * weighted;
+        }
+        
+        segment.energies[step] = sum * scale * scale / stepFrames;
+    }
+    
+    for (qint64 i = 0; i < task.framesCount; i++)
+        segment.peak = std::max(segment.peak, std::abs((double) frames[i]));
+    
+    segment.peak *= scale;
+    
+    return segment;
+    
+}
+
+
+/* Add the steps of a channel to the sums of all the channels. Segments are merged in the order of the tasks. */
+static void mergeSegment(LoudnessSums &sums, const LoudnessSegment &segment)
+{
+    
+    if (sums.energies.size() < segment.firstStep + segment.energies.size())
+        sums.energies.resize(segment.firstStep + segment.energies.size());
+    
+    if (sums.peaks.size() <= segment.channelIndex)
+        sums.peaks.resize(segment.channelIndex + 1);
+    
+    for (int step = 0; step < segment.energies.size(); step++)
+        sums.energies[segment.firstStep + step] += segment.weight * segment.energies.at(step);
+    
+    sums.peaks[segment.channelIndex] = std::max(sums.peaks.at(segment.channelIndex), segment.peak);
+    
+}
+
+
+/* The range is split into segments of loudnessSegmentSteps steps, each channel of a segment being measured by a task.
+ * The K-weighting filter of a task is first given the step before its segment, so that it starts in the state a single
+ * filter over the whole range would be in, to well below the precision of the result.
+ * The steps are then given in order to a LoudnessMeter, which gates the blocks. */
+Loudness loudness(WavBuffer *audioSource, qint64 startFrame, qint64 endFrame)
+{
+    
+    startFrame = std::max<qint64>(startFrame, 0);
+    endFrame   = std::min(endFrame, audioSource->framesCount());
+    
+    qint64 stepFrames    = std::max(1, audioSource->sampleRate() / LoudnessMeter::stepsPerSecond);
+    qint64 segmentFrames = stepFrames * loudnessSegmentSteps;
+    
+    QVector<LoudnessTask> tasks;
+    
+    for (qint64 frame = startFrame, step = 0; frame < endFrame; frame += segmentFrames, step += loudnessSegmentSteps)
+    {
+        // The frames after the last complete step are left to the last segment
+        qint64 framesCount = endFrame - frame < 2 * segmentFrames ? endFrame - frame : segmentFrames;
+        
+        for (int channel = 0; channel < audioSource->channelsCount(); channel++)
+            tasks.append({audioSource, frame, framesCount, std::min(stepFrames, frame - startFrame), step, channel});
+        
+        if (framesCount > segmentFrames)
+            break;
+    }
+    
+    LoudnessSums sums =
+        QtConcurrent::blockingMappedReduced<LoudnessSums>(tasks, measureSegment, mergeSegment, QtConcurrent::OrderedReduce);
+    
+    LoudnessMeter meter;
+    meter.setFormat(audioSource->sampleRate(), audioSource->channelsCount(), SampleKernels::significantBits(audioSource->sampleFormat()));
+    
+    for (double energy : sums.energies)
+        meter.addStep(energy);
+    
+    Loudness result;
+    result.integrated   = meter.integrated();
+    result.maxMomentary = meter.maxMomentary();
+    result.maxShortTerm = meter.maxShortTerm();
+    result.samplePeaks  = sums.peaks;
+    
+    // Channels without any frame are still returned
+    result.samplePeaks.resize(audioSource->channelsCount());
+    
+    return result;
+    
+}
+
+
+/* The range is split into blocks along the pieces of the edit list: each block reads contiguous frames.
+ *
+ * A copy of the edits can be given by a thread which must not see the edits made meanwhile. */
+QVector<ChannelStatistics> statistics(WavBuffer *audioSource, qint64 startFrame, qint64 endFrame, EditList *edits)
+{
+    
+    if (!edits)
+        edits = audioSource->edits();
+    
+    startFrame = std::max<qint64>(startFrame, 0);
+    endFrame   = std::min(endFrame, edits->framesCount());
+    
+    QVector<BlockTask> tasks;
+    
+    for (int i = std::max(edits->pieceAt(startFrame), 0); startFrame < endFrame && i < edits->piecesCount(); i++)
+    {
+        qint64 pieceStart = edits->pieceStart(i);
+        qint64 first      = std::max(startFrame, pieceStart);
+        qint64 last       = std::min(endFrame, pieceStart + edits->piece(i).framesCount);
+        
+        for (qint64 frame = first; frame < last; frame += blockSize)
+        {
+            for (int channel = 0; channel < audioSource->channelsCount(); channel++)
+                tasks.append({audioSource, edits, frame, std::min(blockSize, last - frame), channel});
+        }
+    }
+    
+    QVector<ChannelStatistics> channels =
+        QtConcurrent::blockingMappedReduced<QVector<ChannelStatistics>>(tasks, analyseBlock, mergeBlock, QtConcurrent::OrderedReduce);
+    
+    // Channels without any frame are still returned
+    channels.resize(audioSource->channelsCount());
+    
+    return channels;
+    
+}
+
+
+/* Chunks cover distinct blocks of each level up to chunkLevel, so they can be computed at the same time. */
+void buildChunks(WavBuffer *audioSource, QVector<qint64> chunks)
+{
+    QtConcurrent::blockingMap(chunks, [audioSource](qint64 chunk) {
+        audioSource->peaks()->buildChunk(audioSource, chunk);
+    });
+}
+
+
+/* Compute the whole pyramid: all the chunks in parallel, then the upper levels, which are small. */
+void buildPeaks(WavBuffer *audioSource)
+{
+    
+    PeakPyramid *peaks = audioSource->peaks();
+    peaks->allocate(audioSource);
+    
+    QVector<qint64> chunks(peaks->chunksCount());
+    std::iota(chunks.begin(), chunks.end(), 0);
+    
+    buildChunks(audioSource, chunks);
+    peaks->buildUpperLevels();
+    
+}
+
+
+void setThreadsCount(int threadsCount)
+{
+    QThreadPool::globalInstance()->setMaxThreadCount(threadsCount > 0 ? threadsCount : QThread::idealThreadCount());
+}
+
+
+int threadsCount()
+{
+    return QThreadPool::globalInstance()->maxThreadCount();
+}
+    
+}
@@ -0,0 +1,64 @@
+#ifndef PARALLELANALYSIS_H
+#define PARALLELANALYSIS_H
+
+#include <cmath>
+
+#include <QVector>
+
+#include "wavbuffer.h"
+
+
+/* Analysis passes over the audio data of a WavBuffer, spread over all the cores
+ *
+ * The work is split into tasks by channel and by block of frames, run with QtConcurrent
+ * on the global thread pool, and the partial results are merged in the order of the tasks.
+ * The split only depends on the data, never on the number of threads, so results are
+ * identical (to the last bit of the floating point sums) whatever the thread count.
+ */
+namespace ParallelAnalysis
+{
+    // Frames of a single channel analysed by a task
+    static const qint64 blockSize = 1 << 16;
+    
+    // Steps of the loudness (100 ms) of a single channel measured by a task
+    static const int loudnessSegmentSteps = 64;
+    
+    struct ChannelStatistics
+    {
+        int    min          = 0;
+        int    max          = 0;
+        qint64 framesCount  = 0;
+        double sum          = 0;
+        double sumOfSquares = 0;
+        
+        double mean()  const;
+        double rms()   const;
+        bool operator==(const ChannelStatistics &other) const;
+    };
+    
+    // Statistics of each channel over the logical frames [startFrame, endFrame) of the given edits (by default those of the WavBuffer)
+    QVector<ChannelStatistics> statistics(WavBuffer *audioSource, qint64 startFrame, qint64 endFrame, EditList *edits = nullptr);
+    
+    struct Loudness
+    {
+        double          integrated   = -HUGE_VAL;  // LUFS
+        double          maxMomentary = -HUGE_VAL;
+        double          maxShortTerm = -HUGE_VAL;
+        QVector<double> samplePeaks;               // Of each channel, relative to full scale
+        
+        bool operator==(const Loudness &other) const;
+    };
+    
+    // Loudness of the logical frames [startFrame, endFrame), as a LoudnessMeter would measure it
+    Loudness loudness(WavBuffer *audioSource, qint64 startFrame, qint64 endFrame);
+    
+    // Compute the given chunks of the peak pyramid, or the whole pyramid, in parallel
+    void buildChunks(WavBuffer *audioSource, QVector<qint64> chunks);
+    void buildPeaks(WavBuffer *audioSource);
+    
+    // Maximum number of threads used by the analysis passes (the number of cores by default)
+    void setThreadsCount(int threadsCount);
+    int  threadsCount();
+}
+
+#endif // PARALLELANALYSIS_H
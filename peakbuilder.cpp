@@ -0,0 +1,181 @@
+#include <algorithm>
+
+#include <QElapsedTimer>
+
+#include "parallelanalysis.h"
+#include "peakbuilder.h"
+
+
+// Minimum delay between two peaksUpdated signals, so that the plot is not repainted more than needed
+static const int updateInterval = 16;  // ms
+
+
+/* Reserve the pyramid memory in the calling thread: the worker thread only fills it.
+ *
+ * If the peaks were saved when the file was opened before, they are mapped instead and there is nothing to compute. */
+PeakBuilder::PeakBuilder(WavBuffer *audioSource, QObject *parent) : QThread(parent)
+{
+    
+    m_audioSource = audioSource;
+    
+    if (!m_audioSource->peaks()->loadCache(m_audioSource))
+        m_audioSource->peaks()->allocate(m_audioSource);
+    
+    m_focusStartChunk.storeRelease(0);
+    m_focusEndChunk.storeRelease(0);
+    
+}
+
+
+/* The worker thread must be finished before the WavBuffer is deleted. */
+PeakBuilder::~PeakBuilder()
+{
+    stop();
+}
+
+
+/* Ask the worker thread to stop and wait for it. */
+void PeakBuilder::stop()
+{
+    m_stopRequested.storeRelease(1);
+    wait();
+}
+
+
+/* Give the range of frames currently displayed, so that its peaks are computed first.
+ *
+ * The range is given in logical frames: it is converted to the frames of the file the pyramid works on,
+ * from the first visible piece which reads from the file. Pieces which read from a block have no peaks
+ * in the pyramid; if all the visible pieces do, the focus is left unchanged. */
+void PeakBuilder::setVisibleRange(qint64 startFrame, qint64 endFrame)
+{
+    
+    EditList *edits = m_audioSource->edits();
+    int       first = edits->pieceAt(startFrame);
+    
+    if (first < 0)
+        return;
+    
+    for (int i = first; i < edits->piecesCount(); i++)
+    {
+        EditList::Piece piece      = edits->piece(i);
+        qint64          pieceStart = edits->pieceStart(i);
+        
+        if (pieceStart >= endFrame)
+            return;
+        
+        if (piece.block)
+            continue;
+        
+        qint64 visibleStart = std::max(startFrame, pieceStart);
+        qint64 sourceStart  = piece.sourceFrame + (visibleStart - pieceStart);
+        qint64 sourceEnd    = sourceStart + (endFrame - visibleStart);
+        
+        m_focusStartChunk.storeRelease(sourceStart / PeakPyramid::chunkSize);
+        m_focusEndChunk.storeRelease((sourceEnd + PeakPyramid::chunkSize - 1) / PeakPyramid::chunkSize);
+        
+        return;
+    }
+    
+}
+
+
+/* Main loop of the worker thread.
+ *
+ * Each iteration computes a batch of chunks in parallel, one per core: the first chunks of the visible
+ * range which are not ready, then the first chunks of the file which are not ready. Both searches only
+ * move forward (the visible one restarts when the visible range changes), so the whole loop is linear.
+ * While the file is being loaded (see FileLoader), only the chunks loaded are computed: the thread
+ * waits for the next ones when they are all ready. */
+void PeakBuilder::run()
+{
+    
+    PeakPyramid *peaks       = m_audioSource->peaks();
+    qint64       chunksCount = peaks->chunksCount();
+    qint64       builtCount  = 0;
+    int          batchSize   = std::max(ParallelAnalysis::threadsCount(), 1);
+    
+    qint64 sequentialCursor = 0;
+    qint64 focusCursor      = 0;
+    qint64 lastFocusStart   = -1;
+    
+    // Peaks read from the cache file are complete already
+    if (peaks->isComplete())
+    {
+        emit peaksUpdated();
+        emit progressChanged(100);
+        return;
+    }
+    
+    QElapsedTimer lastUpdate;
+    lastUpdate.start();
+    
+    QVector<qint64> batch;
+    
+    while (builtCount < chunksCount && !m_stopRequested.loadAcquire())
+    {
+        
+        // The last chunk may be shorter than the others
+        qint64 loadedChunks = m_audioSource->isLoaded() ? chunksCount : m_audioSource->loadedFramesCount() / PeakPyramid::chunkSize;
+        qint64 focusStart   = m_focusStartChunk.loadAcquire();
+        qint64 focusEnd     = std::min(m_focusEndChunk.loadAcquire(), loadedChunks);
+        
+        if (focusStart != lastFocusStart)
+        {
+            focusCursor    = focusStart;
+            lastFocusStart = focusStart;
+        }
+        
+        batch.clear();
+        
+        while (batch.size() < batchSize && builtCount + batch.size() < chunksCount)
+        {
+            while (focusCursor < focusEnd && (peaks->isChunkReady(focusCursor) || batch.contains(focusCursor)))
+                focusCursor++;
+            
+            if (focusCursor < focusEnd)  // Some visible chunks are not ready
+            {
+                batch.append(focusCursor++);
+            }
+            else
+            {
+                while (sequentialCursor < loadedChunks && (peaks->isChunkReady(sequentialCursor) || batch.contains(sequentialCursor)))
+                    sequentialCursor++;
+                
+                if (sequentialCursor == loadedChunks)  // The next chunks are not loaded yet
+                    break;
+                
+                batch.append(sequentialCursor++);
+            }
+        }
+        
+        if (batch.isEmpty())
+        {
+            msleep(updateInterval);
+            continue;
+        }
+        
+        ParallelAnalysis::buildChunks(m_audioSource, batch);
+        builtCount += batch.size();
+        
+        if (lastUpdate.elapsed() >= updateInterval)
+        {
+            emit peaksUpdated();
+            emit progressChanged(100 * builtCount / chunksCount);
+            lastUpdate.restart();
+        }
+        
+    }
+    
+    if (m_stopRequested.loadAcquire())
+        return;
+    
+    peaks->buildUpperLevels();
+    
+    emit peaksUpdated();
+    emit progressChanged(100);
+    
+    // The next time the file is opened, the peaks are read from the cache
+    peaks->saveCache(m_audioSource, &m_stopRequested);
+    
+}
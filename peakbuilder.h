@@ -0,0 +1,48 @@
+#ifndef PEAKBUILDER_H
+#define PEAKBUILDER_H
+
+#include <QAtomicInteger>
+#include <QThread>
+
+#include "wavbuffer.h"
+
+
+/* Worker thread which computes the peak pyramid of a WavBuffer
+ *
+ * The pyramid is computed chunk by chunk so that the waveform can be drawn
+ * progressively. Chunks in the visible range, given by setVisibleRange,
+ * are computed first; the others are computed from the start of the file.
+ * Chunks are computed by batches on all the cores (see ParallelAnalysis),
+ * as soon as their frames are loaded.
+ */
+class PeakBuilder : public QThread
+{
+    
+    Q_OBJECT
+    
+public:
+    PeakBuilder(WavBuffer *audioSource, QObject *parent = 0);
+    ~PeakBuilder();
+    
+    void stop();
+    
+public slots:
+    void setVisibleRange(qint64 startFrame, qint64 endFrame);
+    
+signals:
+    void peaksUpdated();               // Some chunks are ready since the last signal
+    void progressChanged(int percent);
+    
+protected:
+    void run();
+    
+private:
+    WavBuffer *m_audioSource;
+    
+    QAtomicInt             m_stopRequested;
+    QAtomicInteger<qint64> m_focusStartChunk;  // Visible chunks, written by the GUI thread
+    QAtomicInteger<qint64> m_focusEndChunk;
+    
+};
+
+#endif // PEAKBUILDER_H
@@ -0,0 +1,384 @@
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+#include "peakpyramid.h"
+#include "samplekernels.h"
+#include "wavbuffer.h"
+
+
+/* Reserve the memory of all the levels of the pyramid, without computing anything.
+ *
+ * The pyramid covers the source frames, which are not changed by edits: it stays valid after a cut.
+ * This must be called from the thread which reads the pyramid, before any chunk is built. */
+void PeakPyramid::allocate(WavBuffer *audioSource)
+{
+    allocate(audioSource->channelsCount(), audioSource->sourceFramesCount());
+}
+
+
+/* Reserve the memory of all the levels of the pyramid of framesCount frames. */
+void PeakPyramid::allocate(int channelsCount, qint64 framesCount)
+{
+    
+    clear();
+    
+    m_channelsCount = channelsCount;
+    m_framesCount   = framesCount;
+    
+    if (m_framesCount == 0)
+        return;
+    
+    m_peaks.resize(computeLevelOffsets());
+    m_storage = m_peaks.data();
+    
+    m_chunksReady.reset(new QAtomicInt[chunksCount()]);
+    
+}
+
+
+/* Compute the offset of each level, until a level holds a single block, and return the total number of peaks. */
+qint64 PeakPyramid::computeLevelOffsets()
+{
+    
+    qint64 totalPeaks  = 0;
+    qint64 blocksCount = (m_framesCount + baseBlockSize - 1) / baseBlockSize;
+    
+    while (true)
+    {
+        m_levelOffsets.push_back(totalPeaks);
+        totalPeaks += blocksCount * m_channelsCount;
+        
+        if (blocksCount == 1)
+            break;
+        
+        blocksCount = (blocksCount + 1) / 2;
+    }
+    
+    return totalPeaks;
+    
+}
+
+
+/* Compute all the levels of the pyramid from the samples of an audio source, in the calling thread. */
+void PeakPyramid::build(WavBuffer *audioSource)
+{
+    build(audioSource->sourceFrameData(0), audioSource->sourceFramesCount(), audioSource->channelsCount(), audioSource->sampleFormat());
+}
+
+
+/* Compute all the levels of the pyramid of a run of frames, in the calling thread. */
+void PeakPyramid::build(const uchar *frames, qint64 framesCount, int channelsCount, SampleKernels::SampleFormat format)
+{
+    
+    allocate(channelsCount, framesCount);
+    
+    for (qint64 chunk = 0; chunk < chunksCount(); chunk++)
+        buildChunk(frames, format, chunk);
+    
+    buildUpperLevels();
+    
+}
+
+
+/* Compute the levels up to chunkLevel for the source frames of a given chunk. */
+void PeakPyramid::buildChunk(WavBuffer *audioSource, qint64 chunk)
+{
+    buildChunk(audioSource->sourceFrameData(0), audioSource->sampleFormat(), chunk);
+}
+
+
+/* Compute the levels up to chunkLevel for the frames of a given chunk, frames pointing to the first frame of the pyramid.
+ *
+ * Level 0 is computed from the raw samples, the other levels from the level below. */
+void PeakPyramid::buildChunk(const uchar *frames, SampleKernels::SampleFormat format, qint64 chunk)
+{
+    
+    if (isEmpty())
+        return;
+    
+    // Level 0: scan the raw samples of each block, all channels at once
+    qint64 firstBlock = chunk << chunkLevel;
+    qint64 endBlock   = std::min((chunk + 1) << chunkLevel, (m_framesCount + baseBlockSize - 1) / baseBlockSize);
+    
+    QVector<int> mins(m_channelsCount);
+    QVector<int> maxs(m_channelsCount);
+    qint64       bytesPerFrame = (qint64) m_channelsCount * SampleKernels::sampleSize(format);
+    
+    for (qint64 block = firstBlock; block < endBlock; block++)
+    {
+        qint64 startFrame = block * baseBlockSize;
+        qint64 endFrame   = std::min(startFrame + baseBlockSize, m_framesCount);
+        
+        mins.fill(INT_MAX);
+        maxs.fill(INT_MIN);
+        
+        SampleKernels::minMax(frames + startFrame * bytesPerFrame, endFrame - startFrame,
+                              m_channelsCount, format, mins.data(), maxs.data());
+        
+        for (int channel = 0; channel < m_channelsCount; channel++)
+        {
+            Peak &peak = m_storage[block * m_channelsCount + channel];
+            peak.min   = mins[channel];
+            peak.max   = maxs[channel];
+        }
+    }
+    
+    // Other levels of the chunk: merge pairs of blocks of the level below
+    for (int l = 1; l <= chunkLevel && l < levelsCount(); l++)
+    {
+        firstBlock >>= 1;
+        endBlock     = (endBlock + 1) >> 1;
+        mergeLevel(l, firstBlock, endBlock);
+    }
+    
+    m_chunksReady[chunk].storeRelease(1);
+    
+}
+
+
+/* Compute the levels above chunkLevel, once all the chunks are ready. */
+void PeakPyramid::buildUpperLevels()
+{
+    
+    if (isEmpty())
+        return;
+    
+    qint64 blocksCount = (m_framesCount + baseBlockSize - 1) / baseBlockSize;
+    
+    for (int l = 1; l < levelsCount(); l++)
+    {
+        blocksCount = (blocksCount + 1) / 2;
+        
+        if (l > chunkLevel)
+            mergeLevel(l, 0, blocksCount);
+    }
+    
+    m_complete.storeRelease(1);
+    
+}
+
+
+/* Compute the blocks [firstBlock, endBlock) of a level from the level below. */
+void PeakPyramid::mergeLevel(int level, qint64 firstBlock, qint64 endBlock)
+{
+    
+    const Peak *below       = m_storage + m_levelOffsets[level - 1];
+    Peak       *current     = m_storage + m_levelOffsets[level];
+    qint64      belowBlocks = (m_levelOffsets[level] - m_levelOffsets[level - 1]) / m_channelsCount;
+    
+    for (qint64 block = firstBlock; block < endBlock; block++)
+    {
+        for (int channel = 0; channel < m_channelsCount; channel++)
+        {
+            Peak merged = below[2 * block * m_channelsCount + channel];
+            
+            // The last block of a level may have no sibling
+            if (2 * block + 1 < belowBlocks)
+            {
+                const Peak &sibling = below[(2 * block + 1) * m_channelsCount + channel];
+                merged.min = std::min(merged.min, sibling.min);
+                merged.max = std::max(merged.max, sibling.max);
+            }
+            
+            current[block * m_channelsCount + channel] = merged;
+        }
+    }
+    
+}
+
+
+/* Release the memory used by the pyramid. */
+void PeakPyramid::clear()
+{
+    m_cacheFile.close();  // Also unmaps it
+    m_peaks.clear();
+    m_levelOffsets.clear();
+    m_storage = nullptr;
+    m_chunksReady.reset();
+    m_complete.storeRelease(0);
+    m_channelsCount = 0;
+    m_framesCount   = 0;
+}
+
+
+/* Get the highest level whose block starting at a given frame lies entirely before endFrame.
+ *
+ * It returns -1 if the frame is not aligned on a block boundary or if even a level 0 block is too large.
+ * Until the pyramid is complete, levels above chunkLevel are not considered. */
+int PeakPyramid::levelAt(qint64 frame, qint64 endFrame)
+{
+    
+    int level    = -1;
+    int maxLevel = isComplete() ? levelsCount() - 1 : std::min((int) chunkLevel, levelsCount() - 1);
+    
+    for (int l = 0; l <= maxLevel; l++)
+    {
+        // The block must start at the frame and end before endFrame (the last block of a level may be shorter)
+        if (frame & (blockSize(l) - 1))
+            break;
+        if (std::min(frame + blockSize(l), m_framesCount) > endFrame)
+            break;
+        
+        level = l;
+    }
+    
+    return level;
+    
+}
+
+
+/* Get the min/max values of a given channel in the block of a level which contains a given frame. */
+PeakPyramid::Peak PeakPyramid::peak(int level, qint64 frame, int channelIndex)
+{
+    qint64 block = frame >> (baseBlockShift + level);
+    return m_storage[m_levelOffsets.at(level) + block * m_channelsCount + channelIndex];
+}
+
+
+/* Map the cache file of an audio source, if it is valid, and use it as the complete pyramid.
+ *
+ * The mapping is private: the pyramid is never written once complete, but nothing could corrupt the cache file anyway. */
+bool PeakPyramid::loadCache(WavBuffer *audioSource)
+{
+    
+    clear();
+    
+    m_channelsCount = audioSource->channelsCount();
+    m_framesCount   = audioSource->sourceFramesCount();
+    
+    if (m_framesCount == 0)
+        return false;
+    
+    qint64      peaksCount = computeLevelOffsets();
+    CacheHeader expected;
+    
+    m_cacheFile.setFileName(cachePath(audioSource->filePath()));
+    
+    if (!cacheHeader(audioSource, peaksCount, expected) || !m_cacheFile.open(QFile::ReadOnly) ||
+        m_cacheFile.size() != (qint64) sizeof(CacheHeader) + peaksCount * (qint64) sizeof(Peak))
+    {
+        clear();
+        return false;
+    }
+    
+    uchar *mapping = m_cacheFile.map(0, m_cacheFile.size(), QFileDevice::MapPrivateOption);
+    
+    // The cache is stale if the audio file or its format changed since it was written
+    if (!mapping || memcmp(mapping, &expected, sizeof(CacheHeader)) != 0)
+    {
+        clear();
+        return false;
+    }
+    
+    m_storage = (Peak*) (mapping + sizeof(CacheHeader));
+    
+    m_chunksReady.reset(new QAtomicInt[chunksCount()]);
+    for (qint64 chunk = 0; chunk < chunksCount(); chunk++)
+        m_chunksReady[chunk].storeRelease(1);
+    
+    m_complete.storeRelease(1);
+    
+    return true;
+    
+}
+
+
+/* Write the complete pyramid to the cache file of its audio source.
+ *
+ * The file is replaced atomically, and the writing is given up if stopRequested is set. */
+bool PeakPyramid::saveCache(WavBuffer *audioSource, const QAtomicInt *stopRequested)
+{
+    
+    const qint64 blockSize = 16 << 20;  // Bytes written between two checks of stopRequested
+    
+    CacheHeader header;
+    
+    // A pyramid read from the cache file is not written again
+    if (isEmpty() || !isComplete() || m_cacheFile.isOpen())
+        return false;
+    
+    // All the levels, the last one holds a single block per channel
+    qint64 peaksCount = m_levelOffsets.last() + m_channelsCount;
+    
+    if (!cacheHeader(audioSource, peaksCount, header))
+        return false;
+    
+    QString path = cachePath(audioSource->filePath());
+    QDir().mkpath(QFileInfo(path).path());
+    
+    QSaveFile file(path);
+    
+    if (!file.open(QFile::WriteOnly) || file.write((const char*) &header, sizeof(header)) != sizeof(header))
+        return false;
+    
+    const char *data = (const char*) m_storage;
+    qint64      size = peaksCount * sizeof(Peak);
+    
+    for (qint64 offset = 0; offset < size; offset += blockSize)
+    {
+        qint64 length = std::min(blockSize, size - offset);
+        
+        if ((stopRequested && stopRequested->loadAcquire()) || file.write(data + offset, length) != length)
+        {
+            file.cancelWriting();
+            return false;
+        }
+    }
+    
+    return file.commit();
+    
+}
+
+
+/* Get the path of the cache file of an audio file, in the cache directory of the application. */
+QString PeakPyramid::cachePath(const QString &filePath)
+{
+    
+    QByteArray key = QCryptographicHash::hash(QFileInfo(filePath).absoluteFilePath().toUtf8(), QCryptographicHash::Sha1);
+    
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/peaks/" + key.toHex() + ".peaks";
+    
+}
+
+
+/* Remove the cache file of an audio file, if there is one. */
+void PeakPyramid::removeCache(const QString &filePath)
+{
+    QFile::remove(cachePath(filePath));
+}
+
+
+/* Fill the header that the cache file of an audio source must have. It returns false if the audio file cannot be found. */
+bool PeakPyramid::cacheHeader(WavBuffer *audioSource, qint64 peaksCount, CacheHeader &header)
+{
+    
+    QFileInfo info(audioSource->filePath());
+    
+    if (!info.exists())
+        return false;
+    
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "PEAKPYR1", sizeof(header.magic));
+    header.version        = 2;
+    header.baseBlockShift = baseBlockShift;
+    header.channelsCount  = audioSource->channelsCount();
+    header.bitDepth       = audioSource->bitDepth();
+    header.sampleFormat   = audioSource->sampleFormat();
+    header.sampleRate     = audioSource->sampleRate();
+    header.framesCount    = audioSource->sourceFramesCount();
+    header.dataOffset     = audioSource->dataOffset();
+    header.fileSize       = info.size();
+    header.lastModified   = info.lastModified().toMSecsSinceEpoch();
+    header.peaksCount     = peaksCount;
+    
+    return true;
+    
+}
@@ -0,0 +1,111 @@
+#ifndef PEAKPYRAMID_H
+#define PEAKPYRAMID_H
+
+#include <QAtomicInt>
+#include <QFile>
+#include <QScopedArrayPointer>
+#include <QString>
+#include <QVector>
+
+#include "samplekernels.h"
+
+
+class WavBuffer;
+
+
+/* Multi-resolution summary of the audio samples of a WavBuffer
+ *
+ * Level 0 stores the minimum and maximum sample value of every block of
+ * baseBlockSize frames, for each channel. Each following level merges two
+ * blocks of the level below, so that block sizes are powers of two.
+ * It allows getting the min/max of any frame range in logarithmic time.
+ *
+ * The pyramid can be built progressively, by chunks of chunkSize frames, from
+ * another thread (see PeakBuilder): the levels up to chunkLevel of a chunk can be
+ * read as soon as the chunk is ready, the upper levels once all chunks are ready.
+ *
+ * A complete pyramid can be saved to a cache file, which is memory-mapped the next time
+ * the same file is opened: the waveform is then available at once, whatever the file length.
+ * The cache file is named after the path of the audio file, and records its size, modification
+ * time and format: it is not used if any of them changed. Edits do not invalidate it, since the
+ * pyramid covers the source frames; an export over the audio file changes its modification time. */
+class PeakPyramid
+{
+    
+public:
+    struct Peak
+    {
+        int min;
+        int max;
+    };
+    
+    static const int    baseBlockShift = 6;
+    static const int    baseBlockSize  = 1 << baseBlockShift;  // 64 frames
+    static const int    chunkLevel     = 10;
+    static const qint64 chunkSize      = (qint64) baseBlockSize << chunkLevel;  // 65536 frames
+    
+    void allocate(WavBuffer *audioSource);
+    void build(WavBuffer *audioSource);
+    void buildChunk(WavBuffer *audioSource, qint64 chunk);
+    
+    // Same for frames which are not those of a file (see AudioBlock)
+    void allocate(int channelsCount, qint64 framesCount);
+    void build(const uchar *frames, qint64 framesCount, int channelsCount, SampleKernels::SampleFormat format);
+    void buildChunk(const uchar *frames, SampleKernels::SampleFormat format, qint64 chunk);
+    
+    void buildUpperLevels();
+    void clear();
+    
+    bool loadCache(WavBuffer *audioSource);
+    bool saveCache(WavBuffer *audioSource, const QAtomicInt *stopRequested = nullptr);
+    static QString cachePath(const QString &filePath);
+    static void    removeCache(const QString &filePath);
+    
+    bool   isEmpty()                  {return m_levelOffsets.isEmpty();};
+    int    levelsCount()              {return m_levelOffsets.size();};
+    qint64 blockSize(int level)       {return (qint64)baseBlockSize << level;};
+    qint64 chunksCount()              {return (m_framesCount + chunkSize - 1) / chunkSize;};
+    bool   isChunkReady(qint64 chunk) {return m_chunksReady[chunk].loadAcquire();};
+    bool   isComplete()               {return m_complete.loadAcquire();};
+    
+    int  levelAt(qint64 frame, qint64 endFrame);
+    Peak peak(int level, qint64 frame, int channelIndex);
+    
+private:
+    int    m_channelsCount = 0;
+    qint64 m_framesCount   = 0;
+    
+    QVector<Peak>   m_peaks;              // All the levels, stored one after the other
+    QVector<qint64> m_levelOffsets;       // Index of the first peak of each level in m_peaks
+    Peak           *m_storage = nullptr;  // m_peaks.data(), taken once so that other threads never detach m_peaks
+    
+    QScopedArrayPointer<QAtomicInt> m_chunksReady;  // Set when the levels up to chunkLevel of a chunk are computed
+    QAtomicInt                      m_complete;     // Set when all the levels are computed
+    
+    QFile m_cacheFile;  // Open while m_storage points to its mapping instead of m_peaks
+    
+    // Header of a cache file, followed by all the levels as stored in memory
+    struct CacheHeader
+    {
+        char   magic[8];
+        qint32 version;
+        qint32 baseBlockShift;
+        qint32 channelsCount;
+        qint32 bitDepth;
+        qint32 sampleRate;
+        qint32 sampleFormat;
+        qint64 framesCount;
+        qint64 dataOffset;
+        qint64 fileSize;
+        qint64 lastModified;  // ms since epoch
+        qint64 peaksCount;
+    };
+    
+    qint64 computeLevelOffsets();
+    void   mergeLevel(int level, qint64 firstBlock, qint64 endBlock);
+    
+    static bool cacheHeader(WavBuffer *audioSource, qint64 peaksCount, CacheHeader &header);
+    
+};
+
+#endif // PEAKPYRAMID_H
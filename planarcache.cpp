@@ -0,0 +1,117 @@
+#include <algorithm>
+#include <cstring>
+
+#include <QMutexLocker>
+
+#include "planarcache.h"
+
+
+PlanarCache::PlanarCache(int maxSizeMB) : m_blocks(maxSizeMB * 1024)
+{
+}
+
+
+/* Give the interleaved frames to cache, which must stay valid until the next call. It empties the cache. */
+void PlanarCache::setSource(const uchar *frames, qint64 framesCount, int channelsCount, SampleKernels::SampleFormat format)
+{
+    
+    QMutexLocker locker(&m_mutex);
+    
+    m_blocks.clear();
+    m_frames        = frames;
+    m_framesCount   = framesCount;
+    m_channelsCount = channelsCount;
+    m_format        = format;
+    
+}
+
+
+/* Release the memory of all the blocks. Threads which are reading a block keep it until they are done. */
+void PlanarCache::clear()
+{
+    QMutexLocker locker(&m_mutex);
+    m_blocks.clear();
+}
+
+
+/* The frames are read block by block, each block being built first if it is not cached. Frames which are not loaded are not read. */
+void PlanarCache::readSamples(qint64 sourceFrame, qint64 framesCount, int channelIndex, int *samples, qint64 loadedFramesCount)
+{
+    
+    qint64 endFrame = std::min(sourceFrame + framesCount, std::min(m_framesCount, loadedFramesCount));
+    
+    for (qint64 frame = sourceFrame; frame < endFrame; )
+    {
+        qint64 index  = frame >> blockShift;
+        qint64 offset = frame - (index << blockShift);
+        qint64 count  = std::min(blockSize - offset, endFrame - frame);
+        
+        QSharedPointer<Block> planar = block(index, loadedFramesCount);
+        memcpy(samples, planar->samples.constData() + channelIndex * blockSize + offset, count * sizeof(int));
+        
+        samples += count;
+        frame   += count;
+    }
+    
+}
+
+
+/* Get a block, and decode it if it is not ready.
+ *
+ * The block is inserted in the cache before it is built, so that the cache is only locked for the lookup:
+ * a thread which needs the block meanwhile waits on its own mutex. A block which does not fit
+ * in the cache is still built and returned, it is only dropped once it is read.
+ * A block of which the last frames are not loaded yet is decoded up to the loaded frames, and not cached:
+ * it would otherwise keep the samples of frames being loaded. */
+QSharedPointer<PlanarCache::Block> PlanarCache::block(qint64 index, qint64 loadedFramesCount)
+{
+    
+    qint64 first = index << blockShift;
+    qint64 count = std::min(blockSize, m_framesCount - first);
+    
+    QSharedPointer<Block> planar;
+    
+    if (first + count > loadedFramesCount)
+    {
+        planar = QSharedPointer<Block>(new Block);
+        decode(planar.data(), first, loadedFramesCount - first);
+        return planar;
+    }
+    
+    {
+        QMutexLocker locker(&m_mutex);
+        
+        QSharedPointer<Block> *cached = m_blocks.object(index);
+        
+        if (cached)
+        {
+            planar = *cached;
+        }
+        else
+        {
+            int cost = (int) (blockSize * m_channelsCount * sizeof(int) / 1024);
+            planar   = QSharedPointer<Block>(new Block);
+            m_blocks.insert(index, new QSharedPointer<Block>(planar), cost);
+        }
+    }
+    
+    QMutexLocker locker(&planar->mutex);
+    
+    if (!planar->ready)
+    {
+        decode(planar.data(), first, count);
+        planar->ready = true;
+    }
+    
+    return planar;
+    
+}
+
+
+/* Decode the samples of a number of frames from the first frame of a block, all the channels at once. */
+void PlanarCache::decode(Block *planar, qint64 first, qint64 count)
+{
+    planar->samples.resize(blockSize * m_channelsCount);
+    SampleKernels::deinterleave(m_frames + first * m_channelsCount * SampleKernels::sampleSize(m_format), count,
+                                m_channelsCount, m_format, planar->samples.data(), blockSize);
+}
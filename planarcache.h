@@ -0,0 +1,60 @@
+#ifndef PLANARCACHE_H
+#define PLANARCACHE_H
+
+#include <QCache>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QVector>
+
+#include "samplekernels.h"
+
+
+/* Samples of the source frames of a WavBuffer stored channel by channel (planar), for scans of a single channel
+ *
+ * Frames are interleaved in WAV files: a scan of one channel strides by the size of a frame, and only uses
+ * one sample of each frame it loads, a small part of each cache line when there are many channels.
+ * The cache decodes blocks of blockSize frames on demand, all the channels in a single pass over the frames,
+ * and keeps the samples of each channel of a block in a contiguous run of ints. Rendering and analysis
+ * then read a channel contiguously (see WavBuffer::readSamples). The least recently used blocks are dropped
+ * beyond a memory budget.
+ * Blocks are built by the first thread which needs them: threads which need the same block wait for it, the
+ * others are not blocked. While the file is loading, a block of which some frames are not loaded yet is
+ * decoded for the reader alone, and cached only once all its frames are loaded. The interleaved frames stay the reference, which playback and export read as they are.
+ */
+class PlanarCache
+{
+    
+public:
+    static const int    blockShift = 12;
+    static const qint64 blockSize  = 1 << blockShift;  // 4096 frames
+    
+    PlanarCache(int maxSizeMB = 256);
+    
+    void setSource(const uchar *frames, qint64 framesCount, int channelsCount, SampleKernels::SampleFormat format);
+    void clear();
+    
+    // Decode the samples of a channel for consecutive source frames, among the first loadedFramesCount
+    void readSamples(qint64 sourceFrame, qint64 framesCount, int channelIndex, int *samples, qint64 loadedFramesCount);
+    
+private:
+    struct Block
+    {
+        QMutex       mutex;  // Held while the block is built
+        bool         ready = false;
+        QVector<int> samples;  // Samples of channel c at [c * blockSize, (c + 1) * blockSize)
+    };
+    
+    const uchar                *m_frames        = nullptr;
+    qint64                      m_framesCount   = 0;
+    int                         m_channelsCount = 0;
+    SampleKernels::SampleFormat m_format        = SampleKernels::InvalidFormat;
+    
+    QMutex                                 m_mutex;   // Protects m_blocks, which several threads read
+    QCache<qint64, QSharedPointer<Block>>  m_blocks;  // Cost in KB
+    
+    QSharedPointer<Block> block(qint64 index, qint64 loadedFramesCount);
+    void                  decode(Block *planar, qint64 first, qint64 count);
+    
+};
+
+#endif // PLANARCACHE_H
@@ -0,0 +1,108 @@
+#include <algorithm>
+
+#include "playbackproducer.h"
+
+
+PlaybackProducer::PlaybackProducer(WavBuffer *audioSource, RingBuffer<char> *ringBuffer, QObject *parent) : QThread(parent)
+{
+    m_audioSource  = audioSource;
+    m_ringBuffer   = ringBuffer;
+    m_edits        = *audioSource->edits();
+    m_outputFormat = audioSource->sampleFormat();
+}
+
+
+/* The worker thread must be finished before the WavBuffer is deleted. */
+PlaybackProducer::~PlaybackProducer()
+{
+    stop();
+}
+
+
+/* Start copying frames from a given logical frame, a period at a time.
+ *
+ * The ring buffer must be empty and its consumer stopped. */
+void PlaybackProducer::start(qint64 startFrame, int periodSize)
+{
+    
+    stop();
+    
+    m_framePosition = startFrame;
+    m_periodSize    = periodSize;
+    m_stopRequested.storeRelease(0);
+    m_reachedEnd.storeRelease(0);
+    
+    QThread::start(QThread::HighPriority);
+    
+}
+
+
+/* Ask the worker thread to stop and wait for it. */
+void PlaybackProducer::stop()
+{
+    m_stopRequested.storeRelease(1);
+    wait();
+}
+
+
+/* Give the new edits of the WavBuffer, after a cut, undo or redo.
+ *
+ * Frames already in the ring buffer are not changed: the engine starts again from its position. */
+void PlaybackProducer::setEdits(EditList *edits)
+{
+    QMutexLocker locker(&m_editsMutex);
+    m_edits = *edits;
+}
+
+
+/* Set the format of the frames written to the ring buffer. It must be called while the worker thread is stopped. */
+void PlaybackProducer::setOutputFormat(SampleKernels::SampleFormat format)
+{
+    m_outputFormat = format;
+}
+
+
+/* Main loop of the worker thread.
+ *
+ * A period is copied whenever it fits in the ring buffer, once converted. Otherwise the thread sleeps for
+ * half a period, which is enough to keep the buffer full since it holds several periods. */
+void PlaybackProducer::run()
+{
+    
+    SampleKernels::SampleFormat format = m_audioSource->sampleFormat();
+    
+    int        channelsCount   = m_audioSource->channelsCount();
+    int        outputFrameSize = SampleKernels::sampleSize(m_outputFormat) * channelsCount;
+    int        sleepTime       = std::max<qint64>(1, (qint64) m_periodSize * 500 / m_audioSource->sampleRate());  // ms
+    QByteArray period(m_periodSize * m_audioSource->bytesPerFrame(), 0);
+    QByteArray converted(m_periodSize * outputFrameSize, 0);
+    
+    while (!m_stopRequested.loadAcquire())
+    {
+        
+        if (m_ringBuffer->writeAvailable() < converted.size())
+        {
+            msleep(sleepTime);
+            continue;
+        }
+        
+        qint64 read;
+        
+        {
+            QMutexLocker locker(&m_editsMutex);
+            read = m_audioSource->readFrames(m_framePosition, period.data(), m_periodSize, &m_edits);
+        }
+        
+        if (read == 0)
+        {
+            m_reachedEnd.storeRelease(1);
+            return;
+        }
+        
+        SampleKernels::convert((const uchar*) period.constData(), format, (uchar*) converted.data(), m_outputFormat, read * channelsCount);
+        m_ringBuffer->write(converted.constData(), read * outputFrameSize);
+        m_framePosition += read;
+        
+    }
+    
+}
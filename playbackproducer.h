@@ -0,0 +1,56 @@
+#ifndef PLAYBACKPRODUCER_H
+#define PLAYBACKPRODUCER_H
+
+#include <QAtomicInteger>
+#include <QMutex>
+#include <QThread>
+
+#include "editlist.h"
+#include "ringbuffer.h"
+#include "wavbuffer.h"
+
+
+/* Worker thread which feeds the playback ring buffer with the frames of a WavBuffer
+ *
+ * The frames are read through a copy of the edit list, so that the GUI thread can edit
+ * the WavBuffer meanwhile: setEdits gives the new list. Each period is converted from
+ * the format of the file to the format of the audio output (see setOutputFormat), so that
+ * the ring buffer holds frames the output can play as they are.
+ * The audio output, which consumes the ring buffer, never waits for this thread or the GUI thread.
+ */
+class PlaybackProducer : public QThread
+{
+    
+    Q_OBJECT
+    
+public:
+    PlaybackProducer(WavBuffer *audioSource, RingBuffer<char> *ringBuffer, QObject *parent = 0);
+    ~PlaybackProducer();
+    
+    void start(qint64 startFrame, int periodSize);
+    void stop();
+    
+    void setEdits(EditList *edits);
+    void setOutputFormat(SampleKernels::SampleFormat format);
+    bool reachedEnd()    {return m_reachedEnd.loadAcquire();};
+    
+protected:
+    void run();
+    
+private:
+    WavBuffer        *m_audioSource;
+    RingBuffer<char> *m_ringBuffer;
+    EditList          m_edits;           // Copy of the edits of the WavBuffer, protected by m_editsMutex
+    QMutex            m_editsMutex;
+    
+    qint64 m_framePosition = 0;          // Next logical frame to copy, only used by the worker thread once started
+    int    m_periodSize    = 0;
+    
+    SampleKernels::SampleFormat m_outputFormat;  // Format of the frames written to the ring buffer
+    
+    QAtomicInt m_stopRequested;
+    QAtomicInt m_reachedEnd;
+    
+};
+
+#endif // PLAYBACKPRODUCER_H
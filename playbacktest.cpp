@@ -0,0 +1,331 @@
+#include <algorithm>
+#include <cstdio>
+
+#include <QEventLoop>
+#include <QFile>
+#include <QJsonDocument>
+#include <QTemporaryDir>
+#include <QTimer>
+#include <QVector>
+
+#include "benchmark.h"
+#include "playbacktest.h"
+#include "samplekernels.h"
+#include "waveformrasterizer.h"
+#include "wavbuffer.h"
+
+
+// Channels of the synthetic file
+static const int syntheticChannelsCount = 2;
+
+
+const char *PlaybackTest::usage =
+    "Usage: AudioPlayer --playback-test [--period <frames>] [--seconds <count>] [--stress] [--output <file.json>] [<file.wav>]\n"
+    "\n"
+    "The file is played in real time through the file output, without an audio device.\n"
+    "\n"
+    "Options:\n"
+    "  --period <frames>     Number of frames pulled at once by the output (default: 512)\n"
+    "  --seconds <count>     Length of the synthetic file played when no file is given (default: 5)\n"
+    "  --stress              Rasterize the waveform in one thread per core during the playback\n"
+    "  --output <file.json>  Write the results to a file instead of the standard output\n";
+
+
+/* Read the arguments given after --playback-test. */
+bool PlaybackTest::parseArguments(const QStringList &arguments)
+{
+    
+    for (int i = 1; i < arguments.size(); i++)
+    {
+        const QString &argument = arguments.at(i);
+        bool           hasValue = i + 1 < arguments.size();
+        bool           valid    = true;
+        
+        if (argument == "--playback-test")
+        {
+            continue;
+        }
+        else if (argument == "--period" && hasValue)
+        {
+            m_periodSize = arguments.at(++i).toInt(&valid);
+            valid        = valid && m_periodSize > 0;
+        }
+        else if (argument == "--seconds" && hasValue)
+        {
+            m_seconds = arguments.at(++i).toInt(&valid);
+            valid     = valid && m_seconds > 0;
+        }
+        else if (argument == "--stress")
+        {
+            m_stress = true;
+        }
+        else if (argument == "--output" && hasValue)
+        {
+            m_outputPath = arguments.at(++i);
+        }
+        else if (!argument.startsWith("--") && m_inputPath.isEmpty())
+        {
+            m_inputPath = argument;
+        }
+        else
+        {
+            m_error = "Unknown option or missing value";
+            return false;
+        }
+        
+        if (!valid)
+        {
+            m_error = "Invalid number of frames or seconds";
+            return false;
+        }
+    }
+    
+    return true;
+    
+}
+
+
+/* Play the file and write the results. It returns the exit code of the program. */
+int PlaybackTest::run()
+{
+    
+    QTemporaryDir directory;
+    
+    if (!directory.isValid())
+    {
+        fprintf(stderr, "Unable to create a temporary directory\n");
+        return 1;
+    }
+    
+    QString filePath = m_inputPath;
+    
+    if (filePath.isEmpty())
+    {
+        filePath = directory.filePath("playback.wav");
+        
+        if (!Benchmark::writeSyntheticWav(filePath, SampleKernels::Int16, syntheticChannelsCount, (qint64) m_seconds * 44100))
+        {
+            fprintf(stderr, "Unable to write %s\n", qPrintable(filePath));
+            return 1;
+        }
+    }
+    
+    if (!playFile(filePath, directory.filePath("playback.raw")))
+        return 1;
+    
+    QByteArray json     = QJsonDocument(m_report).toJson();
+    bool       passed   = m_report["output_matches"].toBool() && m_report["underruns"].toInt() == 0 && m_report["overruns"].toInt() == 0;
+    int        exitCode = passed ? 0 : 1;
+    
+    if (m_outputPath.isEmpty())
+    {
+        fwrite(json.constData(), 1, json.size(), stdout);
+        return exitCode;
+    }
+    
+    QFile output(m_outputPath);
+    
+    if (!output.open(QFile::WriteOnly) || output.write(json) != json.size())
+    {
+        fprintf(stderr, "Unable to write %s\n", qPrintable(m_outputPath));
+        return 1;
+    }
+    
+    return exitCode;
+    
+}
+
+
+/* Cut the middle of the file, play it to the end into a raw file and compare it with the edited frames.
+ *
+ * With m_stress, the rasterizer threads run from the start to the end of the playback.
+ * It returns false if the file cannot be played at all. */
+bool PlaybackTest::playFile(const QString &filePath, const QString &rawPath)
+{
+    
+    QByteArray path = QFile::encodeName(filePath);
+    WavBuffer  audioSource;
+    
+    if (!audioSource.loadFile(path.constData()))
+    {
+        fprintf(stderr, "Unable to load %s: %s\n", path.constData(), audioSource.error());
+        return false;
+    }
+    
+    // A cut makes the producer cross a piece boundary during the playback
+    qint64 sourceFrames = audioSource.framesCount();
+    
+    if (sourceFrames >= 4)
+        audioSource.cutBlock(sourceFrames / 3, sourceFrames / 2);
+    
+    AudioEngine player(&audioSource);
+    player.setPeriodSize(m_periodSize);
+    
+    if (!player.setOutput(AudioEngine::FileOutput, rawPath))
+    {
+        fprintf(stderr, "Unable to write %s: %s\n", qPrintable(rawPath), player.error());
+        return false;
+    }
+    
+    // The rasterizer needs the peaks, as the plot does
+    QVector<RasterizerLoad*> loads;
+    
+    if (m_stress)
+    {
+        audioSource.peaks()->build(&audioSource);
+        
+        for (int i = 0; i < QThread::idealThreadCount(); i++)
+            loads.append(new RasterizerLoad(&audioSource));
+    }
+    
+    // The latency is sampled at each position given by the player, once per period
+    double latencySum     = 0;
+    double latencyMaximum = 0;
+    qint64 latencyCount   = 0;
+    
+    QObject::connect(&player, &AudioEngine::positionChanged, [&]() {
+        if (player.state() != AudioEngine::PlayingState)
+            return;
+        double latency  = player.latency();
+        latencySum     += latency;
+        latencyMaximum  = std::max(latencyMaximum, latency);
+        latencyCount++;
+    });
+    
+    // Playback runs in real time: it is given up if it takes much longer than the audio
+    QEventLoop loop;
+    QTimer     timeout;
+    qint64     framesCount = audioSource.framesCount();
+    
+    timeout.setSingleShot(true);
+    QObject::connect(&timeout, &QTimer::timeout, &loop, &QEventLoop::quit);
+    QObject::connect(&player, &AudioEngine::stateChanged, &loop, [&](AudioEngine::State state) {
+        if (state == AudioEngine::StoppedState)
+            loop.quit();
+    });
+    
+    for (RasterizerLoad *load : loads)
+        load->start();
+    
+    bool started = player.play();
+    
+    if (started)
+    {
+        timeout.start(framesCount * 2000 / audioSource.sampleRate() + 5000);
+        loop.exec();
+    }
+    
+    bool   finished     = player.state() == AudioEngine::StoppedState;
+    qint64 columnsCount = 0;
+    
+    for (RasterizerLoad *load : loads)
+    {
+        load->stop();
+        columnsCount += load->columnsCount();
+        delete load;
+    }
+    
+    if (!started)
+    {
+        fprintf(stderr, "Unable to play %s: %s\n", path.constData(), player.error());
+        return false;
+    }
+    
+    // The raw file is closed by switching to the null output
+    SampleKernels::SampleFormat outputFormat = player.outputFormat();
+    player.setOutput(AudioEngine::NullOutput);
+    
+    QFile      raw(rawPath);
+    QByteArray played;
+    QByteArray frames;
+    QByteArray expected;
+    int        outputFrameSize = SampleKernels::sampleSize(outputFormat) * audioSource.channelsCount();
+    
+    if (raw.open(QFile::ReadOnly))
+        played = raw.readAll();
+    
+    // The output plays the frames converted by the producer
+    frames.resize(framesCount * audioSource.bytesPerFrame());
+    expected.resize(framesCount * outputFrameSize);
+    audioSource.readFrames(0, frames.data(), framesCount);
+    SampleKernels::convert((const uchar*) frames.constData(), audioSource.sampleFormat(), (uchar*) expected.data(), outputFormat,
+                           framesCount * audioSource.channelsCount());
+    
+    m_report["file"]            = filePath;
+    m_report["instruction_set"] = SampleKernels::instructionSet();
+    m_report["sample_rate"]     = audioSource.sampleRate();
+    m_report["channels"]        = audioSource.channelsCount();
+    m_report["file_format"]     = SampleKernels::formatName(audioSource.sampleFormat());
+    m_report["output_format"]   = SampleKernels::formatName(outputFormat);
+    m_report["frames"]          = (double) framesCount;
+    m_report["period_frames"]   = player.periodSize();
+    m_report["output_consumer"] = "thread";
+    m_report["latency_ms"]      = latencyCount ? latencySum / latencyCount : 0.0;
+    m_report["max_latency_ms"]  = latencyMaximum;
+    m_report["played_frames"]   = (double) (played.size() / outputFrameSize);
+    m_report["finished"]        = finished;
+    m_report["underruns"]       = player.underrunsCount();
+    m_report["overruns"]        = player.overrunsCount();
+    m_report["output_matches"]  = finished && played == expected;
+    m_report["stress_threads"]  = loads.size();
+    m_report["stress_columns"]  = (double) columnsCount;
+    
+    return true;
+    
+}
+
+
+
+RasterizerLoad::RasterizerLoad(WavBuffer *audioSource, QObject *parent) : QThread(parent)
+{
+    m_audioSource = audioSource;
+}
+
+
+RasterizerLoad::~RasterizerLoad()
+{
+    stop();
+}
+
+
+/* Ask the thread to stop and wait for it. */
+void RasterizerLoad::stop()
+{
+    m_stopRequested.storeRelease(1);
+    wait();
+}
+
+
+/* Draw the channels one after the other, doubling the scale after each pass over them.
+ *
+ * The samples are mapped to the range of 16-bit samples, as in the plot. */
+void RasterizerLoad::run()
+{
+    
+    QImage image(imageWidth, imageHeight, QImage::Format_ARGB32_Premultiplied);
+    
+    qint64 framesCount  = m_audioSource->framesCount();
+    qint64 maximumScale = framesCount / imageWidth + 1;
+    int    valueShift   = std::max(0, SampleKernels::significantBits(m_audioSource->sampleFormat()) - 16);
+    int    min          = 0;
+    int    max          = 0;
+    
+    for (qint64 scale = 1; !m_stopRequested.loadAcquire(); scale = (scale < maximumScale) ? scale * 2 : 1)
+    {
+        for (int channel = 0; channel < m_audioSource->channelsCount() && !m_stopRequested.loadAcquire(); channel++)
+        {
+            image.fill(Qt::transparent);
+            
+            WaveformRasterizer rasterizer(image, 1.1 * 32767, 1.1 * (-32768 - 32767 + 1), QColor(5, 31, 41));
+            
+            for (int x = 0; x < imageWidth && x * scale < framesCount; x++)
+            {
+                if (m_audioSource->getMinMaxSampleValueInRange(x * scale, scale, channel, min, max))
+                    rasterizer.drawColumn(x, min >> valueShift, max >> valueShift);
+            }
+            
+            m_columnsCount.fetchAndAddRelaxed(imageWidth);
+        }
+    }
+    
+}
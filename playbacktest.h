@@ -0,0 +1,80 @@
+#ifndef PLAYBACKTEST_H
+#define PLAYBACKTEST_H
+
+#include <QJsonObject>
+#include <QString>
+#include <QStringList>
+#include <QThread>
+
+#include "audioengine.h"
+#include "wavbuffer.h"
+
+
+/* Check of the playback engine without an audio device, started with the --playback-test argument
+ *
+ * A file (synthetic unless one is given) is cut in its middle, then played to the end through the
+ * file output of an AudioEngine, in real time, with the period size given on the command line.
+ * The raw frames written by the output are compared with the edited frames of the file, converted
+ * to the format in which they are played, and the latency of the output is measured during the playback.
+ * The file output is consumed at the audio rate by a thread of its own, as an audio device would pull
+ * the frames, not by the GUI thread: the report gives "thread" as its output_consumer.
+ * With --stress, threads rasterize the waveform of the file over and over during the playback,
+ * as the plot would at full speed, so that the producer and the output compete with them for the CPU.
+ * The results are written as JSON; the program fails if the frames played are not the edited frames,
+ * or if the ring buffer underran or overran.
+ */
+class PlaybackTest
+{
+    
+public:
+    static const char *usage;
+    
+    bool parseArguments(const QStringList &arguments);
+    int  run();
+    
+    const char* error()  {return m_error;};
+    
+private:
+    QString     m_inputPath;        // Empty for a synthetic file
+    QString     m_outputPath;       // Empty for the standard output
+    int         m_periodSize = AudioEngine::defaultPeriodSize;
+    int         m_seconds    = 5;  // Length of the synthetic file
+    bool        m_stress     = false;
+    const char *m_error = "";
+    QJsonObject m_report;
+    
+    bool playFile(const QString &filePath, const QString &rawPath);
+    
+};
+
+
+/* Thread which rasterizes the waveform of a file over and over, to load the CPU during a playback test
+ *
+ * The columns of every channel are written into an image of its own, at scales from 1 frame per column
+ * to the whole file, until the thread is stopped. The peaks of the file must be computed beforehand.
+ */
+class RasterizerLoad : public QThread
+{
+    
+public:
+    static const int imageWidth  = 1260;  // Width of the subplots of a 1280-pixel plot
+    static const int imageHeight = 100;
+    
+    RasterizerLoad(WavBuffer *audioSource, QObject *parent = 0);
+    ~RasterizerLoad();
+    
+    void   stop();
+    qint64 columnsCount()  {return m_columnsCount.loadAcquire();};
+    
+protected:
+    void run();
+    
+private:
+    WavBuffer *m_audioSource;
+    
+    QAtomicInt             m_stopRequested;
+    QAtomicInteger<qint64> m_columnsCount;  // Columns drawn so far
+    
+};
+
+#endif // PLAYBACKTEST_H
@@ -0,0 +1,382 @@
+#include <algorithm>
+#include <cstdio>
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTemporaryDir>
+
+#include "allocationcounter.h"
+#include "audioengine.h"
+#include "benchmark.h"
+#include "renderbenchmark.h"
+#include "samplekernels.h"
+#include "signalplot.h"
+#include "wavbuffer.h"
+
+
+// Size of the plot, its subplots are 20 pixels narrower (see SignalPlot::paintEvent)
+static const int plotWidth   = 1280;
+static const int plotPadding = 10;
+
+// Columns the waveform moves by at each frame while scrolling, as during playback
+static const int scrollColumns = 4;
+
+// Positions at which the images of both drawing paths are compared, for each scale
+static const int comparisonsCount = 4;
+
+
+const char *RenderBenchmark::usage =
+    "Usage: AudioPlayer --render-benchmark [--quick] [--output <file.json>]\n"
+    "\n"
+    "The plot is rendered offscreen (QT_QPA_PLATFORM=offscreen unless another platform is set).\n"
+    "When built with CONFIG+=allocation_counter, it fails if scrolling through the rasterized tiles or columns\n"
+    "allocates memory once they are drawn, besides the setup of the QPainter.\n"
+    "\n"
+    "Options:\n"
+    "  --quick                Render fewer frames of shorter files\n"
+    "  --output <file.json>   Write the results to a file instead of the standard output\n";
+
+
+/* Read the arguments given after --render-benchmark. */
+bool RenderBenchmark::parseArguments(const QStringList &arguments)
+{
+    
+    for (int i = 1; i < arguments.size(); i++)
+    {
+        const QString &argument = arguments.at(i);
+        
+        if (argument == "--render-benchmark")
+        {
+            continue;
+        }
+        else if (argument == "--quick")
+        {
+            m_quick = true;
+        }
+        else if (argument == "--output" && i + 1 < arguments.size())
+        {
+            m_outputPath = arguments.at(++i);
+        }
+        else
+        {
+            m_error = "Unknown option or missing value";
+            return false;
+        }
+    }
+    
+    return true;
+    
+}
+
+
+/* Render the plot for all the channels counts and write the results. It returns the exit code of the program. */
+int RenderBenchmark::run()
+{
+    
+    QTemporaryDir directory;
+    
+    if (!directory.isValid())
+    {
+        fprintf(stderr, "Unable to create a temporary directory\n");
+        return 1;
+    }
+    
+    for (int channelsCount : {1, 2, 8, 64})
+    {
+        // Files are kept under a given size, the whole range of scales is swept anyway
+        qint64  maximumSize = m_quick ? (16 << 20) : (128 << 20);
+        qint64  framesCount = std::min<qint64>(m_quick ? (1 << 18) : (1 << 22), maximumSize / (2 * channelsCount));
+        QString filePath    = directory.filePath(QString("render_%1ch.wav").arg(channelsCount));
+        
+        if (!Benchmark::writeSyntheticWav(filePath, SampleKernels::Int16, channelsCount, framesCount))
+        {
+            fprintf(stderr, "Unable to write %s\n", qPrintable(filePath));
+            return 1;
+        }
+        
+        benchmarkFile(filePath, channelsCount);
+        QFile::remove(filePath);
+    }
+    
+    QJsonObject report;
+    report["instruction_set"] = SampleKernels::instructionSet();
+    report["plot_width"]      = plotWidth;
+    report["allocation_counter"] = AllocationCounter::isEnabled();
+    report["allocating_results"] = m_allocatingResults;
+    report["results"]         = m_results;
+    report["comparisons"]     = m_comparisons;
+    
+    QByteArray json     = QJsonDocument(report).toJson();
+    int        exitCode = (m_allocatingResults > 0) ? 1 : 0;
+    
+    if (m_outputPath.isEmpty())
+    {
+        fwrite(json.constData(), 1, json.size(), stdout);
+        return exitCode;
+    }
+    
+    QFile output(m_outputPath);
+    
+    if (!output.open(QFile::WriteOnly) || output.write(json) != json.size())
+    {
+        fprintf(stderr, "Unable to write %s\n", qPrintable(m_outputPath));
+        return 1;
+    }
+    
+    return exitCode;
+    
+}
+
+
+/* Render the plot of a file at every scale.
+ *
+ * The peaks are computed beforehand, so that only the drawing is timed. */
+void RenderBenchmark::benchmarkFile(const QString &filePath, int channelsCount)
+{
+    
+    QByteArray path = QFile::encodeName(filePath);
+    WavBuffer  audioSource;
+    
+    if (!audioSource.loadFile(path.constData()))
+    {
+        fprintf(stderr, "Unable to load %s: %s\n", path.constData(), audioSource.error());
+        return;
+    }
+    
+    audioSource.peaks()->build(&audioSource);
+    
+    // The plot reads its position from the player, which never plays here
+    AudioEngine player(&audioSource);
+    player.setOutput(AudioEngine::NullOutput);
+    
+    SignalPlot plot;
+    plot.setAttribute(Qt::WA_DontShowOnScreen);
+    plot.resize(plotWidth, std::max(600, channelsCount * 24 + plotPadding));
+    plot.preparePlot(&audioSource, &player);
+    
+    QImage image(plot.size(), QImage::Format_ARGB32_Premultiplied);
+    QImage direct(plot.size(), QImage::Format_ARGB32_Premultiplied);
+    
+    int    subplotWidth   = plotWidth - 2 * plotPadding;
+    int    framesPerScale = m_quick ? 20 : 60;
+    qint64 framesCount    = audioSource.framesCount();
+    
+    QVector<double>           times;
+    AllocationCounter::Counts allocations;
+    AllocationCounter::Counts painterAllocations;  // Part of the allocations made by the setup of the QPainter
+    
+    for (int scale : scales(framesCount / subplotWidth + 1))
+    {
+        plot.setScale(scale);
+        
+        qint64 lastPosition = std::max<qint64>(0, framesCount - (qint64) subplotWidth * scale);
+        
+        // Playback: the waveform moves by a few columns at each frame.
+        // The same frames are drawn again once the tiles and buffers are there, to count the allocations of the steady state
+        auto scroll = [&]() {
+            times.clear();
+            for (int k = 0; k < framesPerScale; k++)
+            {
+                player.seek(std::min((qint64) k * scrollColumns * scale, lastPosition));
+                plot.refreshPosition();
+                times.append(render(plot, image));
+            }
+            
+            allocations        = AllocationCounter::Counts();
+            painterAllocations = AllocationCounter::Counts();
+            for (int k = 0; k < framesPerScale; k++)
+            {
+                player.seek(std::min((qint64) k * scrollColumns * scale, lastPosition));
+                plot.refreshPosition();
+                render(plot, image);
+                allocations        += plot.lastPaintAllocations();
+                painterAllocations += plot.lastPainterAllocations();
+            }
+        };
+        
+        // Navigation: the waveform jumps across the file, nothing drawn before can be reused
+        auto jump = [&]() {
+            times.clear();
+            for (int k = 0; k < framesPerScale; k++)
+            {
+                plot.setTileCacheEnabled(true);
+                player.seek(lastPosition * k / (framesPerScale - 1));
+                plot.refreshPosition();
+                times.append(render(plot, image));
+            }
+        };
+        
+        // Samples are drawn one by one at the lowest scales, tiles are not used
+        if (scale <= 7)
+        {
+            scroll();
+            addResult("samples_scroll", channelsCount, scale, times, &allocations, &painterAllocations);
+            continue;
+        }
+        
+        jump();
+        addResult("tiles_jump", channelsCount, scale, times);
+        
+        plot.setTileCacheEnabled(true);
+        scroll();
+        addResult("tiles_scroll", channelsCount, scale, times, &allocations, &painterAllocations, true);
+        
+        plot.setTileCacheEnabled(false);
+        scroll();
+        addResult("direct_scroll", channelsCount, scale, times, &allocations, &painterAllocations, true);
+        
+        // Same paths with the columns drawn as QPainter lines instead of written into the images
+        plot.setRasterizerEnabled(false);
+        
+        jump();
+        addResult("painter_tiles_jump", channelsCount, scale, times);
+        
+        plot.setTileCacheEnabled(false);
+        scroll();
+        addResult("painter_direct_scroll", channelsCount, scale, times, &allocations, &painterAllocations);
+        
+        plot.setRasterizerEnabled(true);
+        
+        // Both paths must give the same image, including at the seams between tiles
+        for (int k = 0; k < comparisonsCount; k++)
+        {
+            qint64 position = lastPosition * k / (comparisonsCount - 1);
+            
+            player.seek(position);
+            plot.refreshPosition();
+            
+            plot.setTileCacheEnabled(false);
+            render(plot, direct);
+            plot.setTileCacheEnabled(true);
+            render(plot, image);
+            
+            addComparison(channelsCount, scale, position, image, direct);
+        }
+    }
+    
+}
+
+
+/* Add the paint times of a path at a given scale to the report, with the allocations made by the paints of the steady state
+ * when they are counted. The paints of an allocation-free path must not allocate besides the setup of the QPainter. */
+void RenderBenchmark::addResult(const QString &path, int channelsCount, int scale, QVector<double> &times,
+                                const AllocationCounter::Counts *allocations, const AllocationCounter::Counts *painterAllocations,
+                                bool allocationFree)
+{
+    
+    std::sort(times.begin(), times.end());
+    
+    double total = 0;
+    for (double time : times)
+        total += time;
+    
+    auto percentile = [&](double p) {return times.at(std::min(times.size() - 1, (int) (p * times.size())));};
+    
+    QJsonObject result;
+    result["path"]     = path;
+    result["channels"] = channelsCount;
+    result["scale"]    = scale;
+    result["frames"]   = times.size();
+    result["p50_ms"]   = percentile(0.50);
+    result["p90_ms"]   = percentile(0.90);
+    result["p99_ms"]   = percentile(0.99);
+    result["max_ms"]   = times.last();
+    result["fps"]      = 1000.0 * times.size() / total;
+    
+    if (allocations && AllocationCounter::isEnabled())
+    {
+        result["steady_allocations"]         = (double) allocations->allocations / times.size();
+        result["steady_net_allocations"]     = (double) ((qint64) allocations->allocations - (qint64) allocations->frees) / times.size();
+        result["steady_painter_allocations"] = (double) painterAllocations->allocations / times.size();
+        
+        if (allocationFree && allocations->allocations > painterAllocations->allocations)
+        {
+            m_allocatingResults++;
+            fprintf(stderr, "Steady paints allocate: %s %2dch scale %d: %llu allocations besides the QPainter\n", qPrintable(path),
+                    channelsCount, scale, (unsigned long long) (allocations->allocations - painterAllocations->allocations));
+        }
+    }
+    
+    m_results.append(result);
+    
+    fprintf(stderr, "%-14s %2dch scale %8d: p50 %8.3f ms  p99 %8.3f ms  %8.1f fps\n", qPrintable(path), channelsCount, scale,
+            percentile(0.50), percentile(0.99), 1000.0 * times.size() / total);
+    
+}
+
+
+/* Count the pixels which differ between the images of both drawing paths, and add it to the report. */
+void RenderBenchmark::addComparison(int channelsCount, int scale, qint64 position, const QImage &tiles, const QImage &direct)
+{
+    
+    qint64 differingPixels = 0;
+    int    maxDifference   = 0;
+    
+    for (int y = 0; y < tiles.height(); y++)
+    {
+        const QRgb *tilesLine  = (const QRgb*) tiles.constScanLine(y);
+        const QRgb *directLine = (const QRgb*) direct.constScanLine(y);
+        
+        for (int x = 0; x < tiles.width(); x++)
+        {
+            if (tilesLine[x] == directLine[x])
+                continue;
+            
+            differingPixels++;
+            maxDifference = std::max({maxDifference,
+                                      qAbs(qRed(tilesLine[x])   - qRed(directLine[x])),
+                                      qAbs(qGreen(tilesLine[x]) - qGreen(directLine[x])),
+                                      qAbs(qBlue(tilesLine[x])  - qBlue(directLine[x])),
+                                      qAbs(qAlpha(tilesLine[x]) - qAlpha(directLine[x]))});
+        }
+    }
+    
+    QJsonObject comparison;
+    comparison["channels"]         = channelsCount;
+    comparison["scale"]            = scale;
+    comparison["position"]         = (double) position;
+    comparison["differing_pixels"] = (double) differingPixels;
+    comparison["max_difference"]   = maxDifference;
+    
+    m_comparisons.append(comparison);
+    
+    if (differingPixels > 0)
+        fprintf(stderr, "Tiles and direct drawing differ: %2dch scale %d position %lld: %lld pixels, up to %d\n",
+                channelsCount, scale, (long long) position, (long long) differingPixels, maxDifference);
+    
+}
+
+
+/* Get the scales to sweep: powers of two up to the scale at which the whole file fits the plot, and that scale. */
+QVector<int> RenderBenchmark::scales(int maximumScale)
+{
+    
+    QVector<int> scales;
+    
+    for (int scale = 1; scale < maximumScale; scale *= 2)
+        scales.append(scale);
+    
+    // 7 is the highest scale drawn with samples, 8 the lowest one drawn with tiles
+    if (maximumScale > 7)
+        scales.insert(std::lower_bound(scales.begin(), scales.end(), 7), 7);
+    scales.append(maximumScale);
+    
+    return scales;
+    
+}
+
+
+/* Render the plot into an image, and return the time it took in ms. */
+double RenderBenchmark::render(SignalPlot &plot, QImage &image)
+{
+    
+    QElapsedTimer timer;
+    timer.start();
+    
+    plot.render(&image);
+    
+    return timer.nsecsElapsed() / 1e6;
+    
+}
@@ -0,0 +1,59 @@
+#ifndef RENDERBENCHMARK_H
+#define RENDERBENCHMARK_H
+
+#include <QImage>
+#include <QJsonArray>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include "allocationcounter.h"
+
+class SignalPlot;
+
+
+/* Benchmark of the waveform drawing, started with the --render-benchmark argument
+ *
+ * A SignalPlot is created offscreen for synthetic 16-bit files of 1 to 64 channels and
+ * rendered into images, at every zoom level from 1 frame per pixel to the whole file.
+ * Each scale is drawn while scrolling like during playback (tiles reused), while jumping
+ * across the file (tiles rendered) and without the tile cache, with the columns written
+ * by the rasterizer and with QPainter lines, and the paint time percentiles and frames
+ * per second are written as JSON.
+ * The images given by the tiles and by direct drawing are also compared pixel by pixel.
+ * When built with CONFIG+=allocation_counter, the heap allocations per paint once the scrolling
+ * frames have been drawn a first time are written too, with the part made by the setup of the QPainter.
+ * Scrolling through the rasterized tiles or columns must not allocate besides that setup, or the benchmark
+ * fails; samples and columns drawn as QPainter lines are only measured, the paint engine allocates.
+ */
+class RenderBenchmark
+{
+    
+public:
+    static const char *usage;
+    
+    bool parseArguments(const QStringList &arguments);
+    int  run();
+    
+    const char* error()  {return m_error;};
+    
+private:
+    QString     m_outputPath;       // Empty for the standard output
+    bool        m_quick = false;    // Fewer frames of shorter files
+    const char *m_error = "";
+    int         m_allocatingResults = 0;  // Results of allocation-free paths whose paints allocated
+    QJsonArray  m_results;
+    QJsonArray  m_comparisons;
+    
+    void benchmarkFile(const QString &filePath, int channelsCount);
+    void addResult(const QString &path, int channelsCount, int scale, QVector<double> &times,
+                   const AllocationCounter::Counts *allocations = nullptr, const AllocationCounter::Counts *painterAllocations = nullptr,
+                   bool allocationFree = false);
+    void addComparison(int channelsCount, int scale, qint64 position, const QImage &tiles, const QImage &direct);
+    
+    static QVector<int> scales(int maximumScale);
+    static double       render(SignalPlot &plot, QImage &image);
+    
+};
+
+#endif // RENDERBENCHMARK_H
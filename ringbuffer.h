@@ -0,0 +1,114 @@
+#ifndef RINGBUFFER_H
+#define RINGBUFFER_H
+
+#include <algorithm>
+#include <cstring>
+
+#include <QAtomicInteger>
+#include <QVector>
+
+
+/* Wait-free ring buffer with a single producer thread and a single consumer thread
+ *
+ * The read and write indexes only grow: their difference is the number of elements
+ * stored, and they are wrapped with a mask since the capacity is a power of two.
+ * Each index is written by one side only, and published with release semantics
+ * once the elements it covers are copied.
+ *
+ * The producer is expected to write no more than writeAvailable() elements:
+ * elements which do not fit are dropped and counted as an overrun.
+ */
+template <typename T>
+class RingBuffer
+{
+    
+public:
+    RingBuffer(qint64 capacity = 0)  {reset(capacity);};
+    
+    // Getters
+    qint64 capacity()                {return m_buffer.size();};
+    qint64 readAvailable()           {return m_writeIndex.loadAcquire() - m_readIndex.loadAcquire();};
+    qint64 writeAvailable()          {return capacity() - readAvailable();};
+    int    overrunsCount()           {return m_overruns.loadAcquire();};
+    
+    /* Empty the buffer and change its capacity, rounded up to a power of two.
+     *
+     * Neither the producer nor the consumer may use the buffer meanwhile. */
+    void reset(qint64 capacity)
+    {
+        
+        qint64 rounded = 1;
+        while (rounded < capacity)
+            rounded <<= 1;
+        
+        m_buffer.resize(capacity > 0 ? rounded : 0);
+        m_readIndex.storeRelease(0);
+        m_writeIndex.storeRelease(0);
+        
+    }
+    
+    /* Append elements. Called from the producer thread only.
+     *
+     * It returns the number of elements written. */
+    qint64 write(const T *data, qint64 count)
+    {
+        
+        qint64 writeIndex = m_writeIndex.load();
+        qint64 written    = std::min(count, capacity() - (writeIndex - m_readIndex.loadAcquire()));
+        
+        if (written < count)
+            m_overruns.fetchAndAddRelaxed(1);
+        
+        copy(data, m_buffer.data(), writeIndex, written, true);
+        m_writeIndex.storeRelease(writeIndex + written);
+        
+        return written;
+        
+    }
+    
+    /* Remove elements from the front of the buffer. Called from the consumer thread only.
+     *
+     * It returns the number of elements read, which is smaller than count if the buffer runs out. */
+    qint64 read(T *data, qint64 count)
+    {
+        
+        qint64 readIndex = m_readIndex.load();
+        qint64 read      = std::min(count, m_writeIndex.loadAcquire() - readIndex);
+        
+        copy(m_buffer.constData(), data, readIndex, read, false);
+        m_readIndex.storeRelease(readIndex + read);
+        
+        return read;
+        
+    }
+    
+private:
+    QVector<T>             m_buffer;
+    QAtomicInteger<qint64> m_readIndex;
+    QAtomicInteger<qint64> m_writeIndex;
+    QAtomicInt             m_overruns;
+    
+    /* Copy elements to or from the buffer, in two parts if they wrap around its end. */
+    void copy(const T *from, T *to, qint64 index, qint64 count, bool toBuffer)
+    {
+        
+        qint64 mask  = capacity() - 1;
+        qint64 start = index & mask;
+        qint64 first = std::min(count, capacity() - start);
+        
+        if (toBuffer)
+        {
+            memcpy(to + start, from,         first * sizeof(T));
+            memcpy(to,         from + first, (count - first) * sizeof(T));
+        }
+        else
+        {
+            memcpy(to,         from + start, first * sizeof(T));
+            memcpy(to + first, from,         (count - first) * sizeof(T));
+        }
+        
+    }
+    
+};
+
+#endif // RINGBUFFER_H
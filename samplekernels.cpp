@@ -0,0 +1,841 @@
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
+
+#include <QVarLengthArray>
+
+#include "samplekernels.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SAMPLEKERNELS_X86
+#include <immintrin.h>
+#endif
+
+using namespace SampleKernels;
+
+
+// The SIMD kernels keep one pair of min/max accumulators per channel
+static const int maxSimdChannels = 64;
+
+
+/* Scale a floating point sample to the range of 32-bit samples. Values out of [-1, +1] are clamped, NaN gives 0. */
+static inline int floatToInt(double value)
+{
+    if (value != value)
+        return 0;
+    
+    return (int) (std::min(1.0, std::max(-1.0, value)) * 2147483647.0);
+}
+
+
+/* Clamp a processed sample to the range of its format, before it is rounded. */
+template <typename Real>
+static inline Real saturate(Real value, Real min, Real max)
+{
+    return std::min(max, std::max(min, value));
+}
+
+
+/* Write the bytesCount low bytes of a value, little endian first. */
+static inline void storeLittleEndian(quint64 value, uchar *bytes, int bytesCount)
+{
+    for (int i = 0; i < bytesCount; i++, value >>= 8)
+        bytes[i] = (uchar) value;
+}
+
+
+/* Size and decoding of the samples of each format. Samples are little endian.
+ *
+ * For processing, value() reads a sample in the arithmetic type of the format (float is exact for 8 and 16-bit
+ * samples, double for the others), without the scaling of decode(), and encode() writes it back, rounding
+ * to the nearest integer and saturating at the limits of integer formats. */
+template <SampleFormat Format> struct Sample;
+
+template <> struct Sample<UInt8>
+{
+    static const int size = 1;
+    static int decode(const uchar *sample) {return (int) sample[0] - 128;}
+    
+    typedef float Real;
+    static Real value(const uchar *sample)          {return decode(sample);}
+    static void encode(Real value, uchar *sample)   {sample[0] = (uchar) (lrintf(saturate(value, -128.0f, 127.0f)) + 128);}
+};
+
+template <> struct Sample<Int16>
+{
+    static const int size = 2;
+    static int decode(const uchar *sample) {return (qint16) (sample[0] | (sample[1] << 8));}
+    
+    typedef float Real;
+    static Real value(const uchar *sample)          {return decode(sample);}
+    static void encode(Real value, uchar *sample)   {storeLittleEndian(lrintf(saturate(value, -32768.0f, 32767.0f)), sample, 2);}
+};
+
+template <> struct Sample<Int24>
+{
+    static const int size = 3;
+    static int decode(const uchar *sample) {return (qint32) (((quint32) sample[0] << 8) | ((quint32) sample[1] << 16) | ((quint32) sample[2] << 24)) >> 8;}
+    
+    typedef double Real;
+    static Real value(const uchar *sample)          {return decode(sample);}
+    static void encode(Real value, uchar *sample)   {storeLittleEndian(llrint(saturate(value, -8388608.0, 8388607.0)), sample, 3);}
+};
+
+template <> struct Sample<Int32>
+{
+    static const int size = 4;
+    static int decode(const uchar *sample) {return (qint32) (sample[0] | (sample[1] << 8) | (sample[2] << 16) | ((quint32) sample[3] << 24));}
+    
+    typedef double Real;
+    static Real value(const uchar *sample)          {return decode(sample);}
+    static void encode(Real value, uchar *sample)   {storeLittleEndian(llrint(saturate(value, -2147483648.0, 2147483647.0)), sample, 4);}
+};
+
+template <> struct Sample<Float32>
+{
+    static const int size = 4;
+    static int decode(const uchar *sample) {return floatToInt(value(sample));}
+    
+    typedef double Real;
+    static Real value(const uchar *sample)
+    {
+        quint32 bits = sample[0] | (sample[1] << 8) | (sample[2] << 16) | ((quint32) sample[3] << 24);
+        float   value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+    static void encode(Real value, uchar *sample)
+    {
+        float   single = (float) value;
+        quint32 bits;
+        memcpy(&bits, &single, sizeof(bits));
+        storeLittleEndian(bits, sample, 4);
+    }
+};
+
+template <> struct Sample<Float64>
+{
+    static const int size = 8;
+    static int decode(const uchar *sample) {return floatToInt(value(sample));}
+    
+    typedef double Real;
+    static Real value(const uchar *sample)
+    {
+        quint64 bits = 0;
+        for (int i = 7; i >= 0; i--)
+            bits = (bits << 8) | sample[i];
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+    static void encode(Real value, uchar *sample)
+    {
+        quint64 bits;
+        memcpy(&bits, &value, sizeof(bits));
+        storeLittleEndian(bits, sample, 8);
+    }
+};
+
+
+/* Call Kernel<Format>::run with the given arguments, for the format of the samples.
+ *
+ * This is the only place where the format is tested: each kernel is compiled once per format. */
+template <template <SampleFormat> class Kernel, typename... Arguments>
+static void dispatchFormat(SampleFormat format, Arguments... arguments)
+{
+    switch (format)
+    {
+        case UInt8:   Kernel<UInt8>::run(arguments...);   break;
+        case Int16:   Kernel<Int16>::run(arguments...);   break;
+        case Int24:   Kernel<Int24>::run(arguments...);   break;
+        case Int32:   Kernel<Int32>::run(arguments...);   break;
+        case Float32: Kernel<Float32>::run(arguments...); break;
+        case Float64: Kernel<Float64>::run(arguments...); break;
+        default:      break;
+    }
+}
+
+
+/* Scalar version of minMax, also used for the frames left over by the SIMD versions. */
+template <SampleFormat Format>
+struct MinMaxScalar
+{
+    static void run(const uchar *frames, qint64 framesCount, int channelsCount, int *mins, int *maxs)
+    {
+        for (qint64 i = 0; i < framesCount; i++)
+        {
+            for (int channel = 0; channel < channelsCount; channel++, frames += Sample<Format>::size)
+            {
+                int sample    = Sample<Format>::decode(frames);
+                mins[channel] = std::min(mins[channel], sample);
+                maxs[channel] = std::max(maxs[channel], sample);
+            }
+        }
+    }
+};
+
+
+/* Scalar version of applyGain, also used for the frames left over by the SIMD version.
+ *
+ * firstFrame is the index of the first frame in the run given to applyGain, from which the gain ramps. */
+template <SampleFormat Format>
+struct ApplyGainScalar
+{
+    static void run(const uchar *in, uchar *out, qint64 framesCount, int channelsCount, const double *offsets,
+                    double startGain, double gainStep, qint64 firstFrame)
+    {
+        typedef typename Sample<Format>::Real Real;
+        
+        // Offsets are given as decoded samples: floating point samples are scaled by decode()
+        const double decodedUnit = (Format == Float32 || Format == Float64) ? 2147483647.0 : 1.0;
+        
+        QVarLengthArray<Real, 64> channelOffsets(channelsCount);
+        for (int channel = 0; channel < channelsCount; channel++)
+            channelOffsets[channel] = (Real) (offsets[channel] / decodedUnit);
+        
+        for (qint64 i = firstFrame; i < firstFrame + framesCount; i++)
+        {
+            Real gain = (Real) startGain + (Real) gainStep * (Real) i;
+            
+            for (int channel = 0; channel < channelsCount; channel++, in += Sample<Format>::size, out += Sample<Format>::size)
+                Sample<Format>::encode((Sample<Format>::value(in) - channelOffsets[channel]) * gain, out);
+        }
+    }
+};
+
+
+#ifdef SAMPLEKERNELS_X86
+
+/* Value of a lane of the accumulators, as returned for a sample. */
+static inline int laneValue(uchar lane)  {return (int) lane - 128;}
+static inline int laneValue(qint16 lane) {return lane;}
+static inline int laneValue(qint32 lane) {return lane;}
+static inline int laneValue(float lane)  {return floatToInt(lane);}
+
+
+/* Merge the lanes of the accumulators into the per-channel results.
+ *
+ * Lane l of accumulator j holds the value number j * lanesCount + l of each period,
+ * which belongs to channel (j * lanesCount + l) % channelsCount. */
+template <typename Lane>
+static void foldLanes(const Lane *lanesMin, const Lane *lanesMax, int lanesCount, int accumulator, int channelsCount, int *mins, int *maxs)
+{
+    for (int l = 0; l < lanesCount; l++)
+    {
+        int channel   = (accumulator * lanesCount + l) % channelsCount;
+        mins[channel] = std::min(mins[channel], laneValue(lanesMin[l]));
+        maxs[channel] = std::max(maxs[channel], laneValue(lanesMax[l]));
+    }
+}
+
+
+/* SSE2 min/max of 8-bit or 16-bit frames.
+ *
+ * channelsCount vectors hold exactly one frame per lane (8 frames of 16-bit samples, 16 frames of
+ * 8-bit samples), so each accumulator always sees the same channels in the same lanes.
+ * Other formats are left to the scalar version. It returns the number of frames processed. */
+__attribute__((target("sse2")))
+static qint64 minMaxSse2(const uchar *frames, qint64 framesCount, int channelsCount, SampleFormat format, int *mins, int *maxs)
+{
+    
+    if (format != UInt8 && format != Int16)
+        return 0;
+    
+    const int framesPerPeriod = (format == UInt8) ? 16 : 8;
+    qint64    periodsCount    = framesCount / framesPerPeriod;
+    
+    __m128i vmin[maxSimdChannels];
+    __m128i vmax[maxSimdChannels];
+    
+    for (int j = 0; j < channelsCount; j++)
+    {
+        vmin[j] = (format == UInt8) ? _mm_set1_epi8((char) 0xFF) : _mm_set1_epi16(32767);
+        vmax[j] = (format == UInt8) ? _mm_setzero_si128()        : _mm_set1_epi16(-32768);
+    }
+    
+    const __m128i *vectors = (const __m128i*) frames;
+    
+    if (format == UInt8)
+    {
+        for (qint64 i = 0; i < periodsCount; i++)
+        {
+            for (int j = 0; j < channelsCount; j++, vectors++)
+            {
+                __m128i v = _mm_loadu_si128(vectors);
+                vmin[j]   = _mm_min_epu8(vmin[j], v);
+                vmax[j]   = _mm_max_epu8(vmax[j], v);
+            }
+        }
+    }
+    else
+    {
+        for (qint64 i = 0; i < periodsCount; i++)
+        {
+            for (int j = 0; j < channelsCount; j++, vectors++)
+            {
+                __m128i v = _mm_loadu_si128(vectors);
+                vmin[j]   = _mm_min_epi16(vmin[j], v);
+                vmax[j]   = _mm_max_epi16(vmax[j], v);
+            }
+        }
+    }
+    
+    if (periodsCount == 0)
+        return 0;
+    
+    for (int j = 0; j < channelsCount; j++)
+    {
+        if (format == UInt8)
+        {
+            uchar lanesMin[16], lanesMax[16];
+            _mm_storeu_si128((__m128i*) lanesMin, vmin[j]);
+            _mm_storeu_si128((__m128i*) lanesMax, vmax[j]);
+            foldLanes(lanesMin, lanesMax, 16, j, channelsCount, mins, maxs);
+        }
+        else
+        {
+            qint16 lanesMin[8], lanesMax[8];
+            _mm_storeu_si128((__m128i*) lanesMin, vmin[j]);
+            _mm_storeu_si128((__m128i*) lanesMax, vmax[j]);
+            foldLanes(lanesMin, lanesMax, 8, j, channelsCount, mins, maxs);
+        }
+    }
+    
+    return periodsCount * framesPerPeriod;
+    
+}
+
+
+/* AVX2 version of minMaxSse2, with vectors twice as wide.
+ *
+ * It also handles 32-bit integer and floating point samples, 8 frames per period. Floating point
+ * values are reduced as they are, which gives the same result as scaling each sample, since scaling is monotonic. */
+__attribute__((target("avx2")))
+static qint64 minMaxAvx2(const uchar *frames, qint64 framesCount, int channelsCount, SampleFormat format, int *mins, int *maxs)
+{
+    
+    if (format == Int24 || format == Float64)
+        return 0;
+    
+    const int framesPerPeriod = (format == UInt8) ? 32 : (format == Int16) ? 16 : 8;
+    qint64    periodsCount    = framesCount / framesPerPeriod;
+    
+    __m256i vmin[maxSimdChannels];
+    __m256i vmax[maxSimdChannels];
+    
+    for (int j = 0; j < channelsCount; j++)
+    {
+        switch (format)
+        {
+            case UInt8:
+                vmin[j] = _mm256_set1_epi8((char) 0xFF);
+                vmax[j] = _mm256_setzero_si256();
+                break;
+            case Int16:
+                vmin[j] = _mm256_set1_epi16(32767);
+                vmax[j] = _mm256_set1_epi16(-32768);
+                break;
+            case Int32:
+                vmin[j] = _mm256_set1_epi32(INT_MAX);
+                vmax[j] = _mm256_set1_epi32(INT_MIN);
+                break;
+            default:  // Float32
+                vmin[j] = _mm256_castps_si256(_mm256_set1_ps(+INFINITY));
+                vmax[j] = _mm256_castps_si256(_mm256_set1_ps(-INFINITY));
+                break;
+        }
+    }
+    
+    const __m256i *vectors = (const __m256i*) frames;
+    
+    // One loop per format, so that the format is not tested in the loops
+    if (format == UInt8)
+    {
+        for (qint64 i = 0; i < periodsCount; i++)
+        {
+            for (int j = 0; j < channelsCount; j++, vectors++)
+            {
+                __m256i v = _mm256_loadu_si256(vectors);
+                vmin[j]   = _mm256_min_epu8(vmin[j], v);
+                vmax[j]   = _mm256_max_epu8(vmax[j], v);
+            }
+        }
+    }
+    else if (format == Int16)
+    {
+        for (qint64 i = 0; i < periodsCount; i++)
+        {
+            for (int j = 0; j < channelsCount; j++, vectors++)
+            {
+                __m256i v = _mm256_loadu_si256(vectors);
+                vmin[j]   = _mm256_min_epi16(vmin[j], v);
+                vmax[j]   = _mm256_max_epi16(vmax[j], v);
+            }
+        }
+    }
+    else if (format == Int32)
+    {
+        for (qint64 i = 0; i < periodsCount; i++)
+        {
+            for (int j = 0; j < channelsCount; j++, vectors++)
+            {
+                __m256i v = _mm256_loadu_si256(vectors);
+                vmin[j]   = _mm256_min_epi32(vmin[j], v);
+                vmax[j]   = _mm256_max_epi32(vmax[j], v);
+            }
+        }
+    }
+    else
+    {
+        for (qint64 i = 0; i < periodsCount; i++)
+        {
+            for (int j = 0; j < channelsCount; j++, vectors++)
+            {
+                // NaN samples count as silence, as in floatToInt
+                __m256 v = _mm256_loadu_ps((const float*) vectors);
+                v        = _mm256_and_ps(v, _mm256_cmp_ps(v, v, _CMP_ORD_Q));
+                vmin[j]  = _mm256_castps_si256(_mm256_min_ps(v, _mm256_castsi256_ps(vmin[j])));
+                vmax[j]  = _mm256_castps_si256(_mm256_max_ps(v, _mm256_castsi256_ps(vmax[j])));
+            }
+        }
+    }
+    
+    if (periodsCount == 0)
+        return 0;
+    
+    for (int j = 0; j < channelsCount; j++)
+    {
+        if (format == UInt8)
+        {
+            uchar lanesMin[32], lanesMax[32];
+            _mm256_storeu_si256((__m256i*) lanesMin, vmin[j]);
+            _mm256_storeu_si256((__m256i*) lanesMax, vmax[j]);
+            foldLanes(lanesMin, lanesMax, 32, j, channelsCount, mins, maxs);
+        }
+        else if (format == Int16)
+        {
+            qint16 lanesMin[16], lanesMax[16];
+            _mm256_storeu_si256((__m256i*) lanesMin, vmin[j]);
+            _mm256_storeu_si256((__m256i*) lanesMax, vmax[j]);
+            foldLanes(lanesMin, lanesMax, 16, j, channelsCount, mins, maxs);
+        }
+        else if (format == Int32)
+        {
+            qint32 lanesMin[8], lanesMax[8];
+            _mm256_storeu_si256((__m256i*) lanesMin, vmin[j]);
+            _mm256_storeu_si256((__m256i*) lanesMax, vmax[j]);
+            foldLanes(lanesMin, lanesMax, 8, j, channelsCount, mins, maxs);
+        }
+        else
+        {
+            float lanesMin[8], lanesMax[8];
+            _mm256_storeu_si256((__m256i*) lanesMin, vmin[j]);
+            _mm256_storeu_si256((__m256i*) lanesMax, vmax[j]);
+            foldLanes(lanesMin, lanesMax, 8, j, channelsCount, mins, maxs);
+        }
+    }
+    
+    return periodsCount * framesPerPeriod;
+    
+}
+
+/* SSE2 version of applyGain for 16-bit frames of 1, 2, 4 or 8 channels.
+ *
+ * A vector of 8 samples then holds whole frames, with the same channel in the same lanes of every vector.
+ * Samples are widened to 32 bits and processed as floats with the same operations as the scalar version,
+ * in the same order: the results are identical. Values are clamped before the conversion, and packed back
+ * with signed saturation. Other formats and channel counts are left to the scalar version.
+ * It returns the number of frames processed. */
+__attribute__((target("sse2")))
+static qint64 applyGainSse2(const uchar *in, uchar *out, qint64 framesCount, int channelsCount, SampleFormat format,
+                            const double *offsets, double startGain, double gainStep)
+{
+    
+    if (format != Int16 || 8 % channelsCount != 0)
+        return 0;
+    
+    const int framesPerVector = 8 / channelsCount;
+    qint64    vectorsCount    = framesCount / framesPerVector;
+    
+    // Channel and frame (relative to the first frame of the vector) of each lane
+    float offsetsLow[4], offsetsHigh[4];
+    int   framesLow[4],  framesHigh[4];
+    
+    for (int l = 0; l < 4; l++)
+    {
+        offsetsLow[l]  = (float) offsets[l % channelsCount];
+        offsetsHigh[l] = (float) offsets[(l + 4) % channelsCount];
+        framesLow[l]   = l / channelsCount;
+        framesHigh[l]  = (l + 4) / channelsCount;
+    }
+    
+    const __m128  vOffsetsLow  = _mm_loadu_ps(offsetsLow);
+    const __m128  vOffsetsHigh = _mm_loadu_ps(offsetsHigh);
+    const __m128i vFramesLow   = _mm_loadu_si128((const __m128i*) framesLow);
+    const __m128i vFramesHigh  = _mm_loadu_si128((const __m128i*) framesHigh);
+    const __m128  vStartGain   = _mm_set1_ps((float) startGain);
+    const __m128  vGainStep    = _mm_set1_ps((float) gainStep);
+    const __m128  vMin         = _mm_set1_ps(-32768.0f);
+    const __m128  vMax         = _mm_set1_ps(32767.0f);
+    
+    const __m128i *inVectors  = (const __m128i*) in;
+    __m128i       *outVectors = (__m128i*) out;
+    
+    for (qint64 i = 0; i < vectorsCount; i++)
+    {
+        __m128i v     = _mm_loadu_si128(inVectors + i);
+        __m128i first = _mm_set1_epi32((int) (i * framesPerVector));
+        
+        // Sign-extend the 16-bit samples: each one is put in the high half of a 32-bit lane, then shifted down
+        __m128 low  = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+        __m128 high = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16));
+        
+        __m128 gainLow  = _mm_add_ps(vStartGain, _mm_mul_ps(vGainStep, _mm_cvtepi32_ps(_mm_add_epi32(first, vFramesLow))));
+        __m128 gainHigh = _mm_add_ps(vStartGain, _mm_mul_ps(vGainStep, _mm_cvtepi32_ps(_mm_add_epi32(first, vFramesHigh))));
+        
+        low  = _mm_mul_ps(_mm_sub_ps(low,  vOffsetsLow),  gainLow);
+        high = _mm_mul_ps(_mm_sub_ps(high, vOffsetsHigh), gainHigh);
+        low  = _mm_min_ps(vMax, _mm_max_ps(vMin, low));
+        high = _mm_min_ps(vMax, _mm_max_ps(vMin, high));
+        
+        _mm_storeu_si128(outVectors + i, _mm_packs_epi32(_mm_cvtps_epi32(low), _mm_cvtps_epi32(high)));
+    }
+    
+    return vectorsCount * framesPerVector;
+    
+}
+
+#endif // SAMPLEKERNELS_X86
+
+
+typedef qint64 (*MinMaxKernel)(const uchar*, qint64, int, SampleFormat, int*, int*);
+typedef qint64 (*GainKernel)(const uchar*, uchar*, qint64, int, SampleFormat, const double*, double, double);
+
+struct KernelDispatch
+{
+    MinMaxKernel kernel;
+    GainKernel   gainKernel;
+    const char  *name;
+};
+
+
+/* Kernels used when no SIMD instruction set is available: all the frames are left to the scalar versions. */
+static qint64 minMaxNone(const uchar*, qint64, int, SampleFormat, int*, int*)
+{
+    return 0;
+}
+
+static qint64 applyGainNone(const uchar*, uchar*, qint64, int, SampleFormat, const double*, double, double)
+{
+    return 0;
+}
+
+
+/* Choose the best kernel for the CPU we are running on, the first time a kernel is needed. */
+static const KernelDispatch& dispatch()
+{
+    
+    static const KernelDispatch selected = []() -> KernelDispatch
+    {
+#ifdef SAMPLEKERNELS_X86
+        __builtin_cpu_init();
+        
+        if (__builtin_cpu_supports("avx2"))
+            return {minMaxAvx2, applyGainSse2, "avx2"};
+        if (__builtin_cpu_supports("sse2"))
+            return {minMaxSse2, applyGainSse2, "sse2"};
+#endif
+        return {minMaxNone, applyGainNone, "scalar"};
+    }();
+    
+    return selected;
+    
+}
+
+
+/* Min/max of a single channel, reading one sample per frame. */
+template <SampleFormat Format>
+struct MinMaxChannel
+{
+    static void run(const uchar *frames, qint64 framesCount, int channelsCount, int channelIndex, int *min, int *max)
+    {
+        int bytesPerFrame = channelsCount * Sample<Format>::size;
+        int channelMin    = *min;
+        int channelMax    = *max;
+        
+        frames += channelIndex * Sample<Format>::size;
+        
+        for (qint64 i = 0; i < framesCount; i++, frames += bytesPerFrame)
+        {
+            int sample = Sample<Format>::decode(frames);
+            channelMin = std::min(channelMin, sample);
+            channelMax = std::max(channelMax, sample);
+        }
+        
+        *min = channelMin;
+        *max = channelMax;
+    }
+};
+
+
+/* Samples of a single channel, reading one sample per frame. */
+template <SampleFormat Format>
+struct DecodeChannel
+{
+    static void run(const uchar *frames, qint64 framesCount, int channelsCount, int channelIndex, int *samples)
+    {
+        int bytesPerFrame = channelsCount * Sample<Format>::size;
+        
+        frames += channelIndex * Sample<Format>::size;
+        
+        for (qint64 i = 0; i < framesCount; i++, frames += bytesPerFrame)
+            samples[i] = Sample<Format>::decode(frames);
+    }
+};
+
+
+/* Samples of all the channels, decoded into one run per channel. */
+template <SampleFormat Format>
+struct Deinterleave
+{
+    static void run(const uchar *frames, qint64 framesCount, int channelsCount, int *samples, qint64 channelStride)
+    {
+        for (qint64 i = 0; i < framesCount; i++)
+        {
+            for (int channel = 0; channel < channelsCount; channel++, frames += Sample<Format>::size)
+                samples[channel * channelStride + i] = Sample<Format>::decode(frames);
+        }
+    }
+};
+
+
+/* Highest absolute value of all the samples. Floating point values are scaled as by decode(), but not clamped. */
+template <SampleFormat Format>
+struct Peak
+{
+    static void run(const uchar *frames, qint64 framesCount, int channelsCount, double *peak)
+    {
+        const double decodedUnit = (Format == Float32 || Format == Float64) ? 2147483647.0 : 1.0;
+        
+        double highest = 0;
+        
+        for (qint64 i = 0; i < framesCount * channelsCount; i++, frames += Sample<Format>::size)
+            highest = std::max<double>(highest, std::abs(Sample<Format>::value(frames)));  // NaN compares false: it is skipped
+        
+        *peak = highest * decodedUnit;
+    }
+};
+
+
+/* Value of full scale in the units of Sample<Format>::value. */
+template <SampleFormat Format>
+static inline double fullScale()
+{
+    return (Format == Float32 || Format == Float64) ? 1.0 : std::ldexp(1.0, 8 * Sample<Format>::size - 1);
+}
+
+
+/* Samples converted to the format Out, from any format given to run. */
+template <SampleFormat Out>
+struct ConvertTo
+{
+    template <SampleFormat In>
+    struct From
+    {
+        static void run(const uchar *in, uchar *out, qint64 samplesCount)
+        {
+            const double scale = fullScale<Out>() / fullScale<In>();
+            
+            for (qint64 i = 0; i < samplesCount; i++, in += Sample<In>::size, out += Sample<Out>::size)
+            {
+                double value = Sample<In>::value(in);
+                
+                // NaN samples are silence, as in decode()
+                if (value != value)
+                    value = 0;
+                
+                Sample<Out>::encode((typename Sample<Out>::Real) (value * scale), out);
+            }
+        }
+    };
+    
+    static void run(const uchar *in, SampleFormat inFormat, uchar *out, qint64 samplesCount)
+    {
+        dispatchFormat<From>(inFormat, in, out, samplesCount);
+    }
+};
+
+
+SampleFormat SampleKernels::format(int formatTag, int bitDepth)
+{
+    
+    const int pcm       = 1;  // WAVE_FORMAT_PCM
+    const int ieeeFloat = 3;  // WAVE_FORMAT_IEEE_FLOAT
+    
+    if (formatTag == pcm)
+    {
+        switch (bitDepth)
+        {
+            case 8:  return UInt8;
+            case 16: return Int16;
+            case 24: return Int24;
+            case 32: return Int32;
+        }
+    }
+    else if (formatTag == ieeeFloat)
+    {
+        switch (bitDepth)
+        {
+            case 32: return Float32;
+            case 64: return Float64;
+        }
+    }
+    
+    return InvalidFormat;
+    
+}
+
+
+int SampleKernels::sampleSize(SampleFormat format)
+{
+    
+    switch (format)
+    {
+        case UInt8:   return Sample<UInt8>::size;
+        case Int16:   return Sample<Int16>::size;
+        case Int24:   return Sample<Int24>::size;
+        case Int32:   return Sample<Int32>::size;
+        case Float32: return Sample<Float32>::size;
+        case Float64: return Sample<Float64>::size;
+        default:      return 0;
+    }
+    
+}
+
+
+int SampleKernels::significantBits(SampleFormat format)
+{
+    
+    switch (format)
+    {
+        case UInt8: return 8;
+        case Int16: return 16;
+        case Int24: return 24;
+        default:    return 32;
+    }
+    
+}
+
+
+const char* SampleKernels::formatName(SampleFormat format)
+{
+    
+    switch (format)
+    {
+        case UInt8:   return "uint8";
+        case Int16:   return "int16";
+        case Int24:   return "int24";
+        case Int32:   return "int32";
+        case Float32: return "float32";
+        case Float64: return "float64";
+        default:      return "invalid";
+    }
+    
+}
+
+
+SampleKernels::SampleDecoder SampleKernels::sampleDecoder(SampleFormat format)
+{
+    
+    switch (format)
+    {
+        case UInt8:   return Sample<UInt8>::decode;
+        case Int16:   return Sample<Int16>::decode;
+        case Int24:   return Sample<Int24>::decode;
+        case Int32:   return Sample<Int32>::decode;
+        case Float32: return Sample<Float32>::decode;
+        case Float64: return Sample<Float64>::decode;
+        default:      return nullptr;
+    }
+    
+}
+
+
+void SampleKernels::minMax(const uchar *frames, qint64 framesCount, int channelsCount, SampleFormat format, int *mins, int *maxs)
+{
+    
+    qint64 processed = 0;
+    
+    if (channelsCount <= maxSimdChannels)
+        processed = dispatch().kernel(frames, framesCount, channelsCount, format, mins, maxs);
+    
+    // The frames which do not fill a whole SIMD period are processed one by one
+    dispatchFormat<MinMaxScalar>(format, frames + processed * channelsCount * sampleSize(format), framesCount - processed, channelsCount, mins, maxs);
+    
+}
+
+
+void SampleKernels::minMaxChannel(const uchar *frames, qint64 framesCount, int channelsCount, SampleFormat format, int channelIndex, int &min, int &max)
+{
+    dispatchFormat<MinMaxChannel>(format, frames, framesCount, channelsCount, channelIndex, &min, &max);
+}
+
+
+void SampleKernels::decodeChannel(const uchar *frames, qint64 framesCount, int channelsCount, SampleFormat format, int channelIndex, int *samples)
+{
+    dispatchFormat<DecodeChannel>(format, frames, framesCount, channelsCount, channelIndex, samples);
+}
+
+
+void SampleKernels::deinterleave(const uchar *frames, qint64 framesCount, int channelsCount, SampleFormat format, int *samples, qint64 channelStride)
+{
+    dispatchFormat<Deinterleave>(format, frames, framesCount, channelsCount, samples, channelStride);
+}
+
+
+/* The same format is copied as it is. */
+void SampleKernels::convert(const uchar *in, SampleFormat inFormat, uchar *out, SampleFormat outFormat, qint64 samplesCount)
+{
+    
+    if (inFormat == outFormat)
+    {
+        memcpy(out, in, samplesCount * sampleSize(inFormat));
+        return;
+    }
+    
+    dispatchFormat<ConvertTo>(outFormat, in, inFormat, out, samplesCount);
+    
+}
+
+
+double SampleKernels::peak(const uchar *frames, qint64 framesCount, int channelsCount, SampleFormat format)
+{
+    
+    double peak = 0;
+    
+    dispatchFormat<Peak>(format, frames, framesCount, channelsCount, &peak);
+    
+    return peak;
+    
+}
+
+
+/* The frames may be processed in place: each vector or sample is read before it is written. */
+void SampleKernels::applyGain(const uchar *in, uchar *out, qint64 framesCount, int channelsCount, SampleFormat format,
+                              const double *offsets, double startGain, double gainStep)
+{
+    
+    qint64 processed = dispatch().gainKernel(in, out, framesCount, channelsCount, format, offsets, startGain, gainStep);
+    qint64 skipped   = processed * channelsCount * sampleSize(format);
+    
+    dispatchFormat<ApplyGainScalar>(format, in + skipped, out + skipped, framesCount - processed, channelsCount, offsets,
+                                    startGain, gainStep, processed);
+    
+}
+
+
+const char* SampleKernels::instructionSet()
+{
+    return dispatch().name;
+}
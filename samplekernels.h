@@ -0,0 +1,73 @@
+#ifndef SAMPLEKERNELS_H
+#define SAMPLEKERNELS_H
+
+#include <QtGlobal>
+
+
+/* Low-level routines which work on runs of raw interleaved audio frames
+ *
+ * Each routine is a template instantiated for every sample format, chosen once per
+ * run of frames: there is no branch on the format in the loops over the samples.
+ * The min/max reduction has SSE2 and AVX2 implementations on x86, chosen once
+ * at run time depending on the CPU, and a scalar fallback for other platforms.
+ *
+ * Samples are returned as ints: 8-bit samples, which are unsigned in WAV files, are
+ * centered on 0, other integer samples keep their range, and floating point samples
+ * (nominally between -1 and +1) are scaled to the range of 32-bit samples and clamped.
+ *
+ * Samples can also be processed in place by applyGain, which has an SSE2 implementation for 16-bit samples.
+ */
+namespace SampleKernels
+{
+    enum SampleFormat
+    {
+        UInt8,
+        Int16,
+        Int24,    // Packed on 3 bytes
+        Int32,
+        Float32,
+        Float64,
+        InvalidFormat
+    };
+    
+    // Get the format of the samples of a WAV file from its format tag and bit depth (InvalidFormat if unsupported)
+    SampleFormat format(int formatTag, int bitDepth);
+    
+    int         sampleSize(SampleFormat format);     // Bytes per sample
+    int         significantBits(SampleFormat format); // Bits of the values returned for the samples
+    const char* formatName(SampleFormat format);
+    
+    // Decode a single sample
+    typedef int (*SampleDecoder)(const uchar *sample);
+    SampleDecoder sampleDecoder(SampleFormat format);
+    
+    // Update per-channel min/max with the samples of a run of frames (mins and maxs hold channelsCount values)
+    void minMax(const uchar *frames, qint64 framesCount, int channelsCount, SampleFormat format, int *mins, int *maxs);
+    
+    // Update the min/max of a single channel with the samples of a run of frames
+    void minMaxChannel(const uchar *frames, qint64 framesCount, int channelsCount, SampleFormat format, int channelIndex, int &min, int &max);
+    
+    // Decode the samples of a single channel from a run of frames
+    void decodeChannel(const uchar *frames, qint64 framesCount, int channelsCount, SampleFormat format, int channelIndex, int *samples);
+    
+    // Decode the samples of all the channels of a run of frames, the samples of channel c starting at samples + c * channelStride
+    void deinterleave(const uchar *frames, qint64 framesCount, int channelsCount, SampleFormat format, int *samples, qint64 channelStride);
+    
+    // Highest absolute value of the samples of a run of frames, as a decoded sample but without clamping
+    // floating point samples to full scale (NaN samples are ignored)
+    double peak(const uchar *frames, qint64 framesCount, int channelsCount, SampleFormat format);
+    
+    // Process the samples of a run of frames: sample = (sample - offsets[channel]) * (startGain + i * gainStep) for frame i.
+    // Offsets are given as decoded samples. Integer results are rounded and saturated. out may be the same as in
+    void applyGain(const uchar *in, uchar *out, qint64 framesCount, int channelsCount, SampleFormat format,
+                   const double *offsets, double startGain, double gainStep);
+    
+    // Convert the samples of a run of frames to another format, full scale to full scale. Integer results are rounded
+    // and saturated, floating point results are not clamped
+    void convert(const uchar *in, SampleFormat inFormat, uchar *out, SampleFormat outFormat, qint64 samplesCount);
+    
+    // Name of the instruction set used by minMax ("avx2", "sse2" or "scalar")
+    const char* instructionSet();
+}
+
+#endif // SAMPLEKERNELS_H
@@ -1,8 +1,10 @@
+#include <algorithm>
 #include <cmath>
 
 #include <QVector>
 
 #include "signalplot.h"
+#include "waveformrasterizer.h"
 
 
 /* The class constructor only takes care of UI aspects */
@@ -25,32 +27,44 @@ SignalPlot::SignalPlot(QWidget *parent) : QWidget(parent)
     layout->addWidget(loadFileLabel);
     setLayout(layout);
     
+    // Spectrogram tiles are computed by worker threads, repaint when some are ready
+    connect(&m_spectrogram, SIGNAL(tilesUpdated()), this, SLOT(update()));
+    
+    // Pen and brush of the plot, created once: setting their color at each paint would allocate their data
+    m_backgroundBrush = QBrush("#ffffff");
+    m_wavePen.setColor(QColor(5, 31, 41));
+    m_wavePen.setWidth(3);
+    m_wavePen.setCosmetic(true);
+    
 }
 
 
-/* Prepare the plot area and loads information from the WavBuffer and the QMediaPlayer.
+/* Prepare the plot area and loads information from the WavBuffer and the AudioEngine.
  *
  * This method is called from the main window as soon as an audio file was loaded. */
-void SignalPlot::preparePlot(WavBuffer *audioSource, QMediaPlayer *mediaPlayer)
+void SignalPlot::preparePlot(WavBuffer *audioSource, AudioEngine *audioPlayer)
 {
 
     loadFileLabel->setVisible(false);
     
     fileLoaded    = true;
     m_audioSource = audioSource;
-    m_audioPlayer = mediaPlayer;
+    m_audioPlayer = audioPlayer;
+    m_spectrogram.setAudioSource(audioSource);
     
-    // 8-bit samples are unsigned from 0 to 255
-    if (m_audioSource->bitDepth() == 8)
+    // 8-bit samples are unsigned from 0 to 255, they are centered on 0 by the WavBuffer
+    if (m_audioSource->sampleFormat() == SampleKernels::UInt8)
     {
-        m_minValue = 0;
-        m_maxValue = 255;
+        m_minValue   = -128;
+        m_maxValue   = +127;
+        m_valueShift = 0;
     }
-    // 16-bit samples are signed from -32768 to +32767
-    else if (m_audioSource->bitDepth() == 16)
+    // Other samples are drawn in the range of 16-bit samples, from -32768 to +32767 (the window size is an int)
+    else
     {
-        m_minValue = -32768;
-        m_maxValue = +32767;
+        m_minValue   = -32768;
+        m_maxValue   = +32767;
+        m_valueShift = SampleKernels::significantBits(m_audioSource->sampleFormat()) - 16;
     }
     
     update();  // Trigger a paintEvent
@@ -61,7 +75,11 @@ void SignalPlot::preparePlot(WavBuffer *audioSource, QMediaPlayer *mediaPlayer)
 /* Main method of the class.
  *
  * It is responsible for the actual drawing of the audio waveform.
- * It is called automatically at run time whenever a re-drawing is needed. */
+ * It is called automatically at run time whenever a re-drawing is needed.
+ * The allocations of the whole paint are counted, including those of the QPainter itself (see lastPaintAllocations).
+ * Once the tiles and buffers they need exist, the min/max columns written by the rasterizer (above scale 7)
+ * are drawn without any allocation besides those of the QPainter. This does not hold for the samples
+ * drawn as lines at the lowest scales, nor for the columns drawn as lines: the paint engine allocates. */
 void SignalPlot::paintEvent(__attribute__((unused)) QPaintEvent *event)
 {
     
@@ -69,14 +87,14 @@ void SignalPlot::paintEvent(__attribute__((unused)) QPaintEvent *event)
     if (fileLoaded)
     {
         
+        AllocationCounter::Counts countsBefore = AllocationCounter::counts();
+        
         // Set colors and aspect of the plot
         QPainter painter(this);
-        painter.setBrush(QBrush("#ffffff"));
         
-        QPen pen;
-        pen.setColor(QColor(5, 31, 41));
-        pen.setWidth(3);
-        pen.setCosmetic(true);
+        m_lastPainterAllocations = AllocationCounter::counts() - countsBefore;
+        
+        painter.setBrush(m_backgroundBrush);
         painter.setRenderHint(QPainter::Antialiasing);
         
         // Calculate the dimensions of subplots (one subplot per audio channel)
@@ -85,12 +103,30 @@ void SignalPlot::paintEvent(__attribute__((unused)) QPaintEvent *event)
         int subplotHeight = (height() - padding * (m_audioSource->channelsCount() + 1)) / m_audioSource->channelsCount();
         
         // Store subplot coordinates which will be needed in case of cut area selection
-        m_CoordTopFirstSubplot   = new QPoint(padding,                padding);
-        m_CoordBottomLastSubplot = new QPoint(padding + subplotWidth, m_audioSource->channelsCount() * (padding + subplotHeight));
+        m_CoordTopFirstSubplot   = QPoint(padding,                padding);
+        m_CoordBottomLastSubplot = QPoint(padding + subplotWidth, m_audioSource->channelsCount() * (padding + subplotHeight));
+        
+        // Let the peak computation know which frames are displayed
+        if (m_positionSample != m_visibleStart || m_positionSample + (qint64) subplotWidth * m_scale != m_visibleEnd)
+        {
+            m_visibleStart = m_positionSample;
+            m_visibleEnd   = m_positionSample + (qint64) subplotWidth * m_scale;
+            emit visibleRangeChanged(m_visibleStart, m_visibleEnd);
+        }
+        
+        // With the spectrogram, the waveform only takes the upper half of the subplots
+        int waveformHeight = m_spectrogramVisible ? subplotHeight / 2 : subplotHeight;
         
-        // Initialize variables to store min and max samples values for a given audio region
-        int min = 0;
-        int max = 0;
+        m_tiles.setTileHeight(waveformHeight);
+        
+        if (m_spectrogramVisible)
+        {
+            qint64 firstColumn = m_positionSample / m_scale;
+            
+            m_spectrogram.setTileHeight(subplotHeight - waveformHeight);
+            m_spectrogram.setVisibleTiles(m_scale, firstColumn / WaveformTileCache::tileWidth,
+                                          (firstColumn + subplotWidth - 1) / WaveformTileCache::tileWidth);
+        }
         
         // Paint the waveforms
         for (int i = 0; i < m_audioSource->channelsCount(); i++)  // for each channel
@@ -100,68 +136,313 @@ void SignalPlot::paintEvent(__attribute__((unused)) QPaintEvent *event)
             painter.setViewport(padding,
                                 padding + i * (padding + subplotHeight),
                                 subplotWidth,
-                                subplotHeight);
+                                waveformHeight);
 
-            painter.setWindow(0, 1.1 * (m_maxValue), subplotWidth * m_scale, 1.1 * (m_minValue - m_maxValue + 1));
+            // One window unit per sample when samples are drawn, per pixel column otherwise (frame numbers may not fit an int)
+            int windowWidth = (m_scale > 7) ? subplotWidth : subplotWidth * m_scale;
+            painter.setWindow(0, 1.1 * (m_maxValue), windowWidth, 1.1 * (m_minValue - m_maxValue + 1));
             
             
             // Draw the white frame in which samples are painted
             painter.drawRect(painter.window());
             
-            painter.setPen(pen);
+            painter.setPen(m_wavePen);
             
             // We draw each audio sample only if the resolution is high/the scale is low
             // Otherwise, we just draw the minimum and maximum sample of an audio block
             if (m_scale > 7)
             {
-                // Draw the minimum and maximum sample of the considered audio block
-                for (int j = 0; j < subplotWidth; j++)
-                {
-                    // Prevent accessing an out-of-range index
-                    if (m_positionSample + j * m_scale < m_audioSource->framesCount())
-                    {
-                        m_audioSource->getMinMaxSampleValueInRange(m_positionSample + j * m_scale, m_scale, i, min, max);
-                        painter.drawLine(QLine(j * m_scale, min, j * m_scale, max));
-                    }
-                }
+                // The min/max columns are rendered once in tiles, which are reused while scrolling
+                if (m_tileCacheEnabled)
+                    drawTiles(painter, i, QRect(padding, padding + i * (padding + subplotHeight), subplotWidth, waveformHeight));
+                else
+                    drawColumns(painter, i, QRect(padding, padding + i * (padding + subplotHeight), subplotWidth, waveformHeight));
             }
             else
             {
                 
-                int currentSample = 0;
-                int nextSample    = 0;
+                // Decode all audio samples of the considered audio block at once (readSamples stops at the end of the audio)
+                m_samples.resize(subplotWidth * m_scale + 1);
+                m_lines.resize(m_samples.size() - 1);
+                int samplesCount = m_audioSource->readSamples(m_positionSample, m_samples.size(), i, m_samples.data());
+                
+                // The lines are given to the painter at once, from a buffer kept between paints
+                for (int j = 0; j + 1 < samplesCount; j++)
+                    m_lines[j] = QLine(j, m_samples[j] >> m_valueShift, (j + 1), m_samples[j + 1] >> m_valueShift);
                 
-                // Draw all audio samples of the considered audio block
-                for (int j = 0; j < subplotWidth * m_scale; j++)
-                {
-                    // Prevent accessing an out-of-range index
-                    if (m_positionSample + j + 1 < m_audioSource->framesCount())
-                    {
-                    
-                        currentSample = m_audioSource->getSample(m_positionSample + j, i);
-                        nextSample    = m_audioSource->getSample(m_positionSample + j + 1, i);
-                        
-                        painter.drawLine(QLine(j, currentSample, (j + 1) , nextSample));
-                        
-                    }
-                }
+                if (samplesCount > 1)
+                    painter.drawLines(m_lines.constData(), samplesCount - 1);
             }
             
             painter.setPen(Qt::NoPen);  // Reset the pen for the next drawRect call in a future paintEvent
             
+            if (m_spectrogramVisible)
+                drawSpectrogram(painter, i, QRect(padding, padding + i * (padding + subplotHeight) + waveformHeight,
+                                                  subplotWidth, subplotHeight - waveformHeight));
+            
             
             // Re-draw the audio selection rectangle if needed
             if (selectionArea)
             {
                 QRect newGeometry = selectionArea->geometry();
-                newGeometry.setHeight(m_CoordBottomLastSubplot->y() - m_CoordTopFirstSubplot->y());
+                newGeometry.setHeight(m_CoordBottomLastSubplot.y() - m_CoordTopFirstSubplot.y());
                 selectionArea->setGeometry(newGeometry);
             }
         
         }
         
+        m_lastPaintAllocations = AllocationCounter::counts() - countsBefore;
+        
     }
+    
+}
 
+
+/* Draw the min/max columns of a channel from the tile cache, rendering the missing tiles.
+ *
+ * Tiles are aligned on multiples of tileWidth columns from the start of the audio,
+ * so the same tiles are used whatever the position. */
+void SignalPlot::drawTiles(QPainter &painter, int channelIndex, const QRect &subplot)
+{
+    
+    const int tileWidth   = WaveformTileCache::tileWidth;
+    qint64    firstColumn = m_positionSample / m_scale;
+    qint64    firstTile   = firstColumn / tileWidth;
+    qint64    lastTile    = (firstColumn + subplot.width() - 1) / tileWidth;
+    
+    // Tiles are drawn in device coordinates, only their part inside the subplot: clipping would allocate a new painter state
+    painter.setViewTransformEnabled(false);
+    
+    for (qint64 tile = firstTile; tile <= lastTile; tile++)
+    {
+        // Nothing to draw after the end of the audio
+        if (tile * tileWidth * m_scale >= m_audioSource->framesCount())
+            break;
+        
+        int     x      = subplot.x() + (int) (tile * tileWidth - firstColumn);
+        int     left   = std::max(x, subplot.x());
+        int     right  = std::min(x + tileWidth, subplot.x() + subplot.width());
+        QRect   source = QRect(tileMargin + left - x, 0, right - left, subplot.height());
+        QImage *image  = m_tiles.tile(channelIndex, m_scale, tile);
+        
+        if (image)
+        {
+            painter.drawImage(left, subplot.y(), *image, source.x(), source.y(), source.width(), source.height());
+        }
+        else
+        {
+            // Tiles with blocks whose peaks are still being computed are not kept, they will be rendered again
+            bool   complete;
+            QImage rendered = renderTile(channelIndex, tile, subplot.height(), complete);
+            
+            painter.drawImage(left, subplot.y(), rendered, source.x(), source.y(), source.width(), source.height());
+            
+            if (complete)
+                m_tiles.insert(channelIndex, m_scale, tile, rendered);
+        }
+    }
+    
+    painter.setViewTransformEnabled(true);
+    
+}
+
+
+/* Render the min/max columns of a tile of a channel into a transparent image.
+ *
+ * The image has tileMargin more columns on each side: the pen of the columns next to the
+ * tile spreads over its edges, so that tiles put side by side look like a single drawing.
+ * complete is set to false if some columns could not be drawn because their peaks are not computed yet. */
+QImage SignalPlot::renderTile(int channelIndex, qint64 tileIndex, int height, bool &complete)
+{
+    
+    const int tileWidth = WaveformTileCache::tileWidth;
+    
+    QImage image(tileWidth + 2 * tileMargin, height, QImage::Format_ARGB32_Premultiplied);
+    image.fill(Qt::transparent);
+    complete = true;
+    
+    if (m_rasterizerEnabled)
+    {
+        rasterizeColumns(image, channelIndex, tileIndex * tileWidth - tileMargin, tileWidth + 2 * tileMargin, complete);
+        return image;
+    }
+    
+    QPainter painter(&image);
+    painter.setRenderHint(QPainter::Antialiasing);
+    painter.setWindow(-tileMargin, 1.1 * (m_maxValue), tileWidth + 2 * tileMargin, 1.1 * (m_minValue - m_maxValue + 1));
+    
+    QPen pen;
+    pen.setColor(QColor(5, 31, 41));
+    pen.setWidth(3);
+    pen.setCosmetic(true);
+    painter.setPen(pen);
+    
+    int min = 0;
+    int max = 0;
+    
+    for (int j = -tileMargin; j < tileWidth + tileMargin; j++)
+    {
+        qint64 frame = (tileIndex * tileWidth + j) * m_scale;
+        
+        // Prevent accessing an out-of-range index
+        if (frame < 0)
+            continue;
+        if (frame >= m_audioSource->framesCount())
+            break;
+        
+        if (m_audioSource->getMinMaxSampleValueInRange(frame, m_scale, channelIndex, min, max))
+            painter.drawLine(QLine(j, min >> m_valueShift, j, max >> m_valueShift));
+        else
+            complete = false;
+    }
+    
+    return image;
+    
+}
+
+
+/* Draw the min/max columns of a channel directly, without the tile cache.
+ *
+ * Columns are aligned on multiples of the scale and clipped to the subplot as with tiles,
+ * so both paths give the same image (see RenderBenchmark). */
+void SignalPlot::drawColumns(QPainter &painter, int channelIndex, const QRect &subplot)
+{
+    
+    qint64 firstColumn = m_positionSample / m_scale;
+    int    min         = 0;
+    int    max         = 0;
+    
+    // The columns are written into an image drawn at once, in device coordinates
+    if (m_rasterizerEnabled)
+    {
+        bool complete;
+        
+        // The image has the margins of the tiles: the pen of the columns next to the subplot spreads over its edges
+        if (m_columnsImage.size() != QSize(subplot.width() + 2 * tileMargin, subplot.height()))
+            m_columnsImage = QImage(subplot.width() + 2 * tileMargin, subplot.height(), QImage::Format_ARGB32_Premultiplied);
+        m_columnsImage.fill(Qt::transparent);
+        
+        rasterizeColumns(m_columnsImage, channelIndex, firstColumn - tileMargin, m_columnsImage.width(), complete);
+        
+        painter.setViewTransformEnabled(false);
+        painter.drawImage(subplot.x(), subplot.y(), m_columnsImage, tileMargin, 0, subplot.width(), subplot.height());
+        painter.setViewTransformEnabled(true);
+        
+        return;
+    }
+    
+    // The clip rectangle is given in widget coordinates, the columns are drawn in the window of the channel
+    painter.save();
+    painter.setViewTransformEnabled(false);
+    painter.setClipRect(subplot);
+    painter.setViewTransformEnabled(true);
+    
+    for (int j = 0; j < subplot.width(); j++)
+    {
+        qint64 frame = (firstColumn + j) * m_scale;
+        
+        // Prevent accessing an out-of-range index
+        if (frame >= m_audioSource->framesCount())
+            break;
+        
+        // Blocks whose peaks are still being computed are left empty, they will be drawn later
+        if (m_audioSource->getMinMaxSampleValueInRange(frame, m_scale, channelIndex, min, max))
+            painter.drawLine(QLine(j, min >> m_valueShift, j, max >> m_valueShift));
+    }
+    
+    painter.restore();
+    
+}
+
+
+/* Draw the spectrogram of a channel from its tiles. The tiles which are not computed yet are left black.
+ *
+ * As for the waveform tiles, only the part of each tile inside the area is drawn, without clipping. */
+void SignalPlot::drawSpectrogram(QPainter &painter, int channelIndex, const QRect &area)
+{
+    
+    const int tileWidth   = WaveformTileCache::tileWidth;
+    qint64    firstColumn = m_positionSample / m_scale;
+    qint64    firstTile   = firstColumn / tileWidth;
+    qint64    lastTile    = (firstColumn + area.width() - 1) / tileWidth;
+    
+    painter.setViewTransformEnabled(false);
+    painter.fillRect(area, Qt::black);
+    
+    for (qint64 tile = firstTile; tile <= lastTile; tile++)
+    {
+        if (tile * tileWidth * m_scale >= m_audioSource->framesCount())
+            break;
+        
+        int     x     = area.x() + (int) (tile * tileWidth - firstColumn);
+        int     left  = std::max(x, area.x());
+        int     right = std::min(x + tileWidth, area.x() + area.width());
+        QImage *image = m_spectrogram.tile(channelIndex, tile);
+        
+        if (image)
+            painter.drawImage(left, area.y(), *image, tileMargin + left - x, 0, right - left, area.height());
+    }
+    
+    painter.setViewTransformEnabled(true);
+    
+}
+
+
+/* Show or hide the spectrogram under the waveforms. */
+void SignalPlot::setSpectrogramVisible(bool visible)
+{
+    m_spectrogramVisible = visible;
+    update();
+}
+
+
+/* Write the min/max columns [firstColumn, firstColumn + columnsCount) of a channel into a transparent image,
+ * the first one at x = 0, with the same window as the QPainter path.
+ *
+ * complete is set to false if some columns could not be drawn because their peaks are not computed yet. */
+void SignalPlot::rasterizeColumns(QImage &image, int channelIndex, qint64 firstColumn, int columnsCount, bool &complete)
+{
+    
+    WaveformRasterizer rasterizer(image, 1.1 * (m_maxValue), 1.1 * (m_minValue - m_maxValue + 1), QColor(5, 31, 41));
+    
+    int min  = 0;
+    int max  = 0;
+    complete = true;
+    
+    for (int j = 0; j < columnsCount; j++)
+    {
+        qint64 frame = (firstColumn + j) * m_scale;
+        
+        // Prevent accessing an out-of-range index
+        if (frame < 0)
+            continue;
+        if (frame >= m_audioSource->framesCount())
+            break;
+        
+        if (m_audioSource->getMinMaxSampleValueInRange(frame, m_scale, channelIndex, min, max))
+            rasterizer.drawColumn(j, min >> m_valueShift, max >> m_valueShift);
+        else
+            complete = false;
+    }
+    
+}
+
+
+/* Choose between writing the min/max columns into images or drawing them with QPainter lines. */
+void SignalPlot::setRasterizerEnabled(bool enabled)
+{
+    m_rasterizerEnabled = enabled;
+    m_tiles.clear();
+    update();
+}
+
+
+/* Choose between drawing the min/max columns through the tile cache or directly. */
+void SignalPlot::setTileCacheEnabled(bool enabled)
+{
+    m_tileCacheEnabled = enabled;
+    m_tiles.clear();
+    update();
 }
 
 
@@ -177,8 +458,16 @@ void SignalPlot::setScale(int value)
 /* Handle changes of timecode. */
 void SignalPlot::refreshPosition()
 {
-    m_positionSample = (m_audioPlayer->position() * m_audioSource->sampleRate()) / 1000;
-    update();  // Trigger a paintEvent
+    
+    qint64 position = m_audioPlayer->position();
+    
+    // Repaint only if the playhead moved
+    if (position != m_positionSample)
+    {
+        m_positionSample = position;
+        update();  // Trigger a paintEvent
+    }
+    
 }
 
 
@@ -189,14 +478,14 @@ void SignalPlot::mousePressEvent(QMouseEvent *event)
 {
     
     // Allow audio selection only if an audio file is opened and not playing
-    if (fileLoaded && (m_audioPlayer->state() != QMediaPlayer::PlayingState))
+    if (fileLoaded && (m_audioPlayer->state() != AudioEngine::PlayingState))
     {
         origin = event->pos();  // coordinates of the click
         if (!selectionArea)
             selectionArea = new CustomRubberBand(QRubberBand::Rectangle, this);
         
         // Clip the rectangular selection to our subplots area
-        selectionArea->setGeometry(QRect(QPoint(origin.x() > m_CoordTopFirstSubplot->x() ? origin.x() : m_CoordTopFirstSubplot->x(), m_CoordTopFirstSubplot->y()), QSize()));
+        selectionArea->setGeometry(QRect(QPoint(origin.x() > m_CoordTopFirstSubplot.x() ? origin.x() : m_CoordTopFirstSubplot.x(), m_CoordTopFirstSubplot.y()), QSize()));
         
         selectionArea->show();
     }
@@ -210,16 +499,16 @@ void SignalPlot::mouseMoveEvent(QMouseEvent *event)
 {
     
     // Allow selection if an audio file is opened and is NOT playing
-    if (fileLoaded && (m_audioPlayer->state() != QMediaPlayer::PlayingState))
+    if (fileLoaded && (m_audioPlayer->state() != AudioEngine::PlayingState))
     {
         // Clip the rectangular selection to our subplots area
-        QPoint topLeftCorner     = QPoint(origin.x() > m_CoordTopFirstSubplot->x() ? origin.x() : m_CoordTopFirstSubplot->x(), m_CoordTopFirstSubplot->y());
-        QPoint bottomRightCorner = QPoint(event->pos().x(), m_CoordBottomLastSubplot->y());
+        QPoint topLeftCorner     = QPoint(origin.x() > m_CoordTopFirstSubplot.x() ? origin.x() : m_CoordTopFirstSubplot.x(), m_CoordTopFirstSubplot.y());
+        QPoint bottomRightCorner = QPoint(event->pos().x(), m_CoordBottomLastSubplot.y());
         
-        if (event->pos().x() > m_CoordBottomLastSubplot->x())
-            bottomRightCorner.setX(m_CoordBottomLastSubplot->x());
-        if (event->pos().x() < m_CoordTopFirstSubplot->x())
-            bottomRightCorner.setX(m_CoordTopFirstSubplot->x());
+        if (event->pos().x() > m_CoordBottomLastSubplot.x())
+            bottomRightCorner.setX(m_CoordBottomLastSubplot.x());
+        if (event->pos().x() < m_CoordTopFirstSubplot.x())
+            bottomRightCorner.setX(m_CoordTopFirstSubplot.x());
         
         // Update the selection area geometry
         selectionArea->setGeometry(QRect(topLeftCorner, bottomRightCorner).normalized());
@@ -234,20 +523,16 @@ void SignalPlot::mouseMoveEvent(QMouseEvent *event)
 void SignalPlot::refreshCut()
 {
     
+    qint64 startFrame, endFrame;
+    
     // Nothing to cut if no selection
-    if (selectionArea)
+    if (selectedRange(startFrame, endFrame))
     {
         
-        // Convert selection area coordinates into audio frames values
-        QRect selectionRectangle = selectionArea->geometry();
-        uint startFrame, endFrame;
-        startFrame = m_positionSample + selectionRectangle.x() * m_scale;
-        endFrame   = startFrame + selectionRectangle.width() * m_scale;
+        // Cut the audio in the original buffer (cutBlock includes its end frame)
+        m_audioSource->cutBlock(startFrame, endFrame - 1);
         
-        // Cut the audio in the original buffer
-        m_audioSource->cutBlock(startFrame, endFrame);
-        
-        update();  // Trigger a paintEvent
+        refreshEdits();
         
         // Hide and unset the selection area
         selectionArea->hide();
@@ -259,6 +544,40 @@ void SignalPlot::refreshCut()
 }
 
 
+/* Convert the selection area into the range of logical frames [startFrame, endFrame) it covers.
+ *
+ * It returns false if nothing is selected. */
+bool SignalPlot::selectedRange(qint64 &startFrame, qint64 &endFrame)
+{
+    
+    if (!selectionArea)
+        return false;
+    
+    // Convert selection area coordinates into audio frames values
+    QRect selectionRectangle = selectionArea->geometry();
+    startFrame = m_positionSample + (qint64) selectionRectangle.x() * m_scale;
+    endFrame   = std::min(startFrame + (qint64) selectionRectangle.width() * m_scale + 1, m_audioSource->framesCount());
+    
+    return startFrame < endFrame;
+    
+}
+
+
+/* Handle a change of the edited audio (cut, undo, redo or processing of the selection).
+ *
+ * The tiles after the change are moved when possible, only the tiles around it are rendered again.
+ * The peaks need no update: they are computed for the source frames, which edits do not change,
+ * and processed frames come with their own peaks. */
+void SignalPlot::refreshEdits()
+{
+    EditList *edits = m_audioSource->edits();
+    
+    m_tiles.applyEdit(edits->changedFrom(), edits->changedTo(), edits->shift());
+    m_spectrogram.applyEdit(edits);
+    update();  // Trigger a paintEvent
+}
+
+
 /* This method is called when closing a file from the main window.
  *
  * It handles removal of the plot to come back to initial state. */
@@ -274,6 +593,8 @@ void SignalPlot::unsetPlot()
     }
     
     fileLoaded = false;
+    m_tiles.clear();
+    m_spectrogram.setAudioSource(nullptr);
     loadFileLabel->setVisible(true);
     
     update();  // Trigger a paintEvent
@@ -1,11 +1,14 @@
 #ifndef SIGNALPLOT_H
 #define SIGNALPLOT_H
 
-#include <QMediaPlayer>
 #include <QtWidgets>
 #include <QWidget>
 
+#include "allocationcounter.h"
+#include "audioengine.h"
+#include "spectrogram.h"
 #include "wavbuffer.h"
+#include "waveformtilecache.h"
 
 
 class CustomRubberBand;  // Defined below
@@ -24,13 +27,27 @@ class SignalPlot : public QWidget
 public:
     SignalPlot(QWidget *parent = 0);
     
-    void preparePlot(WavBuffer*, QMediaPlayer*);
+    void preparePlot(WavBuffer*, AudioEngine*);
     void unsetPlot();
-
+    void setTileCacheEnabled(bool enabled);
+    void setRasterizerEnabled(bool enabled);
+    void setSpectrogramVisible(bool visible);
+    
+    Spectrogram* spectrogram()  {return &m_spectrogram;};
+    bool         selectedRange(qint64 &startFrame, qint64 &endFrame);
+    
+    // Heap allocations made by the last paint, counted with CONFIG+=allocation_counter, and the part made by the QPainter setup
+    AllocationCounter::Counts lastPaintAllocations()    {return m_lastPaintAllocations;};
+    AllocationCounter::Counts lastPainterAllocations()  {return m_lastPainterAllocations;};
+    
 public slots:
     void setScale(int value);
     void refreshPosition();
     void refreshCut();
+    void refreshEdits();
+    
+signals:
+    void visibleRangeChanged(qint64 startFrame, qint64 endFrame);
     
 private:
     bool fileLoaded = false;
@@ -44,20 +61,47 @@ private:
     // This group of attributes is used to draw the waveform
     int m_minValue;
     int m_maxValue;
+    int m_valueShift = 0;  // Right shift of the sample values to fit in [m_minValue, m_maxValue]
     int m_scale = 1;
-    int m_positionSample = 0;
+    qint64 m_positionSample = 0;
+    qint64 m_visibleStart   = 0;  // Last range sent with visibleRangeChanged
+    qint64 m_visibleEnd     = 0;
+    QVector<int>   m_samples;      // Samples of a channel decoded for the lowest scales, kept between paints
+    QVector<QLine> m_lines;        // Lines between these samples, kept between paints
+    QPen           m_wavePen;
+    QBrush         m_backgroundBrush;
+    AllocationCounter::Counts m_lastPaintAllocations;
+    AllocationCounter::Counts m_lastPainterAllocations;
+    
+    // Rendered waveform tiles, used when min/max values are drawn
+    static const int  tileMargin = WaveformTileCache::tileMargin;  // Columns rendered on each side of a tile, for the pen width
+    WaveformTileCache m_tiles;
+    bool              m_tileCacheEnabled = true;
+    void   drawTiles(QPainter &painter, int channelIndex, const QRect &subplot);
+    void   drawColumns(QPainter &painter, int channelIndex, const QRect &subplot);
+    QImage renderTile(int channelIndex, qint64 tileIndex, int height, bool &complete);
+    
+    // Min/max columns are written straight into images, QPainter lines are kept as a fallback
+    bool   m_rasterizerEnabled = true;
+    QImage m_columnsImage;  // Columns of a channel drawn without the tile cache, kept between paints
+    void   rasterizeColumns(QImage &image, int channelIndex, qint64 firstColumn, int columnsCount, bool &complete);
+    
+    // Spectrogram shown under the waveform of each channel, on the lower half of its subplot
+    Spectrogram m_spectrogram;
+    bool        m_spectrogramVisible = false;
+    void        drawSpectrogram(QPainter &painter, int channelIndex, const QRect &area);
     
     // This group of attributes/methods handles the "cut area" selection
     void mousePressEvent(QMouseEvent *event);
     void mouseMoveEvent(QMouseEvent  *event);
     CustomRubberBand *selectionArea  = nullptr;
-    QPoint *m_CoordTopFirstSubplot   = nullptr;
-    QPoint *m_CoordBottomLastSubplot = nullptr;
+    QPoint m_CoordTopFirstSubplot;
+    QPoint m_CoordBottomLastSubplot;
     QPoint origin;
     
-    // Pointers to the original QMediaPlayer and WavBuffer initialized in the main window
-    WavBuffer    *m_audioSource = nullptr;
-    QMediaPlayer *m_audioPlayer = nullptr;
+    // Pointers to the original AudioEngine and WavBuffer initialized in the main window
+    WavBuffer   *m_audioSource = nullptr;
+    AudioEngine *m_audioPlayer = nullptr;
 
 };
 
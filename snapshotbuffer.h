@@ -0,0 +1,65 @@
+#ifndef SNAPSHOTBUFFER_H
+#define SNAPSHOTBUFFER_H
+
+#include <QAtomicInt>
+
+
+/* Wait-free triple buffer, to publish values from a single writer thread to a single reader thread
+ *
+ * The writer fills its own buffer and publishes it by swapping it with the middle one,
+ * the reader takes the middle buffer by swapping it with its own, if a new one was published.
+ * Neither side ever waits for the other or copies the values: the reader always sees the
+ * last complete snapshot, and snapshots published meanwhile are skipped.
+ *
+ * The buffers must be prepared (for instance their containers sized) before both threads use them:
+ * the writer can then fill them without allocating.
+ */
+template <typename T>
+class SnapshotBuffer
+{
+    
+public:
+    // The three buffers, to prepare them while neither the writer nor the reader use them
+    T& buffer(int index)   {return m_buffers[index];};
+    
+    // Buffer of the writer, to fill before publishing it. Called from the writer thread only
+    T& writeBuffer()       {return m_buffers[m_writeIndex];};
+    
+    /* Make the buffer of the writer the last snapshot, the writer gets the previous middle buffer.
+     *
+     * Called from the writer thread only. */
+    void publish()
+    {
+        m_writeIndex = m_middle.fetchAndStoreOrdered(m_writeIndex | publishedFlag) & indexMask;
+    }
+    
+    /* Take the last snapshot if one was published since the previous call.
+     *
+     * Called from the reader thread only. It returns false if there is no new snapshot. */
+    bool update()
+    {
+        
+        if (!(m_middle.loadAcquire() & publishedFlag))
+            return false;
+        
+        m_readIndex = m_middle.fetchAndStoreOrdered(m_readIndex) & indexMask;
+        
+        return true;
+        
+    }
+    
+    // Last snapshot taken by update. Called from the reader thread only
+    const T& readBuffer()  {return m_buffers[m_readIndex];};
+    
+private:
+    static const int indexMask     = 3;
+    static const int publishedFlag = 4;
+    
+    T          m_buffers[3];
+    int        m_writeIndex = 0;
+    QAtomicInt m_middle {1};      // Index of the middle buffer, with publishedFlag until the reader takes it
+    int        m_readIndex  = 2;
+    
+};
+
+#endif // SNAPSHOTBUFFER_H
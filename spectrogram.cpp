@@ -0,0 +1,347 @@
+#include <algorithm>
+#include <cmath>
+
+#include "fft.h"
+#include "samplekernels.h"
+#include "spectrogram.h"
+
+
+// Colors of the palette at regular intervals, from floorLevel to 0 dBFS
+static const QRgb paletteStops[] = {qRgb(0, 0, 0), qRgb(40, 10, 90), qRgb(180, 30, 90), qRgb(250, 130, 20), qRgb(255, 255, 200)};
+
+
+/* Results of the jobs are queued to the thread of the spectrogram, which owns the cache. */
+Spectrogram::Spectrogram(QObject *parent) : QObject(parent)
+{
+    
+    m_palette = palette();
+    
+    connect(this, &Spectrogram::tileRendered, this, &Spectrogram::insertTile, Qt::QueuedConnection);
+    
+}
+
+
+/* The jobs read the audio source and emit signals of the spectrogram: they must be finished first. */
+Spectrogram::~Spectrogram()
+{
+    cancelJobs();
+    m_pool.waitForDone();
+}
+
+
+/* Set the WavBuffer to show, or nullptr when it is closed. It waits for the jobs which read the previous one. */
+void Spectrogram::setAudioSource(WavBuffer *audioSource)
+{
+    
+    cancelJobs();
+    m_pool.waitForDone();
+    
+    m_audioSource = audioSource;
+    m_tiles.clear();
+    
+}
+
+
+/* Change the analysis: all the tiles must be computed again. */
+void Spectrogram::setSettings(const Settings &settings)
+{
+    
+    cancelJobs();
+    
+    m_settings = settings;
+    m_tiles.clear();
+    
+    emit tilesUpdated();
+    
+}
+
+
+/* Set the height of the tiles, dropping the tiles of another height. */
+void Spectrogram::setTileHeight(int height)
+{
+    
+    if (height == m_tiles.tileHeight())
+        return;
+    
+    cancelJobs();
+    m_tiles.setTileHeight(height);
+    
+}
+
+
+/* Give the range of tiles currently displayed, before asking for them with tile().
+ *
+ * The tiles around them which are not computed yet are requested, with a lower priority than the visible ones. */
+void Spectrogram::setVisibleTiles(int scale, qint64 firstTile, qint64 lastTile)
+{
+    
+    m_wantedScale.storeRelease(scale);
+    m_wantedFirst.storeRelease(firstTile - prefetchTiles);
+    m_wantedLast.storeRelease(lastTile + prefetchTiles);
+    
+    if (!m_audioSource)
+        return;
+    
+    for (int channel = 0; channel < m_audioSource->channelsCount(); channel++)
+    {
+        for (int k = 1; k <= prefetchTiles; k++)
+        {
+            request(channel, firstTile - k, 0);
+            request(channel, lastTile + k, 0);
+        }
+    }
+    
+}
+
+
+/* Get a visible tile at the scale given to setVisibleTiles.
+ *
+ * It returns nullptr if the tile is not computed yet: it is then computed on the thread pool,
+ * and tilesUpdated is emitted once it is ready. */
+QImage* Spectrogram::tile(int channelIndex, qint64 index)
+{
+    
+    QImage *image = m_tiles.tile(channelIndex, m_wantedScale.loadAcquire(), index);
+    
+    if (!image)
+        request(channelIndex, index, 1);
+    
+    return image;
+    
+}
+
+
+/* Update the tiles after a cut, undo or redo, as for the waveform tiles.
+ *
+ * A column also shows the frames of its analysis window: the changed range is widened by as much. */
+void Spectrogram::applyEdit(EditList *edits)
+{
+    
+    qint64 reach = (m_settings.windowSize + m_settings.hop) / 2 + 1;
+    
+    cancelJobs();
+    m_tiles.applyEdit(edits->changedFrom() - reach, edits->changedTo() + reach, edits->shift(), m_settings.hop);
+    
+}
+
+
+/* Start the job of a tile, unless it is computed, being computed or after the end of the audio.
+ *
+ * While the file is being loaded, a tile whose analysis windows read frames not loaded yet is asked for again at a later paint. */
+void Spectrogram::request(int channelIndex, qint64 index, int priority)
+{
+    
+    int scale = m_wantedScale.loadAcquire();
+    
+    if (!m_audioSource || index < 0 || index * WaveformTileCache::tileWidth * scale >= m_audioSource->framesCount())
+        return;
+    
+    // There is no edit until the file is loaded: logical frames are source frames
+    if (!m_audioSource->isLoaded() && (index + 1) * WaveformTileCache::tileWidth * scale + m_settings.windowSize > m_audioSource->loadedFramesCount())
+        return;
+    
+    WaveformTileCache::TileKey key = {channelIndex, scale, index};
+    
+    if (m_pending.contains(key) || m_tiles.tile(channelIndex, scale, index))
+        return;
+    
+    m_pending.insert(key);
+    m_pool.start(new SpectrogramJob(this, m_generation.loadAcquire(), *m_audioSource->edits(), channelIndex, scale, index), priority);
+    
+}
+
+
+/* Make the jobs in progress useless: the jobs which did not start are dropped, the results of the others ignored. */
+void Spectrogram::cancelJobs()
+{
+    m_generation.fetchAndAddOrdered(1);
+    m_pool.clear();
+    m_pending.clear();
+}
+
+
+/* Check, from a job, that its tile is still needed. */
+bool Spectrogram::isWanted(int generation, int scale, qint64 index)
+{
+    return generation == m_generation.loadAcquire() && scale == m_wantedScale.loadAcquire() &&
+           index >= m_wantedFirst.loadAcquire() && index <= m_wantedLast.loadAcquire();
+}
+
+
+/* Keep a tile computed by a job, unless it was cancelled meanwhile. A null image means the job was dropped. */
+void Spectrogram::insertTile(int generation, int channelIndex, int scale, qint64 index, QImage image)
+{
+    
+    if (generation != m_generation.loadAcquire())
+        return;
+    
+    m_pending.remove({channelIndex, scale, index});
+    
+    if (image.isNull() || image.height() != m_tiles.tileHeight())
+        return;
+    
+    m_tiles.insert(channelIndex, scale, index, image);
+    
+    emit tilesUpdated();
+    
+}
+
+
+/* Compute a tile, in a thread of the pool.
+ *
+ * Consecutive columns which show the same analysis window share its FFT. Frames of the window
+ * out of the audio count as silence. The image has the margins of the waveform tiles, left transparent.
+ * It returns a null image if the tile stopped being needed before it was done. */
+QImage Spectrogram::render(int generation, const Settings &settings, EditList *edits, int channelIndex, int scale, qint64 index, int height)
+{
+    
+    const int tileWidth   = WaveformTileCache::tileWidth;
+    const int tileMargin  = WaveformTileCache::tileMargin;
+    int       size        = settings.windowSize;
+    int       binsCount   = size / 2 + 1;
+    qint64    framesCount = edits->framesCount();
+    
+    FFT            fft(size);
+    QVector<float> weights = window(settings);
+    QVector<int>   samples(size);
+    QVector<float> input(size);
+    QVector<float> power(binsCount);
+    QVector<QRgb>  column(height);
+    
+    // A full scale sine gives a peak of weights sum / 2 in its bin: levels are relative to it
+    double weightsSum = 0;
+    for (float weight : weights)
+        weightsSum += weight;
+    
+    double sampleScale    = 1.0 / std::ldexp(1.0, SampleKernels::significantBits(m_audioSource->sampleFormat()) - 1);
+    double referencePower = (weightsSum / 2) * (weightsSum / 2);
+    
+    QImage image(tileWidth + 2 * tileMargin, height, QImage::Format_ARGB32_Premultiplied);
+    image.fill(Qt::transparent);
+    
+    qint64 lastWindow = -1;
+    
+    for (int j = 0; j < tileWidth; j++)
+    {
+        qint64 frame = (index * tileWidth + j) * scale;
+        
+        if (frame >= framesCount)
+            break;
+        
+        // Analysis window nearest to the middle of the frames of the column
+        qint64 analysisWindow = (frame + scale / 2 + settings.hop / 2) / settings.hop;
+        
+        if (analysisWindow != lastWindow)
+        {
+            if (!isWanted(generation, scale, index))
+                return QImage();
+            
+            qint64 start = analysisWindow * settings.hop - size / 2;
+            qint64 first = std::max<qint64>(start, 0);
+            qint64 end   = std::min(start + size, framesCount);
+            
+            std::fill(samples.begin(), samples.end(), 0);
+            if (first < end)
+                m_audioSource->readSamples(first, end - first, channelIndex, samples.data() + (first - start), edits);
+            
+            for (int i = 0; i < size; i++)
+                input[i] = samples[i] * sampleScale * weights[i];
+            
+            fft.powerSpectrum(input.constData(), power.data());
+            
+            // Each row shows the loudest of its bins, the lowest frequencies at the bottom
+            for (int row = 0; row < height; row++)
+            {
+                int firstBin = (qint64) (height - 1 - row) * binsCount / height;
+                int endBin   = std::max(firstBin + 1, (int) ((qint64) (height - row) * binsCount / height));
+                
+                float loudest = *std::max_element(power.constBegin() + firstBin, power.constBegin() + endBin);
+                double level  = 10 * std::log10(loudest / referencePower + 1e-30);
+                int    color  = qBound(0, (int) ((level - floorLevel) * (m_palette.size() - 1) / -floorLevel), m_palette.size() - 1);
+                
+                column[row] = m_palette[color];
+            }
+            
+            lastWindow = analysisWindow;
+        }
+        
+        for (int row = 0; row < height; row++)
+            ((QRgb*) image.scanLine(row))[tileMargin + j] = column[row];
+    }
+    
+    return image;
+    
+}
+
+
+/* Get the weights of the analysis window. */
+QVector<float> Spectrogram::window(const Settings &settings)
+{
+    
+    int            size = settings.windowSize;
+    QVector<float> weights(size);
+    
+    // Periodic windows, as usual for spectral analysis
+    for (int i = 0; i < size; i++)
+    {
+        double phase = 2 * M_PI * i / size;
+        
+        switch (settings.window)
+        {
+            case Rectangular:
+                weights[i] = 1;
+                break;
+            case Hann:
+                weights[i] = 0.5 - 0.5 * std::cos(phase);
+                break;
+            case Hamming:
+                weights[i] = 0.54 - 0.46 * std::cos(phase);
+                break;
+            case Blackman:
+                weights[i] = 0.42 - 0.5 * std::cos(phase) + 0.08 * std::cos(2 * phase);
+                break;
+        }
+    }
+    
+    return weights;
+    
+}
+
+
+/* Interpolate the colors of the levels between the stops of the palette. */
+QVector<QRgb> Spectrogram::palette()
+{
+    
+    const int     stopsCount = sizeof(paletteStops) / sizeof(paletteStops[0]);
+    QVector<QRgb> colors(256);
+    
+    for (int i = 0; i < colors.size(); i++)
+    {
+        double position = (double) i * (stopsCount - 1) / (colors.size() - 1);
+        int    stop     = std::min((int) position, stopsCount - 2);
+        double t        = position - stop;
+        QRgb   from     = paletteStops[stop];
+        QRgb   to       = paletteStops[stop + 1];
+        
+        colors[i] = qRgb(qRed(from)   + t * (qRed(to)   - qRed(from)),
+                         qGreen(from) + t * (qGreen(to) - qGreen(from)),
+                         qBlue(from)  + t * (qBlue(to)  - qBlue(from)));
+    }
+    
+    return colors;
+    
+}
+
+
+/* Compute the tile and give it to the spectrogram, in its thread. */
+void SpectrogramJob::run()
+{
+    
+    QImage image;
+    
+    if (m_spectrogram->isWanted(m_generation, m_scale, m_index))
+        image = m_spectrogram->render(m_generation, m_settings, &m_edits, m_channelIndex, m_scale, m_index, m_height);
+    
+    emit m_spectrogram->tileRendered(m_generation, m_channelIndex, m_scale, m_index, image);
+    
+}
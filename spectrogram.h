@@ -0,0 +1,123 @@
+#ifndef SPECTROGRAM_H
+#define SPECTROGRAM_H
+
+#include <QAtomicInt>
+#include <QAtomicInteger>
+#include <QImage>
+#include <QObject>
+#include <QRunnable>
+#include <QSet>
+#include <QThreadPool>
+#include <QVector>
+
+#include "editlist.h"
+#include "wavbuffer.h"
+#include "waveformtilecache.h"
+
+
+/* Spectrogram of each channel of a WavBuffer, computed by tiles on worker threads
+ *
+ * Tiles have the same columns as the waveform tiles: at a given scale, column c shows the
+ * spectrum of the analysis window (every hop frames) nearest to the middle of its frames.
+ * Frequencies go up from the bottom of the tile on a linear scale, and the levels in dBFS
+ * are mapped to colors from black (floorLevel and below) to light yellow (full scale).
+ * The plot asks for the visible tiles at each paint: missing tiles are computed on a thread
+ * pool, with the tiles around them, and kept in a WaveformTileCache, so that scrolling never
+ * computes a tile twice. Jobs whose tile is not around the visible range anymore when they start
+ * are dropped: only the visible part of the file is computed, whatever its length.
+ */
+class Spectrogram : public QObject
+{
+    
+    Q_OBJECT
+    
+public:
+    enum WindowFunction
+    {
+        Rectangular,
+        Hann,
+        Hamming,
+        Blackman
+    };
+    
+    struct Settings
+    {
+        int            windowSize = 2048;  // Frames, a power of two
+        int            hop        = 512;   // Frames between the starts of two analysis windows
+        WindowFunction window     = Hann;
+    };
+    
+    static const int prefetchTiles = 2;     // Tiles computed in advance on each side of the visible ones
+    static const int floorLevel    = -120;  // dBFS
+    
+    Spectrogram(QObject *parent = 0);
+    ~Spectrogram();
+    
+    void     setAudioSource(WavBuffer *audioSource);
+    Settings settings()  {return m_settings;};
+    void     setSettings(const Settings &settings);
+    void     setTileHeight(int height);
+    
+    void     setVisibleTiles(int scale, qint64 firstTile, qint64 lastTile);
+    QImage*  tile(int channelIndex, qint64 index);
+    void     applyEdit(EditList *edits);
+    
+signals:
+    void tilesUpdated();
+    void tileRendered(int generation, int channelIndex, int scale, qint64 index, QImage image);  // From the jobs
+    
+private slots:
+    void insertTile(int generation, int channelIndex, int scale, qint64 index, QImage image);
+    
+private:
+    WavBuffer        *m_audioSource = nullptr;
+    Settings          m_settings;
+    WaveformTileCache m_tiles;
+    QVector<QRgb>     m_palette;  // Color of each level, from floorLevel to 0 dBFS
+    
+    QThreadPool                      m_pool;
+    QSet<WaveformTileCache::TileKey> m_pending;     // Tiles whose job is not finished
+    QAtomicInt                       m_generation;  // Changed when the jobs in progress become useless
+    
+    // Visible tiles and those around them, read by the jobs
+    QAtomicInt             m_wantedScale;
+    QAtomicInteger<qint64> m_wantedFirst;
+    QAtomicInteger<qint64> m_wantedLast;
+    
+    void   request(int channelIndex, qint64 index, int priority);
+    void   cancelJobs();
+    bool   isWanted(int generation, int scale, qint64 index);
+    QImage render(int generation, const Settings &settings, EditList *edits, int channelIndex, int scale, qint64 index, int height);
+    
+    static QVector<float> window(const Settings &settings);
+    static QVector<QRgb>  palette();
+    
+    friend class SpectrogramJob;
+    
+};
+
+
+/* Job of the thread pool which computes a single tile. */
+class SpectrogramJob : public QRunnable
+{
+    
+public:
+    SpectrogramJob(Spectrogram *spectrogram, int generation, const EditList &edits, int channelIndex, int scale, qint64 index) :
+        m_spectrogram(spectrogram), m_generation(generation), m_settings(spectrogram->m_settings), m_edits(edits),
+        m_channelIndex(channelIndex), m_scale(scale), m_index(index), m_height(spectrogram->m_tiles.tileHeight()) {};
+    
+    void run();
+    
+private:
+    Spectrogram          *m_spectrogram;
+    int                   m_generation;
+    Spectrogram::Settings m_settings;
+    EditList              m_edits;  // Copy of the edits when the job was created: the plot may cut meanwhile
+    int                   m_channelIndex;
+    int                   m_scale;
+    qint64                m_index;
+    int                   m_height;
+    
+};
+
+#endif // SPECTROGRAM_H
@@ -1,38 +1,198 @@
 #include <algorithm>
 #include <cmath>
+#include <climits>
 #include <cstdlib>
+#include <cstring>
 
 #include <QFile>
+#include <QFileDevice>
 
+#ifdef Q_OS_LINUX
+#include <cerrno>
+#include <sys/sendfile.h>
+#include <unistd.h>
+#endif
+
+#include "samplekernels.h"
 #include "wavbuffer.h"
 
 
+// Above this size, the RIFF size fields cannot hold the file size and an RF64 header is written
+static const qint64 maxRiffSize = 0xFFFFFFFFLL;
+
+// Audio data is written to the exported file by blocks of this size
+static const qint64 exportBlockSize = 4 * 1024 * 1024;
+
+// Bytes read first to find the header of a file which is not mapped, doubled until the data chunk is found
+static const qint64 headerReadSize = 64 * 1024;
+
+// Mapped pages are read one byte out of this many when a file is loaded
+static const qint64 pageSize = 4096;
+
+// From this number of channels, samples read by channel go through the planar cache by default
+static const int planarMinChannels = 8;
+
+
+/* Append an unsigned integer to a byte array, in little endian. */
+static void appendLittleEndian(QByteArray& bytes, quint64 value, int bytesCount)
+{
+    for (int i = 0 ; i < bytesCount ; i++, value >>= 8 )
+        bytes.push_back((char)(value & 0xFF));
+}
+
+
+/* Copy a range of bytes from a file to another inside the kernel, and return how many bytes were copied.
+ *
+ * copy_file_range lets the file system share the extents or copy them without going through user space,
+ * sendfile is used when it is not available between the two files (other file systems, older kernels).
+ * The copy stops at the first error: the caller writes the remaining bytes itself. */
+static qint64 copyFileRange(int input, qint64 inputOffset, int output, qint64 outputOffset, qint64 size)
+{
+    
+    qint64 copied = 0;
+    
+#ifdef Q_OS_LINUX
+    bool useSendfile = false;
+    
+    while (copied < size)
+    {
+        size_t  count  = std::min(size - copied, exportBlockSize);
+        loff_t  from   = inputOffset + copied;
+        loff_t  to     = outputOffset + copied;
+        ssize_t done;
+        
+        if (!useSendfile)
+        {
+            done = copy_file_range(input, &from, output, &to, count, 0);
+            
+            if (done < 0 && (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP))
+            {
+                useSendfile = true;
+                continue;
+            }
+        }
+        else
+        {
+            // sendfile writes at the offset of the output file
+            off_t offset = from;
+            done = (lseek(output, to, SEEK_SET) == to) ? sendfile(output, input, &offset, count) : -1;
+        }
+        
+        if (done < 0 && errno == EINTR)
+            continue;
+        if (done <= 0)
+            break;
+        
+        copied += done;
+    }
+#else
+    Q_UNUSED(input);
+    Q_UNUSED(inputOffset);
+    Q_UNUSED(output);
+    Q_UNUSED(outputOffset);
+    Q_UNUSED(size);
+#endif
+    
+    return copied;
+    
+}
+
+
+/* Read one byte of each memory page of a range, so that the pages of a mapping are loaded. */
+static void touchPages(const uchar *bytes, qint64 size)
+{
+    
+    uchar sum = 0;
+    
+    for (qint64 i = 0; i < size; i += pageSize)
+        sum ^= bytes[i];
+    
+    // The reads must not be optimized away
+    static volatile uchar sink;
+    sink = sum;
+    
+}
+
+
+/* The file mapping, if any, is released with the file. */
+WavBuffer::~WavBuffer()
+{
+    if (m_mappedData)
+        m_file.unmap(m_mappedData);
+}
+
+
 /* This method takes care of opening an audio file.
  *
- * It checks that the file exists and is readable and loads it. */
-bool WavBuffer::loadFile(const char *filePath)
+ * It checks that the file exists and is readable and loads it.
+ * In LoadMapped mode, nothing is read until samples are accessed. */
+bool WavBuffer::loadFile(const char *filePath, LoadMode mode)
+{
+    
+    if (!openFile(filePath, mode))
+        return false;
+    
+    if (isMapped())
+        m_loadedFrames.storeRelease(m_framesCount);
+    else if (loadFrames(m_framesCount) < 0)
+        return false;
+    
+    return true;
+    
+}
+
+
+/* Open an audio file and read its header, without loading its audio data yet.
+ *
+ * The audio info is available when it returns, the frames are loaded by loadFrames.
+ * In LoadInMemory mode, only the first bytes of the file, up to the data chunk, are read. */
+bool WavBuffer::openFile(const char *filePath, LoadMode mode)
 {
     
-    QFile file(filePath);
+    m_file.setFileName(filePath);
     
-    if (!file.open(QIODevice::ReadOnly))
+    if (!m_file.open(QIODevice::ReadOnly))
     {
         m_error = "Unable to open file";
         return false;
     }
     
-    // Load the raw bytes of the file in the QBuffer
-    buffer().append(file.readAll());
+    // A QByteArray cannot hold more than 2 GB: larger files are always mapped
+    if (mode == LoadMapped || m_file.size() > INT_MAX)
+        m_mappedData = m_file.map(0, m_file.size());
+    
+    if (m_mappedData)
+    {
+        m_data     = m_mappedData;
+        m_dataSize = m_file.size();
+    }
+    else if (m_file.size() <= INT_MAX)  // The raw bytes of the file are read in the QBuffer (also used when the file cannot be mapped)
+    {
+        buffer().resize(m_file.size());
+        
+        m_data     = (const uchar*) buffer().constData();
+        m_dataSize = buffer().size();
+        
+        if (!readHeaderBytes())
+        {
+            m_error = "Unable to read file";
+            return false;
+        }
+    }
+    else
+    {
+        m_error = "Unable to map file";
+        return false;
+    }
     
-    if (!headerIsValid(buffer()))
+    if (!headerIsValid())
     {
         m_error = "Unsupported file format";
         return false;
     }
-
-    readInfo();  // Get audio info contained in the header
     
-    if (m_channelsCount < 1 || m_bitDepth == 0 || m_bitDepth > 16)
+    // Get audio info contained in the header
+    if (!readInfo() || m_channelsCount < 1 || m_sampleRate < 1 || m_sampleFormat == SampleKernels::InvalidFormat)
     {
         m_error = "Unsupported WAV file";
         return false;
@@ -40,108 +200,515 @@ bool WavBuffer::loadFile(const char *filePath)
     
     m_filePath = filePath;
     
+    m_edits.reset(m_framesCount);  // No edit yet
+    m_loadedFrames.storeRelease(0);
+    
+    m_planarCache.setSource(sourceFrameData(0), m_framesCount, m_channelsCount, m_sampleFormat);
+    m_planarCacheEnabled = (m_channelsCount >= planarMinChannels);
+    
     return true;
     
 }
 
 
-/* Check that the file header is a valid WAV header. */
-bool WavBuffer::headerIsValid(const QByteArray& buffer)
+/* Load the next frames of the file opened by openFile, and return how many were loaded.
+ *
+ * A file in memory is read into the QBuffer. The pages of a mapped file are read through the mapping,
+ * so that samples accessed afterwards do not wait for the disk (or the network).
+ * The frames can be read by other threads as soon as it returns. It returns -1 if the file cannot be read. */
+qint64 WavBuffer::loadFrames(qint64 framesCount)
+{
+    
+    qint64 loaded = m_loadedFrames.loadAcquire();
+    qint64 count  = std::min(framesCount, m_framesCount - loaded);
+    
+    if (m_mappedData)
+    {
+        touchPages(sourceFrameData(loaded), count * m_bytesPerFrame);
+    }
+    else if (!readRawBytes(m_dataOffset + (loaded + count) * m_bytesPerFrame))
+    {
+        m_error = "Unable to read file";
+        return -1;
+    }
+    
+    m_loadedFrames.storeRelease(loaded + count);
+    
+    // Everything needed is in the QBuffer
+    if (!m_mappedData && isLoaded())
+        m_file.close();
+    
+    return count;
+    
+}
+
+
+/* Check that the file header is a valid WAV header.
+ *
+ * RF64 and BW64 files are WAV files whose sizes are stored in a ds64 chunk. */
+bool WavBuffer::headerIsValid()
 {
-    if (!buffer.startsWith("RIFF") ||
-        buffer.at(8)  != 'W'       ||
-        buffer.at(9)  != 'A'       ||
-        buffer.at(10) != 'V'       ||
-        buffer.at(11) != 'E')
+    if (m_dataSize < 44                       ||
+        (memcmp(m_data, "RIFF", 4) != 0 &&
+         memcmp(m_data, "RF64", 4) != 0 &&
+         memcmp(m_data, "BW64", 4) != 0)      ||
+        memcmp(m_data + 8, "WAVE", 4) != 0)
             return false;
     else
         return true;
 }
 
 
-/* Read audio info from the header and store it in a WavInfo struct. */
-void WavBuffer::readInfo()
+/* Read the first bytes of a file which is not mapped into the QBuffer, up to its data chunk.
+ *
+ * The chunks are parsed from the bytes read so far, which are doubled until the "fmt " and "data" chunks are found.
+ * It returns false if the file cannot be read; a file without those chunks is read entirely, readInfo then fails. */
+bool WavBuffer::readHeaderBytes()
+{
+    
+    qint64 fileSize = m_dataSize;
+    
+    for (qint64 size = headerReadSize; ; size *= 2)
+    {
+        if (!readRawBytes(std::min(size, fileSize)))
+            return false;
+        
+        // Only the bytes read are parsed
+        m_dataSize = m_bytesRead;
+        bool found = headerIsValid() && readInfo();
+        m_dataSize = fileSize;
+        
+        if (found || m_bytesRead == fileSize)
+            return true;
+    }
+    
+}
+
+
+/* Read the bytes of the file into the QBuffer, from the last byte read up to endByte (excluded). */
+bool WavBuffer::readRawBytes(qint64 endByte)
 {
+    
+    char *bytes = (char*) m_data;  // The QBuffer, which only this method writes
+    
+    while (m_bytesRead < endByte)
+    {
+        qint64 read = m_file.read(bytes + m_bytesRead, endByte - m_bytesRead);
+        
+        if (read <= 0)
+            return false;
+        
+        m_bytesRead += read;
+    }
+    
+    return true;
+    
+}
 
-    m_audioSize      = getByte(40) | (getByte(41) << 8) | (getByte(42) << 16) | (getByte(43) << 24);
-    m_bitDepth       = getByte(34) | (getByte(35) << 8);
-    m_channelsCount  = getByte(22) | (getByte(23) << 8);
-    m_bytesPerSample = m_bitDepth / 8;
-    m_bytesPerFrame  = m_bytesPerSample * m_channelsCount;
-    m_framesCount    = (audioSize() * 8) / (bitDepth() * channelsCount());
-    m_sampleRate     = getByte(24) | (getByte(25) << 8) | (getByte(26) << 16) | (getByte(27) << 24);
 
+/* Read an unsigned integer of a given number of bytes, stored in little endian. */
+quint64 WavBuffer::getLittleEndian(qint64 index, int bytesCount)
+{
+    
+    quint64 value = 0;
+    
+    for (int i = bytesCount - 1; i >= 0; i--)
+        value = (value << 8) | getByte(index + i);
+    
+    return value;
+    
 }
 
 
-/* Get the value of an audio sample at a given frame number and channel index. */
-int WavBuffer::getSample(int frameNumber, int channelIndex)
+/* Read audio info from the header and store it in the class attributes.
+ *
+ * It walks through the chunks of the file to find the "fmt " and "data" chunks,
+ * and reads the 64-bit data size from the ds64 chunk of RF64/BW64 files.
+ * It returns false if one of the required chunks is missing. */
+bool WavBuffer::readInfo()
 {
     
-    // Calculate the byte number of the audio sample we want
-    int byteNumber = frameNumber * bytesPerFrame() + 2 * channelIndex + 44;
+    qint64 audioSize     = 0;
+    qint64 ds64AudioSize = -1;
+    qint64 position      = 12;  // First chunk, after "RIFF", the RIFF size and "WAVE"
     
-    signed short sampleValue;
+    m_fmtOffset  = 0;
+    m_dataOffset = 0;
     
-    if (bitDepth() == 8)  // 8-bit samples
+    while (position + 8 <= m_dataSize)
     {
-        sampleValue = ((int)buffer().at(byteNumber)) - 127;
+        const uchar *chunkId   = m_data + position;
+        qint64       chunkSize = getLittleEndian(position + 4, 4);
+        
+        if (memcmp(chunkId, "fmt ", 4) == 0 && chunkSize >= 16)
+        {
+            m_fmtOffset = position;
+            m_fmtSize   = chunkSize;
+        }
+        else if (memcmp(chunkId, "ds64", 4) == 0 && chunkSize >= 24 && position + 8 + chunkSize <= m_dataSize)
+        {
+            ds64AudioSize = getLittleEndian(position + 16, 8);
+        }
+        else if (memcmp(chunkId, "data", 4) == 0)
+        {
+            m_dataOffset = position + 8;
+            audioSize    = (chunkSize == maxRiffSize && ds64AudioSize >= 0) ? ds64AudioSize : chunkSize;
+            break;
+        }
+        
+        position += 8 + chunkSize + (chunkSize & 1);  // Chunks are word-aligned
     }
-    else  // 16-bit samples
+    
+    if (m_fmtOffset == 0 || m_dataOffset == 0)
+        return false;
+    
+    // The fields of the fmt chunk are read from it, and the whole chunk is copied on export: it must fit in the file
+    if (m_fmtSize < 16 || m_fmtOffset + 8 + m_fmtSize + (m_fmtSize & 1) > m_dataSize)
+        return false;
+    
+    // Do not read past the end of a truncated file
+    audioSize = std::min(audioSize, m_dataSize - m_dataOffset);
+    
+    int formatTag    = getLittleEndian(m_fmtOffset + 8, 2);
+    m_channelsCount  = getLittleEndian(m_fmtOffset + 10, 2);
+    m_sampleRate     = getLittleEndian(m_fmtOffset + 12, 4);
+    m_bitDepth       = getLittleEndian(m_fmtOffset + 22, 2);
+    
+    // WAVE_FORMAT_EXTENSIBLE: the actual format tag starts the SubFormat GUID, after the valid bits and the channel mask.
+    // A chunk too short to hold the SubFormat does not give the format
+    if (formatTag == 0xFFFE)
     {
-        sampleValue  = (short) (unsigned char) buffer().at(byteNumber);
-        sampleValue |= ((short) (unsigned char) buffer().at(byteNumber + 1) << 8);
+        if (m_fmtSize < 40)
+            return false;
+        
+        formatTag = getLittleEndian(m_fmtOffset + 32, 2);
     }
     
-    return sampleValue;
+    m_sampleFormat   = SampleKernels::format(formatTag, m_bitDepth);
+    m_decodeSample   = SampleKernels::sampleDecoder(m_sampleFormat);
+    m_bytesPerSample = SampleKernels::sampleSize(m_sampleFormat);
+    m_bytesPerFrame  = m_bytesPerSample * m_channelsCount;
+    
+    if (m_bytesPerFrame == 0)
+        return false;
+    
+    m_framesCount    = audioSize / bytesPerFrame();
+    
+    return true;
+    
+}
+
+
+/* Get the value of an audio sample at a given frame number and channel index.
+ *
+ * To read many samples, readSamples decodes them with a single choice of the decoder. */
+int WavBuffer::getSample(qint64 frameNumber, int channelIndex)
+{
+    
+    // Find the audio sample we want, in the frames of the piece the edited frame reads from
+    int index = m_edits.pieceAt(frameNumber);
+    
+    return m_decodeSample(frameData(m_edits.piece(index), frameNumber - m_edits.pieceStart(index)) + bytesPerSample() * channelIndex);
     
 }
 
 
-/* Get the minimum and maximum sample values in a given samples range for a given channel index. */
-void WavBuffer::getMinMaxSampleValueInRange(int startFrame, int range, int channelIndex, int& min, int& max)
+/* Decode the samples of a channel for consecutive logical frames.
+ *
+ * Each piece of the edit list the frames span is decoded at once. As with readFrames,
+ * threads which work on a copy of the edit list give it instead of the one of the WavBuffer.
+ * It returns the number of samples decoded, which is smaller than framesCount at the end of the audio,
+ * or before the first frame of the file which is not loaded yet. */
+qint64 WavBuffer::readSamples(qint64 startFrame, qint64 framesCount, int channelIndex, int *samples, EditList *edits)
 {
-    if (range != 1)  // Calculate the min/max only if we have at least two values to look up
+    
+    qint64 decoded = 0;
+    
+    if (!edits)
+        edits = &m_edits;
+    
+    for (int i = edits->pieceAt(startFrame); i >= 0 && i < edits->piecesCount() && decoded < framesCount; i++)
     {
-        int minMaxBuffer[range];
+        EditList::Piece piece  = edits->piece(i);
+        qint64          offset = std::max<qint64>(startFrame + decoded - edits->pieceStart(i), 0);
+        qint64          count  = std::min(piece.framesCount - offset, framesCount - decoded);
+        bool            loaded = true;
         
-        for (int i = 0; i < range; i++)
+        // Frames of the file which are not loaded yet are not decoded
+        if (!piece.block && piece.sourceFrame + offset + count > loadedFramesCount())
         {
-            minMaxBuffer[i] = getSample(i + startFrame, channelIndex);
+            count  = std::max<qint64>(loadedFramesCount() - piece.sourceFrame - offset, 0);
+            loaded = false;
         }
         
-        min = *std::min_element(minMaxBuffer, minMaxBuffer + range);
-        max = *std::max_element(minMaxBuffer, minMaxBuffer + range);
+        // Frames of the file are read contiguously from the planar cache, if enabled, frames of blocks straight from the block
+        if (m_planarCacheEnabled && !piece.block)
+            m_planarCache.readSamples(piece.sourceFrame + offset, count, channelIndex, samples + decoded, loadedFramesCount());
+        else
+            SampleKernels::decodeChannel(frameData(piece, offset), count, channelsCount(), sampleFormat(),
+                                         channelIndex, samples + decoded);
+        
+        decoded += count;
+        
+        if (!loaded)
+            break;
     }
-    else
+    
+    return decoded;
+    
+}
+
+
+/* Get the minimum and maximum sample values in a given samples range for a given channel index.
+ *
+ * The range is split into the pieces of the edit list it covers, which are contiguous in the source.
+ * Each piece is read with the peak pyramid of its frames: the one of the file or the one of its block.
+ * It returns false if the range needs peaks which are still being computed (see PeakBuilder),
+ * or samples of the file which are not loaded yet. */
+bool WavBuffer::getMinMaxSampleValueInRange(qint64 startFrame, qint64 range, int channelIndex, int& min, int& max)
+{
+    
+    qint64 endFrame = std::min(startFrame + std::max<qint64>(range, 1), framesCount());
+    
+    min = INT_MAX;
+    max = INT_MIN;
+    
+    for (int i = m_edits.pieceAt(startFrame); i >= 0 && i < m_edits.piecesCount() && m_edits.pieceStart(i) < endFrame; i++)
     {
-        min = getSample(startFrame, channelIndex);
-        max = getSample(startFrame, channelIndex);
+        EditList::Piece piece      = m_edits.piece(i);
+        qint64          pieceStart = m_edits.pieceStart(i);
+        
+        // Part of the piece which lies in the range, in source frames
+        qint64 sourceStart = piece.sourceFrame + std::max<qint64>(startFrame - pieceStart, 0);
+        qint64 sourceEnd   = piece.sourceFrame + std::min(endFrame - pieceStart, piece.framesCount);
+        
+        PeakPyramid *peaks       = piece.block ? &piece.block->peaks : &m_peaks;
+        const uchar *frames      = piece.block ? piece.block->frames.data() : sourceFrameData(0);
+        qint64       loadedCount = piece.block ? piece.block->framesCount : loadedFramesCount();
+        
+        if (!getSourceMinMax(peaks, frames, loadedCount, sourceStart, sourceEnd, channelIndex, min, max))
+            return false;
     }
     
+    return true;
+    
 }
 
 
-/* Remove a given number of audio frames. */
-void WavBuffer::cutBlock(uint startFrame, uint endFrame)
+/* Update min/max with the samples of a range of source frames for a given channel index.
+ *
+ * The source frames are those of the file or of a block, given with their pyramid, their first frame and the number
+ * of frames loaded. Whole blocks of the range are read from the peak pyramid, only the unaligned edges are read sample by sample.
+ * It returns false if a block of the range belongs to a chunk of the pyramid which is not computed yet, or if an edge is not loaded. */
+bool WavBuffer::getSourceMinMax(PeakPyramid *peaks, const uchar *frames, qint64 loadedCount, qint64 startFrame, qint64 endFrame, int channelIndex, int& min, int& max)
 {
     
-    buffer().remove(44 + std::min(startFrame, endFrame) * bytesPerFrame(), (abs((int)(endFrame - startFrame)) + 1) * bytesPerFrame());
-    setAudioSize(audioSize() - abs((int)(endFrame - startFrame)) + 1);
+    qint64 frame = startFrame;
+    
+    while (frame < endFrame)
+    {
+        int level = peaks->isEmpty() ? -1 : peaks->levelAt(frame, endFrame);
+        
+        if (level >= 0)  // A whole block fits in the range
+        {
+            if (level <= PeakPyramid::chunkLevel && !peaks->isChunkReady(frame / PeakPyramid::chunkSize))
+                return false;
+            
+            PeakPyramid::Peak peak = peaks->peak(level, frame, channelIndex);
+            min    = std::min(min, peak.min);
+            max    = std::max(max, peak.max);
+            frame += peaks->blockSize(level);
+        }
+        else  // Read samples up to the next block boundary
+        {
+            qint64 blockEnd = std::min(endFrame, (frame | (PeakPyramid::baseBlockSize - 1)) + 1);
+            
+            if (blockEnd > loadedCount)
+                return false;
+            
+            SampleKernels::minMaxChannel(frames + frame * bytesPerFrame(), blockEnd - frame, channelsCount(), sampleFormat(), channelIndex, min, max);
+            frame = blockEnd;
+        }
+    }
+    
+    return true;
     
 }
 
 
-/* Write new audio size in the file header. */
-void WavBuffer::setAudioSize(int newAudioSize)
+/* Copy the raw bytes of consecutive logical frames into a buffer.
+ *
+ * The frames may span several pieces of the edit list. Another edit list than the one
+ * of the WavBuffer can be given, for threads which work on a copy of it.
+ * It returns the number of frames copied, which is smaller than framesCount at the end of the audio. */
+qint64 WavBuffer::readFrames(qint64 startFrame, char *data, qint64 framesCount, EditList *edits)
 {
     
-    // Extract individual bytes and reorder them in little endian
-    QByteArray newAudioSizeBytes;
+    qint64 copied = 0;
+    
+    if (!edits)
+        edits = &m_edits;
+    
+    for (int i = edits->pieceAt(startFrame); i >= 0 && i < edits->piecesCount() && copied < framesCount; i++)
+    {
+        EditList::Piece piece  = edits->piece(i);
+        qint64          offset = std::max<qint64>(startFrame + copied - edits->pieceStart(i), 0);
+        qint64          count  = std::min(piece.framesCount - offset, framesCount - copied);
+        
+        memcpy(data + copied * bytesPerFrame(), frameData(piece, offset), count * bytesPerFrame());
+        copied += count;
+    }
+    
+    return copied;
+    
+}
 
-    for (int i = 0 ; i < 4 ; i++, newAudioSize >>= 8 )
-        newAudioSizeBytes.push_back((char)(newAudioSize & 0xFF));
 
-    buffer().replace(40, 4, newAudioSizeBytes);
+/* Read the samples of the file through the planar cache or straight from the interleaved frames.
+ *
+ * The cache is emptied when it is disabled. Threads which read samples must not be running. */
+void WavBuffer::setPlanarCacheEnabled(bool enabled)
+{
+    
+    m_planarCacheEnabled = enabled;
+    
+    if (!enabled)
+        m_planarCache.clear();
+    
+}
+
+
+/* Remove the audio frames between two frame numbers (both included).
+ *
+ * Only the edit list is updated: the audio data is left untouched, and the cut can be undone.
+ * The size fields of the header are written on export, see header(). */
+void WavBuffer::cutBlock(qint64 startFrame, qint64 endFrame)
+{
+    
+    qint64 firstFrame = std::min(startFrame, endFrame);
+    
+    m_edits.cut(firstFrame, firstFrame + std::abs(endFrame - startFrame) + 1);
+    
+}
+
+
+/* Replace the logical frames in [startFrame, endFrame) by all the frames of a block.
+ *
+ * As for a cut, only the edit list is updated, and the edit can be undone: the block is kept by the edit history. */
+void WavBuffer::replaceFrames(qint64 startFrame, qint64 endFrame, QSharedPointer<AudioBlock> block)
+{
+    m_edits.replace(startFrame, endFrame, {0, block->framesCount, block});
+}
+
+
+/* Get a pointer to the frame at a given offset in a piece of an edit list. */
+const uchar* WavBuffer::frameData(const EditList::Piece &piece, qint64 offset)
+{
+    
+    if (piece.block)
+        return piece.block->frames.data() + (piece.sourceFrame + offset) * m_bytesPerFrame;
+    
+    return sourceFrameData(piece.sourceFrame + offset);
+    
+}
 
+
+/* Build a WAV header for the current audio size.
+ *
+ * A standard RIFF header is built when the sizes fit on 32 bits, otherwise an RF64
+ * header with a ds64 chunk. The "fmt " chunk of the original file is kept as is. */
+QByteArray WavBuffer::header()
+{
+    
+    QByteArray formatChunk((const char*) m_data + m_fmtOffset, 8 + m_fmtSize + (m_fmtSize & 1));
+    
+    // Size of everything after the RIFF size field, including the pad byte of odd-sized audio data
+    qint64 riffSize = 4 + formatChunk.size() + 8 + audioSize() + (audioSize() & 1);
+    
+    QByteArray bytes;
+    
+    if (riffSize <= maxRiffSize && audioSize() < maxRiffSize)
+    {
+        bytes.append("RIFF");
+        appendLittleEndian(bytes, riffSize, 4);
+        bytes.append("WAVE");
+        bytes.append(formatChunk);
+        bytes.append("data");
+        appendLittleEndian(bytes, audioSize(), 4);
+    }
+    else
+    {
+        riffSize += 8 + 28;  // ds64 chunk
+        
+        bytes.append("RF64");
+        appendLittleEndian(bytes, maxRiffSize, 4);
+        bytes.append("WAVE");
+        bytes.append("ds64");
+        appendLittleEndian(bytes, 28, 4);
+        appendLittleEndian(bytes, riffSize, 8);
+        appendLittleEndian(bytes, audioSize(), 8);
+        appendLittleEndian(bytes, framesCount(), 8);
+        appendLittleEndian(bytes, 0, 4);  // No table of other chunk sizes
+        bytes.append(formatChunk);
+        bytes.append("data");
+        appendLittleEndian(bytes, maxRiffSize, 4);
+    }
+    
+    return bytes;
+    
+}
+
+
+/* Write the whole WAV file (header and edited audio data) to an open device.
+ *
+ * The pieces of the edit list are written one after the other, by blocks,
+ * so files larger than a QByteArray can be exported with constant memory.
+ * When the device is a file (QFile or QSaveFile), the pieces which read the file opened
+ * are copied from file to file by the kernel (see copyFileRange), unless file copy is disabled. */
+bool WavBuffer::exportTo(QIODevice *device)
+{
+    
+    QFileDevice *outputFile = qobject_cast<QFileDevice*>(device);
+    bool         copyFiles  = m_fileCopyEnabled && outputFile && outputFile->handle() >= 0 && m_file.isOpen();
+    
+    if (device->write(header()) < 0)
+        return false;
+    
+    for (int i = 0; i < m_edits.piecesCount(); i++)
+    {
+        EditList::Piece piece     = m_edits.piece(i);
+        const char     *pieceData = (const char*) frameData(piece, 0);
+        qint64          pieceSize = piece.framesCount * bytesPerFrame();
+        qint64          offset    = 0;
+        
+        // The bytes buffered by the device are written first, the kernel writes at the file position
+        if (copyFiles && !piece.block)
+        {
+            if (!outputFile->flush())
+                return false;
+            
+            qint64 position = outputFile->pos();
+            
+            offset = copyFileRange(m_file.handle(), m_dataOffset + piece.sourceFrame * bytesPerFrame(),
+                                   outputFile->handle(), position, pieceSize);
+            
+            if (offset > 0 && !outputFile->seek(position + offset))
+                return false;
+        }
+        
+        for (; offset < pieceSize; offset += exportBlockSize)
+        {
+            qint64 blockSize = std::min(exportBlockSize, pieceSize - offset);
+            
+            if (device->write(pieceData + offset, blockSize) != blockSize)
+                return false;
+        }
+    }
+    
+    // Chunks are word-aligned
+    if ((audioSize() & 1) && device->write("\0", 1) != 1)
+        return false;
+    
+    return true;
+    
 }
@@ -1,55 +1,149 @@
 #ifndef WAVBUFFER_H
 #define WAVBUFFER_H
 
+#include <QAtomicInteger>
 #include <QBuffer>
+#include <QFile>
+#include <QIODevice>
 #include <QString>
 #include <QVector>
 
+#include "audioblock.h"
+#include "editlist.h"
+#include "peakpyramid.h"
+#include "planarcache.h"
+#include "samplekernels.h"
+
 
 /* Main class to deal with WAV files
  *
  * It allows loading WAV files and get audio info.
  * It also gives access to a buffer containing the raw audio data.
+ * By default, the file is memory-mapped and samples are read straight from the mapping.
+ * A file can also be opened in two steps, from a worker thread (see FileLoader): openFile only
+ * reads the header, then loadFrames reads the audio data progressively. Meanwhile, samples are only
+ * read from the frames already loaded, so that the waveform can be drawn while the file is read.
+ *
+ * The audio data itself is never modified: edits are recorded in an EditList and
+ * every access to frames goes through it. Frames changed by an edit are read from
+ * the AudioBlock of their piece instead of the file. Frame numbers given to the public methods
+ * are logical frames (frames of the edited audio), unless stated otherwise.
+ *
+ * Frames and byte offsets are 64-bit, and RF64/BW64 files (where the
+ * sizes are stored in a ds64 chunk) are supported for reading and writing.
+ *
+ * Samples may be 8, 16, 24 or 32-bit integers or 32/64-bit floats, in plain or
+ * WAVE_FORMAT_EXTENSIBLE files. They are decoded by the kernels of SampleKernels,
+ * see there for their range. With planarMinChannels channels or more, the samples of the
+ * file read by channel are decoded through a PlanarCache, which stores them channel by channel.
  */
 class WavBuffer : public QBuffer
 {
     Q_OBJECT
     
 public:
+    enum LoadMode
+    {
+        LoadInMemory,  // Read the whole file in the QBuffer
+        LoadMapped     // Map the file in memory and read samples straight from the mapping
+    };
+    
+    ~WavBuffer();
+    
     // Getters
-    int         audioSize()      {return m_audioSize;};
+    qint64      audioSize()      {return framesCount() * m_bytesPerFrame;};
     int         bitDepth()       {return m_bitDepth;};
+    SampleKernels::SampleFormat sampleFormat() {return m_sampleFormat;};
     int         bytesPerSample() {return m_bytesPerSample;};
     int         bytesPerFrame()  {return m_bytesPerFrame;};
     int         channelsCount()  {return m_channelsCount;};
-    int         framesCount()    {return m_framesCount;};
+    qint64      framesCount()    {return m_edits.framesCount();};
     int         sampleRate()     {return m_sampleRate;};
     QString     filePath()       {return m_filePath;};
     const char* error()          {return m_error;};
+    PeakPyramid* peaks()         {return &m_peaks;};
+    bool        isMapped()       {return m_mappedData != nullptr;};
+    EditList*   edits()          {return &m_edits;};
+    PlanarCache* planarCache()   {return &m_planarCache;};
+    
+    // Source frames whose audio data is read already (see loadFrames)
+    qint64      loadedFramesCount()  {return m_loadedFrames.loadAcquire();};
+    bool        isLoaded()           {return loadedFramesCount() == m_framesCount;};
+    
+    // Samples read by channel can be decoded through a cache which stores them channel by channel
+    bool isPlanarCacheEnabled()  {return m_planarCacheEnabled;};
+    void setPlanarCacheEnabled(bool enabled);
     
-    bool loadFile(const char *filePath);
+    // Frames of the file can be exported to a file by the kernel, without being copied through memory
+    bool isFileCopyEnabled()               {return m_fileCopyEnabled;};
+    void setFileCopyEnabled(bool enabled)  {m_fileCopyEnabled = enabled;};
     
-    int getSample(int frameNumber, int channelNumber);
-    void getMinMaxSampleValueInRange(int startFrame, int range, int channelIndex, int& min, int&max);
+    // Frames of the audio data of the file, before any edit
+    qint64       sourceFramesCount()                     {return m_framesCount;};
+    const uchar* sourceFrameData(qint64 sourceFrame)     {return m_data + m_dataOffset + sourceFrame * m_bytesPerFrame;};
+    qint64       dataOffset()                            {return m_dataOffset;};
     
-    void cutBlock(uint startFrame, uint endFrame);
-    void setAudioSize(int framesCount);
+    // Frames a piece of an edit list reads from, in the file or in its block
+    const uchar* frameData(const EditList::Piece &piece, qint64 offset);
+    
+    bool loadFile(const char *filePath, LoadMode mode = LoadMapped);
+    bool openFile(const char *filePath, LoadMode mode = LoadMapped);
+    qint64 loadFrames(qint64 framesCount);
+    bool exportTo(QIODevice *device);
+    QByteArray header();
+    
+    int getSample(qint64 frameNumber, int channelNumber);
+    qint64 readSamples(qint64 startFrame, qint64 framesCount, int channelIndex, int *samples, EditList *edits = nullptr);
+    qint64 readFrames(qint64 startFrame, char *data, qint64 framesCount, EditList *edits = nullptr);
+    bool getMinMaxSampleValueInRange(qint64 startFrame, qint64 range, int channelIndex, int& min, int&max);
+    
+    void cutBlock(qint64 startFrame, qint64 endFrame);
+    void replaceFrames(qint64 startFrame, qint64 endFrame, QSharedPointer<AudioBlock> block);
+    void undo()    {m_edits.undo();};
+    void redo()    {m_edits.redo();};
+    bool canUndo() {return m_edits.canUndo();};
+    bool canRedo() {return m_edits.canRedo();};
     
 private:
-    int m_audioSize;
-    int m_bitDepth;
-    int m_bytesPerSample;
-    int m_bytesPerFrame;
-    int m_channelsCount;
-    int m_framesCount;
-    int m_sampleRate;
+    int    m_bitDepth;
+    int    m_bytesPerSample;
+    int    m_bytesPerFrame;
+    int    m_channelsCount;
+    qint64 m_framesCount;  // Frames count of the source audio data
+    int    m_sampleRate;
+    SampleKernels::SampleFormat  m_sampleFormat = SampleKernels::InvalidFormat;
+    SampleKernels::SampleDecoder m_decodeSample = nullptr;  // Decoder of single samples of the format
     QString     m_filePath = "";  // Contains the path to the audio WAV file
     const char *m_error    = "";  // Contains the error message of the last error
+    PeakPyramid m_peaks;          // Min/max summary of the source samples, used to draw the waveform quickly
+    EditList    m_edits;          // Edits applied to the source audio data
+    PlanarCache m_planarCache;    // Source samples stored channel by channel, read by readSamples when enabled
+    bool        m_planarCacheEnabled = false;
+    bool        m_fileCopyEnabled    = true;
+    
+    // Raw bytes of the file: they point either to the file mapping or to the QBuffer
+    QFile   m_file;
+    uchar       *m_mappedData = nullptr;
+    const uchar *m_data       = nullptr;
+    qint64       m_dataSize   = 0;
+    qint64       m_bytesRead  = 0;  // Bytes of the file read in the QBuffer, when it is not mapped
+    
+    QAtomicInteger<qint64> m_loadedFrames;  // Written by the thread which loads the file, read by all
+    
+    // Position of the chunks in the raw bytes
+    qint64  m_fmtOffset  = 0;  // Start of the "fmt " chunk, including its 8-byte chunk header
+    qint64  m_fmtSize    = 0;  // Size of the "fmt " chunk content
+    qint64  m_dataOffset = 0;  // First byte of audio data
+    
+    int     getByte(qint64 index) {return m_data[index];};
+    quint64 getLittleEndian(qint64 index, int bytesCount);
     
-    int getByte(int index) {return (int)(unsigned char)buffer().at(index);};
+    bool getSourceMinMax(PeakPyramid *peaks, const uchar *frames, qint64 loadedCount, qint64 startFrame, qint64 endFrame, int channelIndex, int& min, int& max);
     
-    bool headerIsValid(const QByteArray&);
-    void readInfo();
+    bool headerIsValid();
+    bool readInfo();
+    bool readHeaderBytes();
+    bool readRawBytes(qint64 endByte);
     
 };
 
@@ -0,0 +1,63 @@
+#include <algorithm>
+#include <cmath>
+
+#include "waveformrasterizer.h"
+
+
+// Half of the width of the pen: it spreads by as much around the line, and past its ends (square caps)
+static const double penHalfWidth = 1.5;
+
+
+/* The pointer to the pixels is taken once: the image must not be painted on or copied while the rasterizer is used. */
+WaveformRasterizer::WaveformRasterizer(QImage &image, int windowTop, int windowHeight, const QColor &color)
+{
+    
+    m_bits         = image.bits();
+    m_bytesPerLine = image.bytesPerLine();
+    m_width        = image.width();
+    m_height       = image.height();
+    m_windowTop    = windowTop;
+    m_rowsPerValue = (double) image.height() / windowHeight;
+    
+    m_fullColor = qPremultiply(color.rgb());
+    m_halfColor = qPremultiply(qRgba(color.red(), color.green(), color.blue(), 128));
+    
+}
+
+
+/* A line drawn at x covers the pixels [x - 1.5, x + 1.5]: pixels x - 1 and x fully, pixels x - 2 and x + 1 by half.
+ * Rows are covered from the top of the line to its bottom, extended by the half width of the pen. */
+void WaveformRasterizer::drawColumn(int x, int min, int max)
+{
+    
+    double top    = (max - m_windowTop) * m_rowsPerValue;
+    double bottom = (min - m_windowTop) * m_rowsPerValue;
+    
+    if (top > bottom)
+        std::swap(top, bottom);
+    
+    int firstRow    = std::max(0,            (int) std::floor(top - penHalfWidth));
+    int lastRow     = std::min(m_height - 1, (int) std::ceil(bottom + penHalfWidth) - 1);
+    int firstColumn = std::max(0,            x - 2);
+    int lastColumn  = std::min(m_width - 1,  x + 1);
+    
+    if (firstRow > lastRow || firstColumn > lastColumn)
+        return;
+    
+    for (int row = firstRow; row <= lastRow; row++)
+    {
+        QRgb *line = (QRgb*) (m_bits + (qptrdiff) row * m_bytesPerLine);
+        
+        for (int column = firstColumn; column <= lastColumn; column++)
+        {
+            bool full = (column == x - 1 || column == x);
+            
+            // Pixels only ever get the color at full or half coverage: keep the highest one
+            if (full)
+                line[column] = m_fullColor;
+            else if (line[column] != m_fullColor)
+                line[column] = m_halfColor;
+        }
+    }
+    
+}
@@ -0,0 +1,39 @@
+#ifndef WAVEFORMRASTERIZER_H
+#define WAVEFORMRASTERIZER_H
+
+#include <QColor>
+#include <QImage>
+
+
+/* Direct drawing of min/max waveform columns into the scanlines of an image
+ *
+ * It gives the same shape as a QPainter drawing the columns as vertical lines with
+ * an antialiased 3-pixel cosmetic pen, without going through the paint engine:
+ * each column only fills a short span of pixels in a few scanlines.
+ * Sample values are mapped to rows like the window of the QPainter (top and height
+ * as given to QPainter::setWindow, the height is negative for values going up).
+ * The image must be in the ARGB32_Premultiplied format; all the columns have the same
+ * color, so overlapping columns keep the highest coverage of each pixel.
+ */
+class WaveformRasterizer
+{
+    
+public:
+    WaveformRasterizer(QImage &image, int windowTop, int windowHeight, const QColor &color);
+    
+    // Draw the column of values [min, max] centered on pixel column x (columns out of the image are clipped)
+    void drawColumn(int x, int min, int max);
+    
+private:
+    uchar  *m_bits;
+    int     m_bytesPerLine;
+    int     m_width;
+    int     m_height;
+    double  m_windowTop;
+    double  m_rowsPerValue;
+    QRgb    m_fullColor;  // Premultiplied colors of the pixels fully and half covered by the pen
+    QRgb    m_halfColor;
+    
+};
+
+#endif // WAVEFORMRASTERIZER_H
@@ -0,0 +1,125 @@
+#include <cstring>
+
+#include "waveformtilecache.h"
+
+
+/* The cost of a tile is its size in KB. */
+WaveformTileCache::WaveformTileCache(int maxSizeKB)
+{
+    m_tiles.setMaxCost(maxSizeKB);
+}
+
+
+/* Set the height of the tiles, dropping the tiles of another height. */
+void WaveformTileCache::setTileHeight(int height)
+{
+    
+    if (height == m_tileHeight)
+        return;
+    
+    m_tiles.clear();
+    m_tileHeight = height;
+    
+}
+
+
+/* Add a rendered tile to the cache. */
+void WaveformTileCache::insert(int channel, int scale, qint64 index, const QImage &image)
+{
+    m_tiles.insert({channel, scale, index}, new QImage(image), image.byteCount() / 1024 + 1);
+}
+
+
+/* Integer division rounded down, also for negative columns. */
+static qint64 floorDivide(qint64 numerator, qint64 denominator)
+{
+    return numerator / denominator - (numerator % denominator < 0 ? 1 : 0);
+}
+
+
+/* Update the tiles after an edit which changed the frames [changedFrom, changedTo), the following
+ * frames being moved by shift frames (see EditList).
+ *
+ * The tiles before the change are kept. A pixel column shows the pen of the columns up to tileMargin
+ * after it and 1 before it, so a tile is kept only if none of them reaches the change.
+ * After the change, at the scales which divide the shift, columns show the same frames as before,
+ * only moved by shift / scale columns: the tiles are moved as well, put together from the (at most
+ * two) old tiles they overlap. The other tiles are dropped, they will be rendered again if needed.
+ * Tiles which only show the same frames when the shift is also a multiple of some alignment
+ * (the hop of a spectrogram) are only moved in that case.
+ * The work depends on the number of tiles in the cache, never on the length of the audio. */
+void WaveformTileCache::applyEdit(qint64 changedFrom, qint64 changedTo, qint64 shift, qint64 alignment)
+{
+    
+    QHash<TileKey, QImage*> moved;  // Tiles after the change, with their keys before it
+    
+    for (const TileKey &key : m_tiles.keys())
+    {
+        if (((key.index + 1) * tileWidth + tileMargin) * key.scale <= changedFrom)
+            continue;
+        
+        QImage *image = m_tiles.take(key);
+        
+        // The first column which spreads over the tile must be after the change, which started at changedTo - shift
+        if (shift % key.scale == 0 && shift % alignment == 0 && (key.index * tileWidth - 1) * key.scale >= changedTo - shift)
+            moved.insert(key, image);
+        else
+            delete image;
+    }
+    
+    for (auto i = moved.constBegin(); i != moved.constEnd(); ++i)
+    {
+        const TileKey &key     = i.key();
+        qint64         columns = shift / key.scale;
+        qint64         start   = key.index * tileWidth + columns;  // Where the old tile starts now
+        
+        // New tiles which show some of the columns of the old one
+        for (qint64 index = floorDivide(start, tileWidth); index <= floorDivide(start + tileWidth - 1, tileWidth); index++)
+        {
+            if (index < 0 || m_tiles.contains({key.channel, key.scale, index}))
+                continue;
+            
+            // The new tile shows the end of an old tile from offset, then the start of the next one
+            qint64  oldColumn = index * tileWidth - columns;
+            qint64  oldIndex  = floorDivide(oldColumn, tileWidth);
+            int     offset    = oldColumn - oldIndex * tileWidth;
+            QImage *first     = moved.value({key.channel, key.scale, oldIndex});
+            QImage *second    = moved.value({key.channel, key.scale, oldIndex + 1});
+            
+            if (!first || (offset > 0 && !second))
+                continue;
+            
+            if (offset == 0)
+            {
+                insert(key.channel, key.scale, index, *first);
+                continue;
+            }
+            
+            // Only the columns which are shown are copied, the margins are left transparent
+            QImage image(first->size(), first->format());
+            image.fill(Qt::transparent);
+            
+            for (int y = 0; y < image.height(); y++)
+            {
+                QRgb       *line       = (QRgb*) image.scanLine(y) + tileMargin;
+                const QRgb *firstLine  = (const QRgb*) first->constScanLine(y) + tileMargin;
+                const QRgb *secondLine = (const QRgb*) second->constScanLine(y) + tileMargin;
+                
+                memcpy(line, firstLine + offset, (tileWidth - offset) * sizeof(QRgb));
+                memcpy(line + tileWidth - offset, secondLine, offset * sizeof(QRgb));
+            }
+            
+            insert(key.channel, key.scale, index, image);
+        }
+    }
+    
+    qDeleteAll(moved);
+    
+}
+
+
+/* Drop all the tiles. */
+void WaveformTileCache::clear()
+{
+    m_tiles.clear();
+}
@@ -0,0 +1,61 @@
+#ifndef WAVEFORMTILECACHE_H
+#define WAVEFORMTILECACHE_H
+
+#include <QCache>
+#include <QHash>
+#include <QImage>
+
+
+/* Cache of rendered waveform images
+ *
+ * The waveform of each channel is cut into tiles of tileWidth pixel columns.
+ * At a given scale, column c shows the frames [c * scale, (c + 1) * scale),
+ * so a tile is identified by its channel, the scale and its index. All the
+ * tiles have the same height; changing it empties the cache.
+ * The images have tileMargin more columns on each side, which are not shown:
+ * the pen of the columns next to a tile spreads over its edges.
+ * The least recently used tiles are dropped when the cache is full.
+ */
+class WaveformTileCache
+{
+    
+public:
+    static const int tileWidth  = 256;
+    static const int tileMargin = 2;
+    
+    struct TileKey
+    {
+        int    channel;
+        int    scale;
+        qint64 index;
+        
+        bool operator==(const TileKey &other) const
+        {
+            return channel == other.channel && scale == other.scale && index == other.index;
+        }
+    };
+    
+    WaveformTileCache(int maxSizeKB = 64 * 1024);
+    
+    int     tileHeight()                                {return m_tileHeight;};
+    void    setTileHeight(int height);
+    
+    QImage* tile(int channel, int scale, qint64 index)  {return m_tiles.object({channel, scale, index});};
+    void    insert(int channel, int scale, qint64 index, const QImage &image);
+    
+    void    applyEdit(qint64 changedFrom, qint64 changedTo, qint64 shift, qint64 alignment = 1);
+    void    clear();
+    
+private:
+    QCache<TileKey, QImage> m_tiles;
+    int                     m_tileHeight = 0;
+    
+};
+
+
+inline uint qHash(const WaveformTileCache::TileKey &key, uint seed = 0)
+{
+    return qHash(key.index, seed) ^ qHash(key.scale, seed) ^ (uint) key.channel;
+}
+
+#endif // WAVEFORMTILECACHE_H